@@ -1,687 +1,7428 @@
-#include <iostream>
-#include <string>
-using namespace std;
-
-
-struct UserNode;
-
-struct FriendNode {
-    UserNode* user; 
-    FriendNode* next;
-};
-
-struct MessageNode {
-    UserNode* sender; 
-    string text;
-    MessageNode* next;
-};
-
-struct UserNode {
-    string name, id, city, interest, institution;
-    UserNode* left;
-    UserNode* right;
-    FriendNode* friends; 
-    FriendNode* pendingRequests; 
-    MessageNode* messages; 
-};
-
-struct GroupMemberNode {
-    UserNode* user;
-    GroupMemberNode* next;
-};
-
-struct GroupNode {
-    string groupName;
-    GroupMemberNode* members;
-    GroupNode* next;
-};
-
-class Profile {
-    UserNode* root; // BST root
-    GroupNode* groupHead; // linked list of groups
-
-public:
-    Profile() : root(NULL), groupHead(NULL) {}
-    ~Profile() { clearUsers(root); clearGroups(); }
-
-    // BST insert
-    UserNode* addUser(UserNode* current, UserNode* newUser) {
-        if (!current) return newUser;
-        if (newUser->id < current->id)
-            current->left = addUser(current->left, newUser);
-        else if (newUser->id > current->id)
-            current->right = addUser(current->right, newUser);
-        return current;
-    }
-
-    void makeProfile() {
-        UserNode* newUser = new UserNode;
-        newUser->left = newUser->right = NULL;
-        newUser->friends = NULL;
-        newUser->pendingRequests = NULL;
-        newUser->messages = NULL;
-        
-        cout << "Enter your name: "; getline(cin, newUser->name);
-        if(newUser->name.empty()){ cout << "Name cannot be empty.\n"; delete newUser; return; }
-
-        cout << "Enter your id/Number: "; getline(cin, newUser->id);
-        if(newUser->id.empty()){ cout << "ID cannot be empty.\n"; delete newUser; return; }
-
-        cout << "Enter your city: "; getline(cin, newUser->city);
-        cout << "Enter your interests: "; getline(cin, newUser->interest);
-        cout << "Enter Your institution: "; getline(cin, newUser->institution);
-        
-        if (findUser(root, newUser->id)) {
-            cout << "User with this ID already exists!\n";
-            delete newUser;
-            return;
-        }
-        root = addUser(root, newUser);
-        cout << "Profile created successfully!\n";
-    }
-
-    UserNode* findUser(UserNode* current, const string& id) {
-        if (!current) return NULL;
-        if (id == current->id) return current;
-        if (id < current->id) return findUser(current->left, id);
-        return findUser(current->right, id);
-    }
-
-    void sendFriendRequest(const string& senderId, const string& receiverId) {
-        if (senderId == receiverId) {
-            cout << "You cannot send a friend request to yourself.\n";
-            return;
-        }
-        UserNode* sender = findUser(root, senderId);
-        UserNode* receiver = findUser(root, receiverId);
-        if (!sender || !receiver) {
-            cout << "Invalid user IDs. Friend request not sent.\n";
-            return;
-        }
-        if (areFriends(sender, receiver)) {
-            cout << "You are already friends.\n";
-            return;
-        }
-        if (hasPendingRequest(receiver, sender) || hasPendingRequest(sender, receiver)) {
-            cout << "A friend request is already pending between you two.\n";
-            return;
-        }
-        // Add a pending request to the receiver's list
-        FriendNode* req = new FriendNode;
-        req->user = sender;
-        req->next = receiver->pendingRequests;
-        receiver->pendingRequests = req;
-        cout << "Friend request sent from " << sender->name << " to " << receiver->name << ".\n";
-    }
-
-    void acceptFriendRequest(const string& userId, const string& senderId) {
-        UserNode* user = findUser(root, userId);
-        UserNode* sender = findUser(root, senderId);
-        if (!user || !sender) {
-            cout << "Invalid user IDs. Friend request not accepted.\n";
-            return;
-        }
-        // Find and remove pending request from the user's pending list
-        FriendNode **ptr_to_req = &user->pendingRequests;
-        FriendNode *req_node = user->pendingRequests;
-
-        while(req_node != NULL){
-            if(req_node->user == sender){
-                *ptr_to_req = req_node->next; // Unlink the node
-                delete req_node; // Free the memory for the request node
-
-                // Add each other as friends
-                addFriend(user, sender);
-                addFriend(sender, user);
-                cout << sender->name << " and " << user->name << " are now friends.\n";
-                return;
-            }
-            ptr_to_req = &req_node->next;
-            req_node = req_node->next;
-        }
-        cout << "No pending friend request from " << sender->name << ".\n";
-    }
-
-    void addFriend(UserNode* user, UserNode* friendUser) {
-        if (areFriends(user, friendUser)) return;
-        FriendNode* f = new FriendNode;
-        f->user = friendUser;
-        f->next = user->friends;
-        user->friends = f;
-    }
-
-    bool areFriends(UserNode* a, UserNode* b) {
-        for (FriendNode* curr = a->friends; curr; curr = curr->next) {
-            if (curr->user == b) return true;
-        }
-        return false;
-    }
-
-    bool hasPendingRequest(UserNode* receiver, UserNode* sender) {
-        for (FriendNode* curr = receiver->pendingRequests; curr; curr = curr->next) {
-            if (curr->user == sender) return true;
-        }
-        return false;
-    }
-
-    void sendMessage(const string& senderId, const string& receiverId, const string& message) {
-        UserNode* sender = findUser(root, senderId);
-        UserNode* receiver = findUser(root, receiverId);
-        if (!sender || !receiver) {
-            cout << "Invalid user IDs. Message not sent.\n";
-            return;
-        }
-        if (!areFriends(sender, receiver)) {
-            cout << "You are not friends. Add as friends first before messaging.\n";
-            return;
-        }
-        MessageNode* msg = new MessageNode;
-        msg->sender = sender;
-        msg->text = message;
-        msg->next = receiver->messages;
-        receiver->messages = msg;
-        cout << "Message sent from " << sender->name << " to " << receiver->name << ".\n";
-    }
-
-    void readMessages(const string& userId) {
-        UserNode* user = findUser(root, userId);
-        if (!user) {
-            cout << "Invalid user ID.\n";
-            return;
-        }
-        cout << "Messages for user " << user->name << ":\n";
-        MessageNode* curr = user->messages;
-        if (!curr) cout << "No messages.\n";
-        while (curr) {
-            cout << "From: " << curr->sender->name << " (" << curr->sender->id << ") - Message: " << curr->text << endl;
-            curr = curr->next;
-        }
-    }
-
-    void createGroup(const string& groupName) {
-        if (findGroup(groupName)) {
-            cout << "Group already exists!\n";
-            return;
-        }
-        GroupNode* g = new GroupNode;
-        g->groupName = groupName;
-        g->members = NULL;
-        g->next = groupHead;
-        groupHead = g;
-        cout << "Group " << groupName << " created.\n";
-    }
-
-    void joinGroup(const string& userId, const string& groupName) {
-        UserNode* user = findUser(root, userId);
-        if (!user) {
-            cout << "Invalid user ID. Cannot join the group.\n";
-            return;
-        }
-        GroupNode* group = findGroup(groupName);
-        if (!group) {
-            cout << "Group not found. Create the group first.\n";
-            return;
-        }
-        if (isGroupMember(group, user)) {
-            cout << "User already in group.\n";
-            return;
-        }
-        GroupMemberNode* m = new GroupMemberNode;
-        m->user = user;
-        m->next = group->members;
-        group->members = m;
-        cout << user->name << " joined the group " << groupName << ".\n";
-    }
-
-    void listGroupMembers(const string& groupName) {
-        GroupNode* group = findGroup(groupName);
-        if (!group) {
-            cout << "Group not found.\n";
-            return;
-        }
-        cout << "Members of the group " << groupName << ":\n";
-        GroupMemberNode* curr = group->members;
-        if (!curr) cout << "No members.\n";
-        while (curr) {
-            cout << curr->user->name << " (" << curr->user->id << ")\n";
-            curr = curr->next;
-        }
-    }
-
-    void showMutualFriends(const string& user1Id, const string& user2Id) {
-        UserNode* u1 = findUser(root, user1Id);
-        UserNode* u2 = findUser(root, user2Id);
-        if (!u1 || !u2) {
-            cout << "Invalid user IDs.\n";
-            return;
-        }
-        cout << "Mutual friends between " << u1->name << " and " << u2->name << ":\n";
-        bool found = false;
-        for (FriendNode* f1 = u1->friends; f1; f1 = f1->next) {
-            for (FriendNode* f2 = u2->friends; f2; f2 = f2->next) {
-                if (f1->user == f2->user) {
-                    cout << f1->user->name << " (" << f1->user->id << ")\n";
-                    found = true;
-                }
-            }
-        }
-        if (!found) cout << "No mutual friends.\n";
-    }
-
-    void suggestFriends(const string& userId) {
-        UserNode* user = findUser(root, userId);
-        if (!user) {
-            cout << "Invalid user ID.\n";
-            return;
-        }
-        cout << "Friend suggestions for " << user->name << ":\n";
-        bool found = false;
-        suggestFriendsRec(root, user, found);
-        if (!found) cout << "No suggestions.\n";
-    }
-    void suggestFriendsRec(UserNode* current, UserNode* user, bool& found) {
-        if (!current) return;
-        if (current != user && !areFriends(user, current) && !hasPendingRequest(user, current) && !hasPendingRequest(current, user)) {
-            string reason = "";
-            if (current->city == user->city && !current->city.empty()) reason += "[Same City] ";
-            if (current->interest == user->interest && !current->interest.empty()) reason += "[Same Interest] ";
-            if (current->institution == user->institution && !current->institution.empty()) reason += "[Same Institution]";
-
-            if (!reason.empty()) {
-                 cout << "Name: " << current->name << ", ID: " << current->id << " - Reason: " << reason << endl;
-                 found = true;
-            }
-        }
-        suggestFriendsRec(current->left, user, found);
-        suggestFriendsRec(current->right, user, found);
-    }
-
-    void sendFriendRequestToGroup(const string& userId, const string& groupName) {
-        UserNode* user = findUser(root, userId);
-        GroupNode* group = findGroup(groupName);
-        if (!user || !group) {
-            cout << "Invalid user ID or group name.\n";
-            return;
-        }
-        bool any = false;
-        for (GroupMemberNode* m = group->members; m; m = m->next) {
-            if (m->user != user && !areFriends(user, m->user) && !hasPendingRequest(m->user, user) && !hasPendingRequest(user, m->user)) {
-                sendFriendRequest(userId, m->user->id);
-                any = true;
-            }
-        }
-        if (!any) cout << "No new friend requests sent.\n";
-    }
-
-    void listAllUsers() {
-        cout << "All users:\n";
-        listAllUsersRec(root);
-    }
-    void listAllUsersRec(UserNode* current) {
-        if (!current) return;
-        listAllUsersRec(current->left);
-        cout << current->name << " (" << current->id << ")\n";
-        listAllUsersRec(current->right);
-    }
-
-    void listFriends(const string& userId) {
-        UserNode* user = findUser(root, userId);
-        if (!user) {
-            cout << "Invalid user ID.\n";
-            return;
-        }
-        cout << "Friends of " << user->name << ":\n";
-        bool found = false;
-        for (FriendNode* f = user->friends; f; f = f->next) {
-            cout << f->user->name << " (" << f->user->id << ")\n";
-            found = true;
-        }
-        if (!found) cout << "No friends.\n";
-    }
-
-    void listPendingRequests(const string& userId) {
-        UserNode* user = findUser(root, userId);
-        if (!user) {
-            cout << "Invalid user ID.\n";
-            return;
-        }
-        cout << "Pending friend requests for " << user->name << ":\n";
-        bool found = false;
-        for (FriendNode* req = user->pendingRequests; req; req = req->next) {
-            cout << req->user->name << " (" << req->user->id << ")\n";
-            found = true;
-        }
-        if (!found) cout << "No pending requests.\n";
-    }
-
-    void editProfile(const string& userId) {
-        UserNode* user = findUser(root, userId);
-        if (!user) {
-            cout << "Invalid user ID.\n";
-            return;
-        }
-
-        int choice;
-        string input;
-        while (true) {
-            cout << "\nEdit Profile for " << user->name << ":\n";
-            cout << "1. Edit Name\n";
-            cout << "2. Edit City\n";
-            cout << "3. Edit Interests\n";
-            cout << "4. Edit Institution\n";
-            cout << "0. Back to Main Menu\n";
-            cout << "Enter your choice: ";
-            cin >> choice;
-            if (!cin) {
-                cout << "Invalid input.\n";
-                cin.clear();
-                cin.ignore(10000, '\n');
-                continue;
-            }
-            cin.ignore();
-
-            if (choice == 0) break;
-
-            cout << "Enter new value: ";
-            getline(cin, input);
-            if (input.empty()) {
-                cout << "Input cannot be empty.\n";
-                continue;
-            }
-
-            switch (choice) {
-                case 1: user->name = input; cout << "Name updated.\n"; break;
-                case 2: user->city = input; cout << "City updated.\n"; break;
-                case 3: user->interest = input; cout << "Interests updated.\n"; break;
-                case 4: user->institution = input; cout << "Institution updated.\n"; break;
-                default: cout << "Invalid choice.\n";
-            }
-        }
-    }
-
-    void deleteFriend(const string& userId, const string& friendId) {
-        if (userId == friendId) {
-            cout << "You cannot unfriend yourself.\n";
-            return;
-        }
-        UserNode* user = findUser(root, userId);
-        UserNode* friendUser = findUser(root, friendId);
-        if (!user || !friendUser) {
-            cout << "Invalid user ID(s).\n";
-            return;
-        }
-        if (!areFriends(user, friendUser)) {
-            cout << "You are not friends with this user.\n";
-            return;
-        }
-
-        removeFriend(user, friendUser);
-        removeFriend(friendUser, user);
-        cout << "You are no longer friends with " << friendUser->name << ".\n";
-    }
-
-    void rejectFriendRequest(const string& userId, const string& senderId) {
-        UserNode* user = findUser(root, userId);
-        UserNode* sender = findUser(root, senderId);
-        if (!user || !sender) {
-            cout << "Invalid user IDs.\n";
-            return;
-        }
-
-        FriendNode** pp = &user->pendingRequests;
-        while (*pp) {
-            if ((*pp)->user == sender) {
-                FriendNode* temp = *pp;
-                *pp = (*pp)->next;
-                delete temp;
-                cout << "Friend request from " << sender->name << " rejected.\n";
-                return;
-            }
-            pp = &(*pp)->next;
-        }
-        cout << "No pending request from " << sender->name << " found.\n";
-    }
-
-    void sendGroupMessage(const string& senderId, const string& groupName, const string& message) {
-        UserNode* sender = findUser(root, senderId);
-        if (!sender) {
-            cout << "Invalid sender ID.\n";
-            return;
-        }
-        GroupNode* group = findGroup(groupName);
-        if (!group) {
-            cout << "Group not found.\n";
-            return;
-        }
-        if (!isGroupMember(group, sender)) {
-            cout << "You are not a member of this group.\n";
-            return;
-        }
-
-        int count = 0;
-        for (GroupMemberNode* member = group->members; member; member = member->next) {
-            if (member->user != sender) {
-                MessageNode* msg = new MessageNode;
-                msg->sender = sender;
-                msg->text = message;
-                msg->next = member->user->messages;
-                member->user->messages = msg;
-                count++;
-            }
-        }
-        cout << "Message sent to " << count << " members of group " << groupName << ".\n";
-    }
-
-    void viewUserProfile(const string& userId) {
-        UserNode* user = findUser(root, userId);
-        if (!user) {
-            cout << "User not found.\n";
-            return;
-        }
-        cout << "\n--- User Profile ---\n";
-        cout << "Name: " << user->name << "\n";
-        cout << "ID: " << user->id << "\n";
-        cout << "City: " << user->city << "\n";
-        cout << "Interests: " << user->interest << "\n";
-        cout << "Institution: " << user->institution << "\n";
-        cout << "--------------------\n";
-        listFriends(userId);
-        cout << "--------------------\n";
-    }
-
-private:
-    void removeFriend(UserNode* user, UserNode* friendToRemove) {
-        FriendNode** pp = &user->friends;
-        while (*pp) {
-            if ((*pp)->user == friendToRemove) {
-                FriendNode* temp = *pp;
-                *pp = (*pp)->next;
-                delete temp;
-                return;
-            }
-            pp = &(*pp)->next;
-        }
-    }
-    void clearUsers(UserNode* node) {
-        if (!node) return;
-        clearUsers(node->left);
-        clearUsers(node->right);
-        // Delete friends
-        FriendNode* f = node->friends;
-        while (f) {
-            FriendNode* tmp = f;
-            f = f->next;
-            delete tmp;
-        }
-        // Delete pending requests
-        FriendNode* p = node->pendingRequests;
-        while (p) {
-            FriendNode* tmp = p;
-            p = p->next;
-            delete tmp;
-        }
-        // Delete messages
-        MessageNode* m = node->messages;
-        while (m) {
-            MessageNode* tmp = m;
-            m = m->next;
-            delete tmp;
-        }
-        delete node;
-    }
-    void clearGroups() {
-        GroupNode* g = groupHead;
-        while (g) {
-            GroupMemberNode* m = g->members;
-            while (m) {
-                GroupMemberNode* tmp = m;
-                m = m->next;
-                delete tmp;
-            }
-            GroupNode* tmpg = g;
-            g = g->next;
-            delete tmpg;
-        }
-    }
-    GroupNode* findGroup(const string& groupName) {
-        GroupNode* curr = groupHead;
-        while (curr) {
-            if (curr->groupName == groupName) return curr;
-            curr = curr->next;
-        }
-        return NULL;
-    }
-    bool isGroupMember(GroupNode* group, UserNode* user) {
-        GroupMemberNode* curr = group->members;
-        while (curr) {
-            if (curr->user == user) return true;
-            curr = curr->next;
-        }
-        return false;
-    }
-};
-
-int main() {
-    Profile profile;
-    int choice;
-    while (1) {
-        cout << "\nMenu:\n";
-        cout << "1. Create Profile\n";
-        cout << "2. Create Group\n";
-        cout << "3. Send Friend Request\n";
-        cout << "4. Accept Friend Request\n";
-        cout << "5. Send Message\n";
-        cout << "6. Read Messages\n";
-        cout << "7. List Group Members\n";
-        cout << "8. Show Mutual Friends\n";
-        cout << "9. Send Friend Request to Group Members\n";
-        cout << "10. Suggest Friends\n";
-        cout << "11. List All Users\n";
-        cout << "12. List Friends\n";
-        cout << "13. List Pending Friend Requests\n";
-        cout << "14. Edit Profile\n";
-        cout << "15. Delete Friend\n";
-        cout << "16. Reject Friend Request\n";
-        cout << "17. Send Group Message\n";
-        cout << "18. View User Profile\n";
-        cout << "0. Exit\n";
-        cout << "Enter your choice: ";
-        cin >> choice;
-        if (!(cin)) {
-            cout << "Invalid input. Please enter a number.\n";
-            cin.clear();
-            cin.ignore(10000, '\n');
-            continue;
-        }
-        cin.ignore();
-        if (choice == 1) {
-            profile.makeProfile();
-        } else if (choice == 2) {
-            string groupName;
-            cout << "Enter group name: ";
-            getline(cin, groupName);
-            profile.createGroup(groupName);
-        } else if (choice == 3) {
-            string senderId, receiverId;
-            cout << "Enter sender ID: "; getline(cin, senderId);
-            cout << "Enter receiver ID: "; getline(cin, receiverId);
-            profile.sendFriendRequest(senderId, receiverId);
-        } else if (choice == 4) {
-            string userId, senderId;
-            cout << "Enter your user ID: "; getline(cin, userId);
-            cout << "Enter sender ID: "; getline(cin, senderId);
-            profile.acceptFriendRequest(userId, senderId);
-        } else if (choice == 5) {
-            string senderId, receiverId, message;
-            cout << "Enter sender ID: "; getline(cin, senderId);
-            cout << "Enter receiver ID: "; getline(cin, receiverId);
-            cout << "Enter message: "; getline(cin, message);
-            profile.sendMessage(senderId, receiverId, message);
-        } else if (choice == 6) {
-            string userId;
-            cout << "Enter user ID: "; getline(cin, userId);
-            profile.readMessages(userId);
-        } else if (choice == 7) {
-            string groupName;
-            cout << "Enter group name: "; getline(cin, groupName);
-            profile.listGroupMembers(groupName);
-        } else if (choice == 8) {
-            string user1Id, user2Id;
-            cout << "Enter first user ID: "; getline(cin, user1Id);
-            cout << "Enter second user ID: "; getline(cin, user2Id);
-            profile.showMutualFriends(user1Id, user2Id);
-        } else if (choice == 9) {
-            string userId, groupName;
-            cout << "Enter your user ID: "; getline(cin, userId);
-            cout << "Enter group name: "; getline(cin, groupName);
-            profile.sendFriendRequestToGroup(userId, groupName);
-        } else if (choice == 10) {
-            string userId;
-            cout << "Enter user ID: "; getline(cin, userId);
-            profile.suggestFriends(userId);
-        } else if (choice == 11) {
-            profile.listAllUsers();
-        } else if (choice == 12) {
-            string userId;
-            cout << "Enter user ID: "; getline(cin, userId);
-            profile.listFriends(userId);
-        } else if (choice == 13) {
-            string userId;
-            cout << "Enter user ID: "; getline(cin, userId);
-            profile.listPendingRequests(userId);
-        } else if (choice == 14) {
-            string userId;
-            cout << "Enter your user ID: "; getline(cin, userId);
-            profile.editProfile(userId);
-        } else if (choice == 15) {
-            string userId, friendId;
-            cout << "Enter your user ID: "; getline(cin, userId);
-            cout << "Enter friend's ID to remove: "; getline(cin, friendId);
-            profile.deleteFriend(userId, friendId);
-        } else if (choice == 16) {
-            string userId, senderId;
-            cout << "Enter your user ID: "; getline(cin, userId);
-            cout << "Enter ID of request to reject: "; getline(cin, senderId);
-            profile.rejectFriendRequest(userId, senderId);
-        } else if (choice == 17) {
-            string senderId, groupName, message;
-            cout << "Enter your user ID: "; getline(cin, senderId);
-            cout << "Enter group name: "; getline(cin, groupName);
-            cout << "Enter message: "; getline(cin, message);
-            profile.sendGroupMessage(senderId, groupName, message);
-        } else if (choice == 18) {
-            string userId;
-            cout << "Enter user ID to view: "; getline(cin, userId);
-            profile.viewUserProfile(userId);
-        } else if (choice == 0) {
-            cout << "Exiting program.\n";
-            break;
-        } else {
-            cout << "Invalid choice. Please try again.\n";
-        }
-    }
-    return 0;
-}
-
-
-
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <random>
+#include <iomanip>
+#include <queue>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <new>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cerrno>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#define HAVE_MMAP 1
+#define HAVE_POSIX_IO 1
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+#ifndef PROFILE_METRICS
+#define PROFILE_METRICS 1 // per-operation latency histograms; -DPROFILE_METRICS=0 compiles them out
+#endif
+using namespace std;
+
+
+// Pooled allocator for small fixed-size nodes. Objects are carved out of
+// large slabs and recycled through an intrusive free list, so adding an
+// edge or message costs a pointer pop instead of a malloc.
+template <typename T, size_t SLAB_OBJECTS = 1024>
+class SlabPool {
+    union Slot {
+        Slot* nextFree;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+    vector<Slot*> slabs;
+    Slot* freeList;
+    size_t usedInSlab; // bump position in the newest slab
+    size_t live;
+
+    void freeSlabs() {
+        for (size_t i = 0; i < slabs.size(); i++) delete[] slabs[i];
+        slabs.clear();
+        freeList = NULL;
+        usedInSlab = SLAB_OBJECTS;
+        live = 0;
+    }
+
+    SlabPool(const SlabPool&);
+    SlabPool& operator=(const SlabPool&);
+
+public:
+    SlabPool() : freeList(NULL), usedInSlab(SLAB_OBJECTS), live(0) {}
+    // Only the memory is returned; non-trivial objects must be destroyed first
+    ~SlabPool() { freeSlabs(); }
+
+    T* create() {
+        Slot* slot;
+        if (freeList) {
+            slot = freeList;
+            freeList = freeList->nextFree;
+        } else {
+            if (usedInSlab == SLAB_OBJECTS) {
+                slabs.push_back(new Slot[SLAB_OBJECTS]);
+                usedInSlab = 0;
+            }
+            slot = &slabs.back()[usedInSlab++];
+        }
+        live++;
+        return new (slot->storage) T();
+    }
+    void destroy(T* obj) {
+        if (!obj) return;
+        obj->~T();
+        Slot* slot = reinterpret_cast<Slot*>(obj);
+        slot->nextFree = freeList;
+        freeList = slot;
+        live--;
+    }
+    // Bulk teardown: drops every slab at once without visiting the objects.
+    // Objects with non-trivial destructors must have been destroyed first.
+    void releaseAll() { freeSlabs(); }
+    size_t liveCount() const { return live; }
+    size_t reservedBytes() const { return slabs.size() * SLAB_OBJECTS * sizeof(Slot); }
+};
+
+// FNV-1a, shared by the hashed indexes
+inline uint64_t hashString(const string& s) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < s.size(); i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+struct UserNode;
+struct GroupNode;
+struct GroupMemberNode;
+
+struct FriendNode {
+    UserNode* user; 
+    FriendNode* next;
+    FriendNode* prev;
+};
+
+// Set of per-user nodes (friend edges, pending requests, group members)
+// with O(1) membership and removal. Nodes stay in a doubly linked list
+// (newest first) for listing; once the list outgrows SMALL_SET they are
+// also indexed by an open-addressing table keyed on the user pointer.
+// Node needs user, next and prev fields.
+template <typename Node>
+class UserNodeSet {
+    static const int SMALL_SET = 8;
+
+    Node* head;
+    int count;
+    Node** slots;
+    size_t capacity; // power of two, 0 while the set is small
+
+    static size_t hashPtr(const UserNode* u) {
+        uint64_t x = (uint64_t)(uintptr_t)u;
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        return (size_t)x;
+    }
+    size_t findSlot(const UserNode* u) const {
+        size_t i = hashPtr(u) & (capacity - 1);
+        while (slots[i] && slots[i]->user != u) i = (i + 1) & (capacity - 1);
+        return i;
+    }
+    void rebuild(size_t newCapacity) {
+        delete[] slots;
+        capacity = newCapacity;
+        slots = new Node*[capacity]();
+        for (Node* n = head; n; n = n->next) slots[findSlot(n->user)] = n;
+    }
+    // Backward-shift deletion keeps probe chains intact without tombstones
+    void eraseSlot(size_t i) {
+        size_t j = i;
+        while (true) {
+            j = (j + 1) & (capacity - 1);
+            if (!slots[j]) break;
+            size_t home = hashPtr(slots[j]->user) & (capacity - 1);
+            bool movable = (j > i) ? (home <= i || home > j) : (home <= i && home > j);
+            if (movable) {
+                slots[i] = slots[j];
+                i = j;
+            }
+        }
+        slots[i] = NULL;
+    }
+
+    UserNodeSet(const UserNodeSet&);
+    UserNodeSet& operator=(const UserNodeSet&);
+
+public:
+    UserNodeSet() : head(NULL), count(0), slots(NULL), capacity(0) {}
+    ~UserNodeSet() { delete[] slots; }
+
+    Node* first() const { return head; }
+    int size() const { return count; }
+
+    Node* find(const UserNode* u) const {
+        if (!slots) {
+            for (Node* n = head; n; n = n->next)
+                if (n->user == u) return n;
+            return NULL;
+        }
+        return slots[findSlot(u)];
+    }
+    bool contains(const UserNode* u) const { return find(u) != NULL; }
+
+    // Links a node for a user that is not in the set yet
+    void add(Node* node) {
+        node->prev = NULL;
+        node->next = head;
+        if (head) head->prev = node;
+        head = node;
+        count++;
+        if (slots) {
+            if ((size_t)count * 10 > capacity * 7) rebuild(capacity * 2);
+            else slots[findSlot(node->user)] = node;
+        } else if (count > SMALL_SET) {
+            rebuild(32);
+        }
+    }
+    // Unlinks the node for u and hands it back to the caller (NULL if absent)
+    Node* remove(const UserNode* u) {
+        Node* node;
+        if (slots) {
+            size_t i = findSlot(u);
+            node = slots[i];
+            if (!node) return NULL;
+            eraseSlot(i);
+        } else {
+            node = find(u);
+            if (!node) return NULL;
+        }
+        if (node->prev) node->prev->next = node->next;
+        else head = node->next;
+        if (node->next) node->next->prev = node->prev;
+        count--;
+        return node;
+    }
+    // Detaches every node at once; the caller owns the returned chain
+    Node* release() {
+        Node* chain = head;
+        head = NULL;
+        count = 0;
+        delete[] slots;
+        slots = NULL;
+        capacity = 0;
+        return chain;
+    }
+};
+
+typedef UserNodeSet<FriendNode> FriendSet;
+
+struct MessageNode {
+    UserNode* sender; 
+    string text;
+    uint64_t seq; // Profile-wide message clock: unique, increasing along each inbox and group log
+};
+
+static const size_t MESSAGE_CHUNK = 64;
+
+struct MessageChunk {
+    MessageNode items[MESSAGE_CHUNK];
+};
+
+typedef SlabPool<MessageChunk, 16> MessageChunkPool;
+
+// Search postings of one message log: for each term handle, the log
+// positions whose text contains it, ascending, stored as varint-coded gaps.
+// Positions only ever grow, so adding one is an append to its list. Lists
+// are chains of small blocks in one byte arena per log, so starting a new
+// list costs no allocation of its own.
+class TermPostings {
+public:
+    static constexpr uint32_t BLOCK = 16;                 // 4-byte link to the next block, then data
+    static constexpr uint32_t BLOCK_DATA = BLOCK - 4;
+    static constexpr uint32_t NO_TERM = 0xFFFFFFFFu;
+
+    struct List {
+        uint32_t term;       // NO_TERM in an empty slot
+        uint32_t count;
+        uint32_t last;       // newest position, the base for the next gap
+        uint32_t head, tail; // arena offsets of the first and last block
+        uint32_t tailUsed;   // data bytes written to the last block
+    };
+
+private:
+    List* slots;     // open addressing by term hash
+    size_t capacity; // power of two
+    size_t lists;
+    vector<uint8_t> arena;
+
+    size_t slotOf(uint32_t term) const { return (size_t)((term * 2654435761u) >> 7) & (capacity - 1); }
+    List* emptyTable(size_t n) {
+        List* table = new List[n];
+        for (size_t i = 0; i < n; i++) table[i].term = NO_TERM;
+        return table;
+    }
+    void grow() {
+        List* old = slots;
+        size_t oldCapacity = capacity;
+        capacity *= 2;
+        slots = emptyTable(capacity);
+        for (size_t i = 0; i < oldCapacity; i++) {
+            if (old[i].term == NO_TERM) continue;
+            size_t j = slotOf(old[i].term);
+            while (slots[j].term != NO_TERM) j = (j + 1) & (capacity - 1);
+            slots[j] = old[i];
+        }
+        delete[] old;
+    }
+    uint32_t newBlock() {
+        uint32_t at = (uint32_t)arena.size();
+        arena.resize(at + BLOCK);
+        return at;
+    }
+    void putByte(List& list, uint8_t b) {
+        if (list.tailUsed == BLOCK_DATA) {
+            uint32_t block = newBlock();
+            memcpy(&arena[list.tail], &block, 4);
+            list.tail = block;
+            list.tailUsed = 0;
+        }
+        arena[list.tail + 4 + list.tailUsed++] = b;
+    }
+
+    TermPostings(const TermPostings&);
+    TermPostings& operator=(const TermPostings&);
+
+public:
+    size_t indexed; // log messages indexed so far
+
+    // Sized for the first couple of messages, which is all most inboxes see for a while
+    TermPostings() : capacity(32), lists(0), indexed(0) {
+        slots = emptyTable(capacity);
+        arena.reserve(16 * BLOCK);
+    }
+    ~TermPostings() { delete[] slots; }
+
+    const List* find(uint32_t term) const {
+        for (size_t i = slotOf(term); slots[i].term != NO_TERM; i = (i + 1) & (capacity - 1))
+            if (slots[i].term == term) return &slots[i];
+        return NULL;
+    }
+    // Positions arrive in order; a term repeated within one message is kept once
+    void add(uint32_t term, uint32_t pos) {
+        size_t i = slotOf(term);
+        while (slots[i].term != NO_TERM && slots[i].term != term) i = (i + 1) & (capacity - 1);
+        if (slots[i].term == NO_TERM) {
+            if ((lists + 1) * 10 > capacity * 7) {
+                grow();
+                i = slotOf(term);
+                while (slots[i].term != NO_TERM) i = (i + 1) & (capacity - 1);
+            }
+            uint32_t block = newBlock();
+            List fresh = { term, 0, 0, block, block, 0 };
+            slots[i] = fresh;
+            lists++;
+        } else if (slots[i].last == pos) {
+            return;
+        }
+        List& list = slots[i];
+        uint32_t gap = list.count ? pos - list.last : pos;
+        while (gap >= 0x80) {
+            putByte(list, (uint8_t)(gap | 0x80));
+            gap >>= 7;
+        }
+        putByte(list, (uint8_t)gap);
+        list.last = pos;
+        list.count++;
+    }
+    void decode(const List& list, vector<uint32_t>& out) const {
+        out.resize(list.count);
+        uint32_t block = list.head, used = 0, pos = 0;
+        for (uint32_t i = 0; i < list.count; i++) {
+            uint32_t gap = 0;
+            for (int shift = 0;; shift += 7) {
+                if (used == BLOCK_DATA) {
+                    memcpy(&block, &arena[block], 4);
+                    used = 0;
+                }
+                uint8_t b = arena[block + 4 + used++];
+                gap |= (uint32_t)(b & 0x7F) << shift;
+                if (!(b & 0x80)) break;
+            }
+            pos += gap;
+            out[i] = pos;
+        }
+    }
+
+    size_t listCount() const { return lists; }
+    // Raw slots, for walking every list; NULL for an empty one
+    size_t slotCount() const { return capacity; }
+    const List* slot(size_t i) const { return slots[i].term == NO_TERM ? NULL : &slots[i]; }
+    size_t heapBytes() const { return capacity * sizeof(List) + arena.capacity(); }
+};
+
+// Append-only message sequence stored as a chunked deque: positions map to
+// (chunk, slot) in O(1) and seqs increase with position, so the first
+// message after a given seq is a binary search instead of a list walk.
+class MessageLog {
+    vector<MessageChunk*> chunks;
+    size_t count;
+
+    MessageLog(const MessageLog&);
+    MessageLog& operator=(const MessageLog&);
+
+public:
+    TermPostings* postings; // search index over the log, NULL until first searched or indexed
+
+    MessageLog() : count(0), postings(NULL) {}
+
+    size_t size() const { return count; }
+    const MessageNode& at(size_t pos) const { return chunks[pos / MESSAGE_CHUNK]->items[pos % MESSAGE_CHUNK]; }
+
+    size_t capacity() const { return chunks.size() * MESSAGE_CHUNK; }
+
+    // Takes the text by value so callers can move it in
+    void append(MessageChunkPool& pool, UserNode* sender, string text, uint64_t seq) {
+        if (count == capacity()) chunks.push_back(pool.create());
+        MessageNode& msg = chunks[count / MESSAGE_CHUNK]->items[count % MESSAGE_CHUNK];
+        msg.sender = sender;
+        msg.text.swap(text);
+        msg.seq = seq;
+        count++;
+    }
+    // Chunks for up to total messages, so the appends need no pool
+    void reserve(MessageChunkPool& pool, size_t total) {
+        while (capacity() < total) chunks.push_back(pool.create());
+    }
+    // Position of the first message with a seq greater than the given one
+    size_t firstAfter(uint64_t seq) const {
+        size_t lo = 0, hi = count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (at(mid).seq <= seq) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+    void release(MessageChunkPool& pool) {
+        for (size_t i = 0; i < chunks.size(); i++) pool.destroy(chunks[i]);
+        chunks.clear();
+        count = 0;
+        delete postings;
+        postings = NULL;
+    }
+};
+
+// A private message on its way into the receiver's inbox
+struct InboxItem {
+    atomic<InboxItem*> next;
+    UserNode* sender;
+    string text;
+    uint64_t logSeq; // its WAL_QUEUED_MESSAGE record, 0 without a store
+    uint32_t shard;  // InboxItemPool shard it came from
+};
+
+// Multi-producer single-consumer queue of incoming private messages:
+// Vyukov's intrusive MPSC queue. A sender claims the tail with one exchange
+// and then links the previous tail to its item, so senders on any number of
+// threads never take a lock or wait. Only the owner pops.
+//
+// Items carry no seq: the owner stamps a popped batch from the message
+// clock (see Profile::drainInbox), so seqs rise along the inbox log.
+class InboxQueue {
+    InboxItem stub;          // placeholder that keeps the queue non-empty
+    atomic<InboxItem*> tail; // last item pushed
+    InboxItem* head;         // oldest item, or the stub in front of it
+
+    InboxQueue(const InboxQueue&);
+    InboxQueue& operator=(const InboxQueue&);
+
+public:
+    InboxQueue() : tail(&stub), head(&stub) { stub.next.store(NULL, memory_order_relaxed); }
+
+    // Any thread
+    void push(InboxItem* item) {
+        item->next.store(NULL, memory_order_relaxed);
+        InboxItem* prev = tail.exchange(item, memory_order_acq_rel);
+        prev->next.store(item, memory_order_release);
+    }
+
+    // Owner only. The oldest item, or NULL if there is none or the sender
+    // of the next one has claimed the tail but not linked it yet; that item
+    // is picked up by a later pop instead of being waited for.
+    InboxItem* pop() {
+        InboxItem* item = head;
+        InboxItem* next = item->next.load(memory_order_acquire);
+        if (item == &stub) {
+            if (!next) return NULL;
+            head = item = next;
+            next = item->next.load(memory_order_acquire);
+        }
+        if (next) {
+            head = next;
+            return item;
+        }
+        if (item != tail.load(memory_order_acquire)) return NULL;
+        // item is the last one: put the stub behind it so it can be unlinked
+        push(&stub);
+        next = item->next.load(memory_order_acquire);
+        if (!next) return NULL;
+        head = next;
+        return item;
+    }
+};
+
+// InboxItems come from slab pools split into shards: a sender locks only the
+// shard picked by its thread, so senders rarely meet, and the reader hands a
+// drained batch back with one lock per shard it touches.
+class InboxItemPool {
+    static constexpr uint32_t SHARDS = 16;
+    struct alignas(64) Shard {
+        mutex lock;
+        SlabPool<InboxItem> items;
+    };
+    Shard shards[SHARDS];
+
+public:
+    InboxItem* create() {
+        uint32_t shard = (uint32_t)(hash<thread::id>()(this_thread::get_id()) % SHARDS);
+        InboxItem* item;
+        {
+            lock_guard<mutex> hold(shards[shard].lock);
+            item = shards[shard].items.create();
+        }
+        item->shard = shard;
+        return item;
+    }
+    void destroy(const vector<InboxItem*>& batch) {
+        for (size_t i = 0; i < batch.size();) {
+            uint32_t shard = batch[i]->shard;
+            lock_guard<mutex> hold(shards[shard].lock);
+            for (; i < batch.size() && batch[i]->shard == shard; i++) shards[shard].items.destroy(batch[i]);
+        }
+    }
+};
+
+struct UserNode {
+    string name, id; // city/interest/institution live in UserRecordStore
+    UserNode* left;
+    UserNode* right;
+    int height; // AVL height of the subtree rooted here
+    uint32_t index; // dense 0..n-1 position, assigned at creation
+    FriendSet friends; 
+    FriendSet pendingRequests; 
+    MessageLog inbox; // private messages, oldest first
+    InboxQueue incoming; // sent but not yet moved into inbox (concurrent mode)
+    uint64_t readSeq; // everything up to this message seq has been read
+    GroupMemberNode* groups; // memberships, linked through GroupMemberNode::nextOfUser/prevOfUser
+};
+
+// A membership sits on two lists: the group's members and the user's groups
+struct GroupMemberNode {
+    UserNode* user;
+    GroupNode* group;
+    GroupMemberNode* next;
+    GroupMemberNode* prev;
+    GroupMemberNode* nextOfUser;
+    GroupMemberNode* prevOfUser;
+    size_t joinedAt; // group log position when the user joined
+    vector<size_t> ownPosts; // log positions of this member's own posts
+};
+
+struct GroupNode {
+    string groupName;
+    UserNodeSet<GroupMemberNode> members;
+    MessageLog log; // posts stored once and read by every member
+};
+
+// Groups by name: open-addressing table over GroupNode::groupName plus a
+// creation-ordered list for teardown.
+class GroupRegistry {
+    GroupNode** slots;
+    size_t capacity; // power of two
+    vector<GroupNode*> all;
+
+    void place(GroupNode* g) {
+        size_t i = hashString(g->groupName) & (capacity - 1);
+        while (slots[i]) i = (i + 1) & (capacity - 1);
+        slots[i] = g;
+    }
+
+    GroupRegistry(const GroupRegistry&);
+    GroupRegistry& operator=(const GroupRegistry&);
+
+public:
+    GroupRegistry() : capacity(16) { slots = new GroupNode*[capacity](); }
+    ~GroupRegistry() { delete[] slots; }
+
+    GroupNode* find(const string& name) const {
+        size_t i = hashString(name) & (capacity - 1);
+        while (slots[i]) {
+            if (slots[i]->groupName == name) return slots[i];
+            i = (i + 1) & (capacity - 1);
+        }
+        return NULL;
+    }
+    // Caller checks the name is free
+    void add(GroupNode* g) {
+        if ((all.size() + 1) * 10 > capacity * 7) {
+            delete[] slots;
+            capacity *= 2;
+            slots = new GroupNode*[capacity]();
+            for (size_t i = 0; i < all.size(); i++) place(all[i]);
+        }
+        place(g);
+        all.push_back(g);
+    }
+    size_t size() const { return all.size(); }
+    GroupNode* at(size_t i) const { return all[i]; }
+    void clear() {
+        all.clear();
+        for (size_t i = 0; i < capacity; i++) slots[i] = NULL;
+    }
+};
+
+// Lookup structure for users keyed on UserNode::id.
+// Backends must look up iteratively and list users in id order.
+class UserIndex {
+public:
+    virtual ~UserIndex() {}
+    virtual UserNode* find(const string& id) const = 0;
+    virtual UserNode* find(const string& id, unsigned& steps) const = 0; // counts nodes or slots visited
+    virtual bool insert(UserNode* user) = 0; // false if the id is already taken
+    virtual void reserve(size_t users) = 0;  // room for that many without regrowing
+    virtual void inOrder(vector<UserNode*>& out) const = 0;
+    virtual size_t size() const = 0;
+};
+
+// AVL tree threaded through UserNode::left/right, so sequential ids stay O(log n) deep
+class AVLUserIndex : public UserIndex {
+    UserNode* root;
+    size_t count;
+
+    static int heightOf(UserNode* n) { return n ? n->height : 0; }
+    static void update(UserNode* n) { n->height = 1 + max(heightOf(n->left), heightOf(n->right)); }
+
+    static UserNode* rotateRight(UserNode* y) {
+        UserNode* x = y->left;
+        y->left = x->right;
+        x->right = y;
+        update(y);
+        update(x);
+        return x;
+    }
+    static UserNode* rotateLeft(UserNode* x) {
+        UserNode* y = x->right;
+        x->right = y->left;
+        y->left = x;
+        update(x);
+        update(y);
+        return y;
+    }
+    static UserNode* rebalance(UserNode* n) {
+        update(n);
+        int balance = heightOf(n->left) - heightOf(n->right);
+        if (balance > 1) {
+            if (heightOf(n->left->left) < heightOf(n->left->right)) n->left = rotateLeft(n->left);
+            return rotateRight(n);
+        }
+        if (balance < -1) {
+            if (heightOf(n->right->right) < heightOf(n->right->left)) n->right = rotateRight(n->right);
+            return rotateLeft(n);
+        }
+        return n;
+    }
+    // Recursion depth is bounded by the tree height (~1.44 log n)
+    UserNode* insertRec(UserNode* current, UserNode* newUser, bool& inserted) {
+        if (!current) { inserted = true; return newUser; }
+        if (newUser->id < current->id)
+            current->left = insertRec(current->left, newUser, inserted);
+        else if (newUser->id > current->id)
+            current->right = insertRec(current->right, newUser, inserted);
+        else
+            return current;
+        return inserted ? rebalance(current) : current;
+    }
+
+public:
+    AVLUserIndex() : root(NULL), count(0) {}
+
+    UserNode* find(const string& id) const {
+        UserNode* curr = root;
+        while (curr) {
+            if (id == curr->id) return curr;
+            curr = id < curr->id ? curr->left : curr->right;
+        }
+        return NULL;
+    }
+    UserNode* find(const string& id, unsigned& steps) const {
+        UserNode* curr = root;
+        while (curr) {
+            steps++;
+            if (id == curr->id) return curr;
+            curr = id < curr->id ? curr->left : curr->right;
+        }
+        return NULL;
+    }
+    bool insert(UserNode* user) {
+        user->left = user->right = NULL;
+        user->height = 1;
+        bool inserted = false;
+        root = insertRec(root, user, inserted);
+        if (inserted) count++;
+        return inserted;
+    }
+    void reserve(size_t) {}
+    // Iterative in-order walk with an explicit stack
+    void inOrder(vector<UserNode*>& out) const {
+        vector<UserNode*> stack;
+        UserNode* curr = root;
+        while (curr || !stack.empty()) {
+            while (curr) { stack.push_back(curr); curr = curr->left; }
+            curr = stack.back(); stack.pop_back();
+            out.push_back(curr);
+            curr = curr->right;
+        }
+    }
+    size_t size() const { return count; }
+};
+
+// Open-addressing hash table (linear probing) over UserNode::id
+class HashUserIndex : public UserIndex {
+    UserNode** slots;
+    size_t capacity; // always a power of two
+    size_t count;
+
+    void grow() {
+        UserNode** old = slots;
+        size_t oldCapacity = capacity;
+        capacity *= 2;
+        slots = new UserNode*[capacity]();
+        for (size_t i = 0; i < oldCapacity; i++)
+            if (old[i]) place(old[i]);
+        delete[] old;
+    }
+    void place(UserNode* user) {
+        size_t i = hashString(user->id) & (capacity - 1);
+        while (slots[i]) i = (i + 1) & (capacity - 1);
+        slots[i] = user;
+    }
+    static bool byId(UserNode* a, UserNode* b) { return a->id < b->id; }
+
+public:
+    HashUserIndex() : capacity(16), count(0) { slots = new UserNode*[capacity](); }
+    ~HashUserIndex() { delete[] slots; }
+
+    UserNode* find(const string& id) const {
+        size_t i = hashString(id) & (capacity - 1);
+        while (slots[i]) {
+            if (slots[i]->id == id) return slots[i];
+            i = (i + 1) & (capacity - 1);
+        }
+        return NULL;
+    }
+    UserNode* find(const string& id, unsigned& steps) const {
+        size_t i = hashString(id) & (capacity - 1);
+        while (slots[i]) {
+            steps++;
+            if (slots[i]->id == id) return slots[i];
+            i = (i + 1) & (capacity - 1);
+        }
+        return NULL;
+    }
+    bool insert(UserNode* user) {
+        if (find(user->id)) return false;
+        if ((count + 1) * 10 > capacity * 7) grow(); // keep load factor under 0.7
+        place(user);
+        count++;
+        return true;
+    }
+    void reserve(size_t users) {
+        while (users * 10 > capacity * 7) grow();
+    }
+    // Hashing loses the order, so sort on demand for listings
+    void inOrder(vector<UserNode*>& out) const {
+        size_t first = out.size();
+        for (size_t i = 0; i < capacity; i++)
+            if (slots[i]) out.push_back(slots[i]);
+        sort(out.begin() + first, out.end(), byId);
+    }
+    size_t size() const { return count; }
+};
+
+enum UserIndexKind { INDEX_AVL, INDEX_HASH };
+
+// Sorted-set intersection kernels over ascending, duplicate-free id arrays.
+// Each writes the common ids to out (or only counts them when out is NULL).
+typedef size_t (*IntersectFn)(const uint32_t* a, size_t na, const uint32_t* b, size_t nb, uint32_t* out);
+
+inline size_t intersectMerge(const uint32_t* a, size_t na, const uint32_t* b, size_t nb, uint32_t* out) {
+    size_t i = 0, j = 0, k = 0;
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) i++;
+        else if (a[i] > b[j]) j++;
+        else {
+            if (out) out[k] = a[i];
+            k++; i++; j++;
+        }
+    }
+    return k;
+}
+
+// For skewed sizes: exponential then binary search of each small-side id (na <= nb)
+inline size_t intersectGalloping(const uint32_t* a, size_t na, const uint32_t* b, size_t nb, uint32_t* out) {
+    size_t k = 0, lo = 0;
+    for (size_t i = 0; i < na && lo < nb; i++) {
+        uint32_t x = a[i];
+        size_t step = 1, hi = lo;
+        while (hi < nb && b[hi] < x) { lo = hi + 1; hi += step; step <<= 1; }
+        if (hi > nb) hi = nb;
+        lo = lower_bound(b + lo, b + hi, x) - b;
+        if (lo < nb && b[lo] == x) {
+            if (out) out[k] = x;
+            k++; lo++;
+        }
+    }
+    return k;
+}
+
+#ifdef HAVE_X86_SIMD
+// 4x4 all-pairs block compare: a block of a against every rotation of a block of b
+__attribute__((target("sse4.2,popcnt")))
+inline size_t intersectSSE(const uint32_t* a, size_t na, const uint32_t* b, size_t nb, uint32_t* out) {
+    size_t i = 0, j = 0, k = 0;
+    while (i + 4 <= na && j + 4 <= nb) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + j));
+        __m128i m = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi32(va, vb), _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x39))),
+            _mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x4E)), _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x93))));
+        unsigned mask = (unsigned)_mm_movemask_ps(_mm_castsi128_ps(m));
+        if (out) {
+            while (mask) { out[k++] = a[i + __builtin_ctz(mask)]; mask &= mask - 1; }
+        } else {
+            k += _mm_popcnt_u32(mask);
+        }
+        uint32_t amax = a[i + 3], bmax = b[j + 3];
+        if (amax <= bmax) i += 4;
+        if (bmax <= amax) j += 4;
+    }
+    return k + intersectMerge(a + i, na - i, b + j, nb - j, out ? out + k : NULL);
+}
+
+// 8x8 block compare using lane rotations
+__attribute__((target("avx2,popcnt")))
+inline size_t intersectAVX2(const uint32_t* a, size_t na, const uint32_t* b, size_t nb, uint32_t* out) {
+    size_t i = 0, j = 0, k = 0;
+    const __m256i rot = _mm256_set_epi32(0, 7, 6, 5, 4, 3, 2, 1);
+    while (i + 8 <= na && j + 8 <= nb) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + j));
+        __m256i m = _mm256_cmpeq_epi32(va, vb);
+        for (int r = 1; r < 8; r++) {
+            vb = _mm256_permutevar8x32_epi32(vb, rot);
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi32(va, vb));
+        }
+        unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(m));
+        if (out) {
+            while (mask) { out[k++] = a[i + __builtin_ctz(mask)]; mask &= mask - 1; }
+        } else {
+            k += _mm_popcnt_u32(mask);
+        }
+        uint32_t amax = a[i + 7], bmax = b[j + 7];
+        if (amax <= bmax) i += 8;
+        if (bmax <= amax) j += 8;
+    }
+    return k + intersectSSE(a + i, na - i, b + j, nb - j, out ? out + k : NULL);
+}
+#endif
+
+// Widest block kernel this CPU supports, picked once at startup
+inline IntersectFn selectIntersectKernel() {
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return intersectAVX2;
+    if (__builtin_cpu_supports("sse4.2")) return intersectSSE;
+#endif
+    return intersectMerge;
+}
+
+inline const char* intersectKernelName() {
+    IntersectFn fn = selectIntersectKernel();
+#ifdef HAVE_X86_SIMD
+    if (fn == intersectAVX2) return "avx2";
+    if (fn == intersectSSE) return "sse4.2";
+#endif
+    return fn == intersectMerge ? "merge" : "unknown";
+}
+
+// Gallops when one side is 32x larger, otherwise uses the vector block kernel
+inline size_t intersectSorted(const uint32_t* a, size_t na, const uint32_t* b, size_t nb, uint32_t* out) {
+    static const IntersectFn blockKernel = selectIntersectKernel();
+    if (na > nb) { swap(a, b); swap(na, nb); }
+    if (na == 0) return 0;
+    if (nb / na >= 32) return intersectGalloping(a, na, b, nb, out);
+    return blockKernel(a, na, b, nb, out);
+}
+
+// Sorted friend-index arrays per user, kept in step with the FriendSets,
+// so mutual-friend queries are array intersections instead of list walks.
+// This is the one array copy of the friend graph that changes in place;
+// the CSR snapshot is refreshed from it using the log of changed rows.
+class MutualFriendsEngine {
+    vector<vector<uint32_t> > rows;
+    vector<uint32_t> changed; // rows edited since the last takeChanges
+    bool changedOverflow;     // too many to list, every row counts as changed
+
+    void noteChange(uint32_t u) {
+        if (changedOverflow) return;
+        if (changed.size() >= rows.size() + 1024) { // cheaper to rebuild than replay
+            changed.clear();
+            changedOverflow = true;
+            return;
+        }
+        changed.push_back(u);
+    }
+
+public:
+    MutualFriendsEngine() : changedOverflow(false) {}
+
+    void addUser() { rows.push_back(vector<uint32_t>()); }
+    // Bulk load: replaces a row with the given friends, in any order. The
+    // next snapshot refresh rebuilds rather than listing every row.
+    void setRow(uint32_t u, const uint32_t* begin, const uint32_t* end) {
+        rows[u].assign(begin, end);
+        sort(rows[u].begin(), rows[u].end());
+        changed.clear();
+        changedOverflow = true;
+    }
+    void addEdge(uint32_t u, uint32_t v) {
+        vector<uint32_t>& row = rows[u];
+        row.insert(lower_bound(row.begin(), row.end(), v), v);
+        noteChange(u);
+    }
+    void removeEdge(uint32_t u, uint32_t v) {
+        vector<uint32_t>& row = rows[u];
+        vector<uint32_t>::iterator it = lower_bound(row.begin(), row.end(), v);
+        if (it == row.end() || *it != v) return;
+        row.erase(it);
+        noteChange(u);
+    }
+    uint32_t userCount() const { return (uint32_t)rows.size(); }
+    const vector<uint32_t>& friendsOf(uint32_t u) const { return rows[u]; }
+    // Moves the rows edited since the last call into out; false if there
+    // were too many to list and every row must be re-read
+    bool takeChanges(vector<uint32_t>& out) {
+        bool listed = !changedOverflow;
+        out.swap(changed);
+        changed.clear();
+        changedOverflow = false;
+        return listed;
+    }
+
+    size_t count(uint32_t u, uint32_t v) const {
+        return intersectSorted(rows[u].data(), rows[u].size(), rows[v].data(), rows[v].size(), NULL);
+    }
+    void list(uint32_t u, uint32_t v, vector<uint32_t>& out) const {
+        out.resize(min(rows[u].size(), rows[v].size()));
+        out.resize(intersectSorted(rows[u].data(), rows[u].size(), rows[v].data(), rows[v].size(), out.data()));
+    }
+    void clear() {
+        rows.clear();
+        changed.clear();
+        changedOverflow = false;
+    }
+};
+
+// Open-addressing map from user index to a positive count. A slot with
+// count 0 is empty; erasing shifts later entries back so probe chains
+// never need tombstones.
+class CountMap {
+public:
+    struct Entry { uint32_t key, count; };
+
+private:
+    Entry* slots;
+    uint32_t capacity; // power of two, 0 until the first insert
+    uint32_t used;
+
+    static uint32_t home(uint32_t key, uint32_t capacity) {
+        return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & (capacity - 1);
+    }
+    uint32_t findSlot(uint32_t key) const {
+        uint32_t i = home(key, capacity);
+        while (slots[i].count && slots[i].key != key) i = (i + 1) & (capacity - 1);
+        return i;
+    }
+    void rehash(uint32_t newCapacity) {
+        Entry* old = slots;
+        uint32_t oldCapacity = capacity;
+        capacity = newCapacity;
+        slots = new Entry[capacity]();
+        for (uint32_t i = 0; i < oldCapacity; i++)
+            if (old[i].count) slots[findSlot(old[i].key)] = old[i];
+        delete[] old;
+    }
+    void eraseSlot(uint32_t i) {
+        uint32_t j = i;
+        while (true) {
+            j = (j + 1) & (capacity - 1);
+            if (!slots[j].count) break;
+            uint32_t h = home(slots[j].key, capacity);
+            bool movable = (j > i) ? (h <= i || h > j) : (h <= i && h > j);
+            if (movable) {
+                slots[i] = slots[j];
+                i = j;
+            }
+        }
+        slots[i].count = 0;
+    }
+
+    CountMap(const CountMap&);
+    CountMap& operator=(const CountMap&);
+
+public:
+    CountMap() : slots(NULL), capacity(0), used(0) {}
+    CountMap(CountMap&& other) noexcept : slots(other.slots), capacity(other.capacity), used(other.used) {
+        other.slots = NULL;
+        other.capacity = other.used = 0;
+    }
+    ~CountMap() { delete[] slots; }
+
+    uint32_t get(uint32_t key) const { return capacity ? slots[findSlot(key)].count : 0; }
+    uint32_t size() const { return used; }
+
+    // Room for n keys without rehashing
+    void reserve(uint32_t n) {
+        uint32_t want = 8;
+        while (want * 3 < n * 4) want *= 2;
+        if (want > capacity) rehash(want);
+    }
+    void add(uint32_t key, uint32_t count) {
+        if ((used + 1) * 4 > capacity * 3) rehash(capacity ? capacity * 2 : 8);
+        Entry& e = slots[findSlot(key)];
+        if (!e.count) {
+            e.key = key;
+            used++;
+        }
+        e.count += count;
+    }
+    // Takes one off the key's count, dropping it at zero
+    void decrement(uint32_t key) {
+        if (!capacity) return;
+        uint32_t i = findSlot(key);
+        if (!slots[i].count) return;
+        if (--slots[i].count == 0) {
+            used--;
+            eraseSlot(i);
+        }
+    }
+    void clear() {
+        delete[] slots;
+        slots = NULL;
+        capacity = used = 0;
+    }
+
+    // Raw slots for iteration; skip those with count 0
+    uint32_t slotCount() const { return capacity; }
+    const Entry& slot(uint32_t i) const { return slots[i]; }
+    size_t heapBytes() const { return capacity * sizeof(Entry); }
+};
+
+// Materialized mutual-friend counts: for each user, how many friends they
+// share with every user two hops away. A friendship change touches only
+// the two users' friend lists, so keeping the counts current costs
+// O(deg(u) + deg(v)) per accept or unfriend; a count read is one probe.
+// Memory grows with the number of two-hop pairs.
+class CommonFriendCounts {
+    vector<CountMap> maps;
+
+    void ensure(uint32_t n) {
+        if (maps.size() < n) maps.resize(n);
+    }
+
+public:
+    uint32_t get(uint32_t u, uint32_t w) const { return u < maps.size() ? maps[u].get(w) : 0; }
+    const CountMap& of(uint32_t u) {
+        ensure(u + 1);
+        return maps[u];
+    }
+
+    // From scratch, one user at a time, with a scratch count array that is zeroed again as it is read
+    void build(const MutualFriendsEngine& graph, uint32_t n) {
+        maps.clear();
+        maps.resize(n);
+        vector<uint32_t> counts(n, 0), touched;
+        for (uint32_t u = 0; u < n; u++) {
+            touched.clear();
+            const vector<uint32_t>& direct = graph.friendsOf(u);
+            for (size_t i = 0; i < direct.size(); i++) {
+                const vector<uint32_t>& hop = graph.friendsOf(direct[i]);
+                for (size_t j = 0; j < hop.size(); j++) {
+                    uint32_t w = hop[j];
+                    if (w == u) continue;
+                    if (counts[w]++ == 0) touched.push_back(w);
+                }
+            }
+            maps[u].reserve((uint32_t)touched.size());
+            for (size_t i = 0; i < touched.size(); i++) {
+                maps[u].add(touched[i], counts[touched[i]]);
+                counts[touched[i]] = 0;
+            }
+        }
+    }
+
+    // Friendship u-v was just added or removed (the friend rows already
+    // show it). Every user whose counts moved is appended to affected.
+    void friendshipChanged(const MutualFriendsEngine& graph, uint32_t u, uint32_t v, bool added,
+                           vector<uint32_t>& affected) {
+        ensure(max(u, v) + 1);
+        for (int side = 0; side < 2; side++) {
+            uint32_t a = side ? v : u, b = side ? u : v; // a gains or loses b as a common friend with b's other friends
+            const vector<uint32_t>& row = graph.friendsOf(b);
+            for (size_t i = 0; i < row.size(); i++) {
+                uint32_t w = row[i];
+                if (w == a) continue;
+                ensure(w + 1);
+                if (added) {
+                    maps[a].add(w, 1);
+                    maps[w].add(a, 1);
+                } else {
+                    maps[a].decrement(w);
+                    maps[w].decrement(a);
+                }
+                affected.push_back(w);
+            }
+        }
+    }
+
+    void clear() { vector<CountMap>().swap(maps); }
+
+    size_t pairs() const {
+        size_t total = 0;
+        for (size_t u = 0; u < maps.size(); u++) total += maps[u].size();
+        return total / 2;
+    }
+    size_t heapBytes() const {
+        size_t total = maps.capacity() * sizeof(CountMap);
+        for (size_t u = 0; u < maps.size(); u++) total += maps[u].heapBytes();
+        return total;
+    }
+};
+
+// Shortest chain of friends between two users: breadth-first search from
+// both ends at once, always growing the side whose next level has fewer
+// friend links to scan, until the two meet. At six hops on a large network
+// that touches a few thousand users instead of millions. Visit marks are
+// epoch-stamped, so a query allocates nothing once the arrays have grown.
+class ConnectionSearch {
+    vector<uint32_t> seenEpoch; // == epoch: reached in this query
+    vector<uint8_t> seenSide;   // 0 from the start, 1 from the target
+    vector<uint32_t> parent;    // one step back towards that side's end
+    vector<uint32_t> frontier[2], next;
+    uint32_t epoch;
+    size_t visitedCount;
+
+    void stamp(uint32_t u, uint8_t side, uint32_t from) {
+        seenEpoch[u] = epoch;
+        seenSide[u] = side;
+        parent[u] = from;
+        visitedCount++;
+    }
+    // Expands one whole level of side; returns the meeting edge if found
+    bool expand(const MutualFriendsEngine& graph, uint8_t side, uint32_t& near, uint32_t& far) {
+        next.clear();
+        for (size_t i = 0; i < frontier[side].size(); i++) {
+            uint32_t u = frontier[side][i];
+            const vector<uint32_t>& row = graph.friendsOf(u);
+            for (size_t j = 0; j < row.size(); j++) {
+                uint32_t v = row[j];
+                if (seenEpoch[v] != epoch) {
+                    stamp(v, side, u);
+                    next.push_back(v);
+                } else if (seenSide[v] != side) { // every meeting in this level gives the same length
+                    near = u;
+                    far = v;
+                    return true;
+                }
+            }
+        }
+        frontier[side].swap(next);
+        return false;
+    }
+    static uint64_t links(const MutualFriendsEngine& graph, const vector<uint32_t>& users) {
+        uint64_t total = 0;
+        for (size_t i = 0; i < users.size(); i++) total += graph.friendsOf(users[i]).size();
+        return total;
+    }
+
+public:
+    ConnectionSearch() : epoch(0), visitedCount(0) {}
+
+    // Fills path with from .. to, both included, and returns true if the
+    // two are at most maxHops friendships apart
+    bool find(const MutualFriendsEngine& graph, uint32_t userCount, uint32_t from, uint32_t to, uint32_t maxHops,
+              vector<uint32_t>& path) {
+        path.clear();
+        visitedCount = 0;
+        if (seenEpoch.size() < userCount) {
+            seenEpoch.resize(userCount, 0);
+            seenSide.resize(userCount);
+            parent.resize(userCount);
+        }
+        if (++epoch == 0) { // wrapped: stale stamps could alias the new epoch
+            fill(seenEpoch.begin(), seenEpoch.end(), 0);
+            epoch = 1;
+        }
+        if (from == to) {
+            path.push_back(from);
+            return true;
+        }
+        frontier[0].assign(1, from);
+        frontier[1].assign(1, to);
+        stamp(from, 0, from);
+        stamp(to, 1, to);
+        uint32_t hops[2] = { 0, 0 }; // levels grown on each side
+        uint32_t near = 0, far = 0;
+        bool met = false;
+        while (!met && hops[0] + hops[1] < maxHops && !frontier[0].empty() && !frontier[1].empty()) {
+            uint8_t side = links(graph, frontier[0]) <= links(graph, frontier[1]) ? 0 : 1;
+            met = expand(graph, side, near, far);
+            hops[side]++;
+            if (met && side == 1) swap(near, far); // near on the start side
+        }
+        if (!met) return false;
+        for (uint32_t u = near;; u = parent[u]) {
+            path.push_back(u);
+            if (u == from) break;
+        }
+        reverse(path.begin(), path.end());
+        for (uint32_t u = far;; u = parent[u]) {
+            path.push_back(u);
+            if (u == to) break;
+        }
+        return true;
+    }
+
+    // Users reached by the last find(), both sides together
+    size_t visited() const { return visitedCount; }
+};
+
+enum UserAttribute { ATTR_CITY, ATTR_INTEREST, ATTR_INSTITUTION, ATTR_COUNT };
+
+// Interning pool: each distinct string is stored once and named by a dense
+// 32-bit handle. Lookups probe an open-addressing table of handles.
+class StringPool {
+    vector<string> strings;
+    uint32_t* slots; // handle + 1, 0 = empty
+    size_t capacity; // power of two
+
+    void place(uint32_t handle) {
+        size_t i = hashString(strings[handle]) & (capacity - 1);
+        while (slots[i]) i = (i + 1) & (capacity - 1);
+        slots[i] = handle + 1;
+    }
+    void grow() {
+        delete[] slots;
+        capacity *= 2;
+        slots = new uint32_t[capacity]();
+        for (uint32_t h = 0; h < strings.size(); h++) place(h);
+    }
+
+    StringPool(const StringPool&);
+    StringPool& operator=(const StringPool&);
+
+public:
+    static constexpr uint32_t NONE = 0xFFFFFFFFu;
+
+    StringPool() : capacity(16) { slots = new uint32_t[capacity](); }
+    ~StringPool() { delete[] slots; }
+
+    // Handle of s, or NONE if it was never interned
+    uint32_t lookup(const string& s) const {
+        size_t i = hashString(s) & (capacity - 1);
+        while (slots[i]) {
+            if (strings[slots[i] - 1] == s) return slots[i] - 1;
+            i = (i + 1) & (capacity - 1);
+        }
+        return NONE;
+    }
+    uint32_t intern(const string& s) {
+        uint32_t h = lookup(s);
+        if (h != NONE) return h;
+        if ((strings.size() + 1) * 10 > capacity * 7) {
+            strings.push_back(s);
+            grow();
+        } else {
+            strings.push_back(s);
+            place((uint32_t)strings.size() - 1);
+        }
+        return (uint32_t)strings.size() - 1;
+    }
+    const string& str(uint32_t handle) const { return strings[handle]; }
+    size_t size() const { return strings.size(); }
+};
+
+// One attribute = value condition of an attribute query
+struct AttributeTerm {
+    UserAttribute attr;
+    string value;
+};
+
+// Fixed-size profile records stored column-wise (structure of arrays):
+// each attribute is a 32-bit handle into one interning pool shared by all
+// users, so a city held by a million users is stored once.
+class UserRecordStore {
+    StringPool pool;
+    vector<uint32_t> columns[ATTR_COUNT]; // by user index
+
+public:
+    static constexpr uint32_t EMPTY = 0; // handle of ""
+
+    UserRecordStore() { pool.intern(""); }
+
+    void addUser() {
+        for (int a = 0; a < ATTR_COUNT; a++) columns[a].push_back(EMPTY);
+    }
+    // A user whose values are already interned
+    void addUser(const uint32_t handles[ATTR_COUNT]) {
+        for (int a = 0; a < ATTR_COUNT; a++) columns[a].push_back(handles[a]);
+    }
+    void reserve(size_t users) {
+        for (int a = 0; a < ATTR_COUNT; a++) columns[a].reserve(users);
+    }
+    // Drops every record; interned values stay in the pool
+    void clear() {
+        for (int a = 0; a < ATTR_COUNT; a++) columns[a].clear();
+    }
+    uint32_t handle(uint32_t user, UserAttribute attr) const { return columns[attr][user]; }
+    const string& get(uint32_t user, UserAttribute attr) const { return pool.str(columns[attr][user]); }
+    void set(uint32_t user, UserAttribute attr, const string& value) { columns[attr][user] = pool.intern(value); }
+    uint32_t intern(const string& value) { return pool.intern(value); }
+    const StringPool& values() const { return pool; }
+
+    size_t userCount() const { return columns[0].size(); }
+    // Heap bytes held by the interned strings themselves
+    size_t poolBytes() const {
+        size_t bytes = 0;
+        for (uint32_t h = 0; h < pool.size(); h++) bytes += sizeof(string) + heapBytes(pool.str(h));
+        return bytes;
+    }
+    static size_t heapBytes(const string& s) {
+        string probe;
+        return s.capacity() > probe.capacity() ? s.capacity() + 1 : 0; // short strings stay inline
+    }
+};
+
+// Inverted index from interned attribute value to the sorted indices of the
+// users holding it, one posting table per attribute.
+class AttributeIndex {
+    vector<vector<uint32_t> > postings[ATTR_COUNT]; // by value handle
+
+public:
+    void clear() {
+        for (int a = 0; a < ATTR_COUNT; a++) postings[a].clear();
+    }
+    void add(UserAttribute attr, uint32_t value, uint32_t user) {
+        if (value == UserRecordStore::EMPTY) return;
+        if (postings[attr].size() <= value) postings[attr].resize(value + 1);
+        vector<uint32_t>& list = postings[attr][value];
+        if (list.empty() || list.back() < user) list.push_back(user); // users added in index order
+        else list.insert(lower_bound(list.begin(), list.end(), user), user);
+    }
+    void remove(UserAttribute attr, uint32_t value, uint32_t user) {
+        if (value >= postings[attr].size()) return;
+        vector<uint32_t>& list = postings[attr][value];
+        vector<uint32_t>::iterator pos = lower_bound(list.begin(), list.end(), user);
+        if (pos != list.end() && *pos == user) list.erase(pos);
+    }
+    // Users holding the value, or NULL if none
+    const vector<uint32_t>* find(UserAttribute attr, uint32_t value) const {
+        if (value == UserRecordStore::EMPTY || value >= postings[attr].size() || postings[attr][value].empty()) return NULL;
+        return &postings[attr][value];
+    }
+
+    // Users matching every term (matchAll) or any term, in index order.
+    // AND intersects posting lists smallest first; OR merges them.
+    void query(const vector<AttributeTerm>& terms, const StringPool& values, bool matchAll, vector<uint32_t>& out) const {
+        out.clear();
+        vector<const vector<uint32_t>*> lists;
+        for (size_t i = 0; i < terms.size(); i++) {
+            uint32_t value = values.lookup(terms[i].value);
+            const vector<uint32_t>* list = value == StringPool::NONE ? NULL : find(terms[i].attr, value);
+            if (!list) {
+                if (matchAll) return;
+                continue;
+            }
+            lists.push_back(list);
+        }
+        if (lists.empty()) return;
+        if (matchAll) {
+            sort(lists.begin(), lists.end(), bySize);
+            out = *lists[0];
+            for (size_t i = 1; i < lists.size() && !out.empty(); i++)
+                out.resize(intersectSorted(out.data(), out.size(), lists[i]->data(), lists[i]->size(), out.data()));
+        } else {
+            vector<uint32_t> merged;
+            for (size_t i = 0; i < lists.size(); i++) {
+                merged.clear();
+                set_union(out.begin(), out.end(), lists[i]->begin(), lists[i]->end(), back_inserter(merged));
+                out.swap(merged);
+            }
+        }
+    }
+    static bool bySize(const vector<uint32_t>* a, const vector<uint32_t>* b) { return a->size() < b->size(); }
+};
+
+// Splits message text into search terms: runs of ASCII letters and digits,
+// lowercased, with bytes of UTF-8 characters kept as word characters so
+// non-English words stay whole. Terms are cut at MAX_TERM bytes.
+class TermScanner {
+    const string& text;
+    size_t pos;
+
+public:
+    static constexpr size_t MAX_TERM = 32;
+
+    explicit TermScanner(const string& s) : text(s), pos(0) {}
+
+    static bool isTermByte(unsigned char c) {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80;
+    }
+    bool next(string& term) {
+        while (pos < text.size() && !isTermByte(text[pos])) pos++;
+        if (pos == text.size()) return false;
+        term.clear();
+        for (; pos < text.size() && isTermByte(text[pos]); pos++) {
+            unsigned char c = text[pos];
+            if (term.size() < MAX_TERM) term.push_back((char)(c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c));
+        }
+        return true;
+    }
+    // Whether the term just returned was written with a trailing '*'
+    bool starred() const { return pos < text.size() && text[pos] == '*'; }
+};
+
+// Every term seen in any message, interned once. Handles are also kept in
+// term order for prefix queries; new terms go on an unsorted tail that is
+// merged in by the next prefix query, so indexing never pays for ordering.
+class TermDictionary {
+    StringPool terms;
+    vector<uint32_t> ordered;
+    size_t sortedCount;
+
+    struct ByTerm {
+        const StringPool& pool;
+        ByTerm(const StringPool& p) : pool(p) {}
+        bool operator()(uint32_t a, uint32_t b) const { return pool.str(a) < pool.str(b); }
+        bool operator()(uint32_t a, const string& b) const { return pool.str(a) < b; }
+    };
+
+public:
+    TermDictionary() : sortedCount(0) {}
+
+    uint32_t intern(const string& term) {
+        uint32_t before = (uint32_t)terms.size();
+        uint32_t handle = terms.intern(term);
+        if (handle == before) ordered.push_back(handle);
+        return handle;
+    }
+    uint32_t lookup(const string& term) const { return terms.lookup(term); }
+    // Handles of every term starting with prefix, in term order
+    void withPrefix(const string& prefix, vector<uint32_t>& out) {
+        out.clear();
+        if (sortedCount < ordered.size()) {
+            ByTerm byTerm(terms);
+            sort(ordered.begin() + sortedCount, ordered.end(), byTerm);
+            inplace_merge(ordered.begin(), ordered.begin() + sortedCount, ordered.end(), byTerm);
+            sortedCount = ordered.size();
+        }
+        vector<uint32_t>::const_iterator it = lower_bound(ordered.begin(), ordered.end(), prefix, ByTerm(terms));
+        for (; it != ordered.end() && terms.str(*it).compare(0, prefix.size(), prefix) == 0; ++it) out.push_back(*it);
+    }
+    size_t size() const { return terms.size(); }
+};
+
+// One word of a message search, resolved against the dictionary: an exact
+// term, or with prefix set every term it begins (handles in ascending order)
+struct SearchTerm {
+    string text;
+    bool prefix;
+    vector<uint32_t> handles;
+};
+
+// Full-text index over message logs. Each log keeps its own postings
+// (TermPostings) so a user's search only touches their inbox and groups;
+// terms are shared through one dictionary. catchUp() indexes a log from
+// where it left off to its end. The send path calls it every few appends,
+// searches before they read, so a log filled any other way (snapshot
+// loads, concurrent delivery) is indexed the first time it is searched.
+class MessageSearchIndex {
+    TermDictionary dictionary;
+    string term; // scratch, reused across messages
+    vector<uint32_t> positions, merged;
+    vector<vector<uint32_t> > matches;
+
+    MessageSearchIndex(const MessageSearchIndex&);
+    MessageSearchIndex& operator=(const MessageSearchIndex&);
+
+    static bool bySize(const vector<uint32_t>& a, const vector<uint32_t>& b) { return a.size() < b.size(); }
+
+    // Positions of the log holding any of the term's handles
+    void termPositions(const TermPostings& postings, const SearchTerm& query, vector<uint32_t>& out) {
+        out.clear();
+        if (!query.prefix) {
+            const TermPostings::List* list = postings.find(query.handles[0]);
+            if (list) postings.decode(*list, out);
+            return;
+        }
+        // Few expansions: probe each; many: scan the log's own (smaller) term set
+        bool probe = query.handles.size() <= postings.listCount();
+        size_t n = probe ? query.handles.size() : postings.slotCount();
+        for (size_t i = 0; i < n; i++) {
+            const TermPostings::List* list = probe ? postings.find(query.handles[i]) : postings.slot(i);
+            if (!list || (!probe && !binary_search(query.handles.begin(), query.handles.end(), list->term))) continue;
+            postings.decode(*list, positions);
+            merged.clear();
+            set_union(out.begin(), out.end(), positions.begin(), positions.end(), back_inserter(merged));
+            out.swap(merged);
+        }
+    }
+
+public:
+    MessageSearchIndex() {}
+
+    static constexpr size_t APPEND_BATCH = 8;
+
+    // Send-path hook: indexes once APPEND_BATCH messages are waiting, so the
+    // log's postings are pulled into cache once per batch, not per message
+    void appended(MessageLog& log) {
+        if (log.size() - (log.postings ? log.postings->indexed : 0) >= APPEND_BATCH) catchUp(log);
+    }
+    void catchUp(MessageLog& log) {
+        if (!log.postings) log.postings = new TermPostings;
+        TermPostings& postings = *log.postings;
+        for (; postings.indexed < log.size(); postings.indexed++) {
+            TermScanner scan(log.at(postings.indexed).text);
+            while (scan.next(term)) postings.add(dictionary.intern(term), (uint32_t)postings.indexed);
+        }
+    }
+
+    // Splits a query into terms, a trailing '*' marking a prefix. False if
+    // it has no terms; terms found nowhere resolve to no handles.
+    bool parse(const string& query, vector<SearchTerm>& out) {
+        out.clear();
+        TermScanner scan(query);
+        string word;
+        while (scan.next(word)) {
+            SearchTerm t;
+            t.text = word;
+            t.prefix = scan.starred();
+            if (t.prefix) {
+                dictionary.withPrefix(word, t.handles);
+                sort(t.handles.begin(), t.handles.end());
+            }
+            else if (dictionary.lookup(word) != StringPool::NONE) t.handles.push_back(dictionary.lookup(word));
+            out.push_back(t);
+        }
+        return !out.empty();
+    }
+
+    // Log positions matching every term, ascending; the log must be caught up
+    void match(const MessageLog& log, const vector<SearchTerm>& query, vector<uint32_t>& out) {
+        out.clear();
+        if (!log.postings) return;
+        for (size_t i = 0; i < query.size(); i++)
+            if (query[i].handles.empty()) return;
+        matches.resize(query.size());
+        for (size_t i = 0; i < query.size(); i++) {
+            termPositions(*log.postings, query[i], matches[i]);
+            if (matches[i].empty()) return;
+        }
+        sort(matches.begin(), matches.end(), bySize);
+        out = matches[0];
+        for (size_t i = 1; i < matches.size() && !out.empty(); i++)
+            out.resize(intersectSorted(out.data(), out.size(), matches[i].data(), matches[i].size(), out.data()));
+    }
+
+    size_t termCount() const { return dictionary.size(); }
+};
+
+// Compressed (radix) trie over user names: each edge holds a run of
+// characters and a node lists the users with a key ending there. subtree
+// counts the entries at and below a node, so the number of keys starting
+// with a prefix is known without walking anything.
+class NameTrie {
+public:
+    struct Node {
+        string label;           // edge from the parent
+        vector<Node*> children; // by first byte of label
+        vector<uint32_t> users; // ascending
+        uint32_t subtree;
+        Node() : subtree(0) {}
+    };
+    // One entry of a bulk build: the key is bytes [offset, offset + length)
+    // of a shared buffer
+    struct BulkKey {
+        size_t offset;
+        uint32_t length, user;
+    };
+
+private:
+    Node root;
+    size_t nodeCount;
+
+    // Bulk keys by their bytes from depth on, shorter first, then by user
+    struct KeyOrder {
+        const char* bytes;
+        size_t depth;
+        bool operator()(const BulkKey& a, const BulkKey& b) const {
+            size_t la = a.length - depth, lb = b.length - depth;
+            int c = memcmp(bytes + a.offset + depth, bytes + b.offset + depth, min(la, lb));
+            if (c != 0) return c < 0;
+            if (la != lb) return la < lb;
+            return a.user < b.user;
+        }
+    };
+    struct KeyRange {
+        size_t lo, hi, depth;
+    };
+
+    NameTrie(const NameTrie&);
+    NameTrie& operator=(const NameTrie&);
+
+    static size_t childSlot(const Node* n, char c) {
+        size_t lo = 0, hi = n->children.size();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if ((unsigned char)n->children[mid]->label[0] < (unsigned char)c) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+    static Node* child(const Node* n, char c) {
+        size_t slot = childSlot(n, c);
+        return slot < n->children.size() && n->children[slot]->label[0] == c ? n->children[slot] : NULL;
+    }
+    // One node of fuzzyWords: extends the path by the label, a row per byte,
+    // and stops where the word ends or no extension can come close enough
+    static void fuzzyStep(const Node* n, const string& query, bool prefix, int maxEdits, string& path,
+                          vector<int>& rows, vector<pair<int, string> >& out) {
+        size_t width = query.size() + 1, start = path.size();
+        bool descend = true;
+        for (size_t k = 0; descend && k < n->label.size(); k++) {
+            char c = n->label[k];
+            const int* above = &rows[path.size() * width];
+            if (c == ' ') {
+                if (!prefix && above[query.size()] <= maxEdits) out.push_back(make_pair(above[query.size()], path));
+                path.resize(start);
+                return;
+            }
+            if (path.size() == TermScanner::MAX_TERM) {
+                descend = false;
+                continue;
+            }
+            path += c;
+            int* row = &rows[path.size() * width];
+            row[0] = (int)path.size();
+            int best = row[0];
+            for (size_t j = 1; j < width; j++) {
+                row[j] = min(min(above[j] + 1, row[j - 1] + 1), above[j - 1] + (query[j - 1] != c));
+                best = min(best, row[j]);
+            }
+            if (prefix && row[query.size()] <= maxEdits) {
+                out.push_back(make_pair(row[query.size()], path));
+                descend = false;
+            }
+            if (best > maxEdits) descend = false;
+        }
+        if (descend)
+            for (size_t i = 0; i < n->children.size(); i++) fuzzyStep(n->children[i], query, prefix, maxEdits, path, rows, out);
+        path.resize(start);
+    }
+    // MSD radix sort into KeyOrder, one byte per pass; the passes are
+    // stable, so keys arriving in user order keep it among equal keys.
+    // Small ranges are finished by comparison.
+    static void sortKeys(const char* bytes, vector<BulkKey>& keys) {
+        vector<BulkKey> scratch(keys.size());
+        vector<KeyRange> stack;
+        KeyRange all = { 0, keys.size(), 0 };
+        stack.push_back(all);
+        while (!stack.empty()) {
+            KeyRange r = stack.back();
+            stack.pop_back();
+            if (r.hi - r.lo < 64) {
+                KeyOrder order = { bytes, r.depth };
+                sort(keys.begin() + r.lo, keys.begin() + r.hi, order);
+                continue;
+            }
+            size_t counts[257] = { 0 }, starts[257]; // bucket 0: keys ending at depth
+            for (size_t i = r.lo; i < r.hi; i++)
+                counts[keys[i].length > r.depth ? (unsigned char)bytes[keys[i].offset + r.depth] + 1 : 0]++;
+            size_t first = keys[r.lo].length > r.depth ? (unsigned char)bytes[keys[r.lo].offset + r.depth] + 1 : 0;
+            if (first > 0 && counts[first] == r.hi - r.lo) { // a byte every key shares: nothing moves
+                r.depth++;
+                stack.push_back(r);
+                continue;
+            }
+            for (size_t b = 0, at = r.lo; b < 257; b++) {
+                starts[b] = at;
+                at += counts[b];
+            }
+            for (size_t i = r.lo; i < r.hi; i++)
+                scratch[starts[keys[i].length > r.depth ? (unsigned char)bytes[keys[i].offset + r.depth] + 1 : 0]++] = keys[i];
+            copy(scratch.begin() + r.lo, scratch.begin() + r.hi, keys.begin() + r.lo);
+            for (size_t b = 1; b < 257; b++) {
+                if (counts[b] < 2) continue;
+                KeyRange bucket = { starts[b] - counts[b], starts[b], r.depth + 1 };
+                stack.push_back(bucket);
+            }
+        }
+    }
+    // Fills the empty node n from keys[lo, hi), sorted and sharing their
+    // first depth bytes. Each run of keys with the same next byte becomes
+    // a child labelled with the run's common prefix, which for sorted keys
+    // is that of its first and last.
+    void buildRange(Node* n, const char* bytes, const vector<BulkKey>& keys, size_t lo, size_t hi, size_t depth) {
+        n->subtree = (uint32_t)(hi - lo);
+        for (; lo < hi && keys[lo].length == depth; lo++) n->users.push_back(keys[lo].user);
+        while (lo < hi) {
+            char next = bytes[keys[lo].offset + depth];
+            size_t end = lo + 1;
+            while (end < hi && bytes[keys[end].offset + depth] == next) end++;
+            const BulkKey& first = keys[lo];
+            const BulkKey& last = keys[end - 1];
+            size_t common = depth + 1;
+            while (common < first.length && bytes[first.offset + common] == bytes[last.offset + common]) common++;
+            Node* c = new Node;
+            c->label.assign(bytes + first.offset + depth, common - depth);
+            n->children.push_back(c);
+            nodeCount++;
+            buildRange(c, bytes, keys, lo, end, common);
+            lo = end;
+        }
+    }
+    static void destroy(Node* n) {
+        for (size_t i = 0; i < n->children.size(); i++) {
+            destroy(n->children[i]);
+            delete n->children[i];
+        }
+        n->children.clear();
+    }
+
+public:
+    NameTrie() : nodeCount(1) {}
+    ~NameTrie() { destroy(&root); }
+
+    void clear() {
+        destroy(&root);
+        root.users.clear();
+        root.subtree = 0;
+        nodeCount = 1;
+    }
+    void insert(const string& word, uint32_t user) {
+        Node* n = &root;
+        n->subtree++;
+        for (size_t i = 0; i < word.size();) {
+            size_t slot = childSlot(n, word[i]);
+            if (slot == n->children.size() || n->children[slot]->label[0] != word[i]) {
+                Node* leaf = new Node;
+                leaf->label = word.substr(i);
+                n->children.insert(n->children.begin() + slot, leaf);
+                nodeCount++;
+            }
+            Node* c = n->children[slot];
+            size_t common = 1;
+            while (common < c->label.size() && i + common < word.size() && c->label[common] == word[i + common]) common++;
+            if (common < c->label.size()) { // split the edge where the word leaves it
+                Node* mid = new Node;
+                mid->label = c->label.substr(0, common);
+                mid->subtree = c->subtree;
+                c->label.erase(0, common);
+                mid->children.push_back(c);
+                n->children[slot] = mid;
+                c = mid;
+                nodeCount++;
+            }
+            c->subtree++;
+            n = c;
+            i += common;
+        }
+        n->users.insert(lower_bound(n->users.begin(), n->users.end(), user), user);
+    }
+    // Inserts every key into an empty trie at once, in time linear in their
+    // bytes plus a radix sort; keys come in ascending user order
+    void build(const string& bytes, vector<BulkKey>& keys) {
+        sortKeys(bytes.data(), keys);
+        buildRange(&root, bytes.data(), keys, 0, keys.size(), 0);
+    }
+    // Drops the entry and folds away nodes it leaves without a purpose:
+    // empty leaves go, and an empty node with one child merges into it
+    void remove(const string& word, uint32_t user) {
+        vector<Node*> path(1, &root);
+        for (size_t i = 0; i < word.size();) {
+            Node* c = child(path.back(), word[i]);
+            if (!c || word.compare(i, c->label.size(), c->label) != 0) return;
+            path.push_back(c);
+            i += c->label.size();
+        }
+        vector<uint32_t>& users = path.back()->users;
+        vector<uint32_t>::iterator it = lower_bound(users.begin(), users.end(), user);
+        if (it == users.end() || *it != user) return;
+        users.erase(it);
+        for (size_t k = 0; k < path.size(); k++) path[k]->subtree--;
+        for (size_t k = path.size() - 1; k > 0; k--) {
+            Node* n = path[k];
+            Node* parent = path[k - 1];
+            if (!n->users.empty() || n->children.size() > 1) break;
+            if (n->children.empty()) {
+                parent->children.erase(parent->children.begin() + childSlot(parent, n->label[0]));
+                delete n;
+                nodeCount--;
+                continue; // the parent may now be foldable too
+            }
+            Node* only = n->children[0];
+            n->label += only->label;
+            n->children.swap(only->children);
+            n->users.swap(only->users);
+            delete only;
+            nodeCount--;
+            break;
+        }
+    }
+    // Node whose subtree holds every word starting with prefix, or NULL
+    const Node* findPrefix(const string& prefix) const {
+        const Node* n = &root;
+        for (size_t i = 0; i < prefix.size();) {
+            const Node* c = child(n, prefix[i]);
+            if (!c) return NULL;
+            size_t m = min(c->label.size(), prefix.size() - i);
+            if (c->label.compare(0, m, prefix, i, m) != 0) return NULL;
+            n = c;
+            i += m;
+        }
+        return n;
+    }
+    // Beginnings of the keys' first words within maxEdits of query, with
+    // their distances: whole words that another word follows or, if prefix,
+    // the shortest beginnings of words the whole query is that close to.
+    // rows is scratch for the edit-distance rows of the walk.
+    void fuzzyWords(const string& query, bool prefix, int maxEdits, vector<int>& rows,
+                    vector<pair<int, string> >& out) const {
+        out.clear();
+        size_t width = query.size() + 1;
+        rows.resize((TermScanner::MAX_TERM + 1) * width);
+        for (size_t j = 0; j < width; j++) rows[j] = (int)j;
+        string path;
+        fuzzyStep(&root, query, prefix, maxEdits, path, rows, out);
+    }
+    // Up to limit entries of the subtree, shorter keys first at each
+    // branch and branches in byte order
+    static void collect(const Node* n, size_t limit, vector<uint32_t>& out) {
+        vector<const Node*> stack(1, n);
+        while (!stack.empty() && out.size() < limit) {
+            const Node* top = stack.back();
+            stack.pop_back();
+            for (size_t i = 0; i < top->users.size() && out.size() < limit; i++) out.push_back(top->users[i]);
+            for (size_t i = top->children.size(); i-- > 0;) stack.push_back(top->children[i]);
+        }
+    }
+    size_t nodes() const { return nodeCount; }
+};
+
+// Name search: every run of words that ends a name ("kari morasa" and
+// "morasa") is a key of a NameTrie, so a query whose words begin
+// consecutive words of a name, in order, is a prefix of one of its keys.
+// Typos are found by walking the trie's first words with an edit-distance
+// row: a query word of four or more letters may be one edit away from a
+// name word (from its beginning, for the last query word), seven or more
+// two, and one query word at a time is corrected.
+class NameIndex {
+    NameTrie trie;
+    vector<string> nameScratch, corrected;
+    vector<pair<int, string> > close;
+    vector<int> rows;
+    string key; // scratch
+
+    NameIndex(const NameIndex&);
+    NameIndex& operator=(const NameIndex&);
+
+    // Words of a name in order, lowercased as in message search
+    static void nameWords(const string& name, vector<string>& out) {
+        out.clear();
+        TermScanner scan(name);
+        string w;
+        while (scan.next(w)) out.push_back(w);
+    }
+    // The words from first on, separated by single spaces
+    static void joinWords(const vector<string>& ws, size_t first, string& out) {
+        out.clear();
+        for (size_t i = first; i < ws.size(); i++) {
+            if (i > first) out += ' ';
+            out += ws[i];
+        }
+    }
+    // Fewest edits turning query into w, or into some prefix of w if
+    // prefix; maxEdits + 1 if more. Both come from TermScanner, so neither
+    // exceeds MAX_TERM bytes.
+    static int editDistance(const string& query, const string& w, bool prefix, int maxEdits) {
+        int rowsAt[2][TermScanner::MAX_TERM + 1];
+        size_t n = query.size(), m = w.size();
+        int* row = rowsAt[0];
+        int* next = rowsAt[1];
+        for (size_t j = 0; j <= m; j++) row[j] = (int)j;
+        for (size_t i = 1; i <= n; i++) {
+            next[0] = (int)i;
+            int best = next[0];
+            for (size_t j = 1; j <= m; j++) {
+                next[j] = min(min(row[j] + 1, next[j - 1] + 1), row[j - 1] + (query[i - 1] != w[j - 1]));
+                best = min(best, next[j]);
+            }
+            if (best > maxEdits) return maxEdits + 1;
+            swap(row, next);
+        }
+        return min(prefix ? *min_element(row, row + m + 1) : row[m], maxEdits + 1);
+    }
+    static bool closerWord(const pair<int, string>& a, const pair<int, string>& b) {
+        if (a.first != b.first) return a.first < b.first;
+        return a.second < b.second;
+    }
+
+public:
+    NameIndex() {}
+
+    static constexpr int MAX_EDITS = 2;
+
+    // Edits a query word of this length may be away from a name word
+    static int editBudget(size_t length) { return length >= 7 ? MAX_EDITS : length >= 4 ? 1 : 0; }
+
+    void add(uint32_t user, const string& name) {
+        nameWords(name, nameScratch);
+        for (size_t i = 0; i < nameScratch.size(); i++) {
+            joinWords(nameScratch, i, key);
+            trie.insert(key, user);
+        }
+    }
+    // Fills an empty index with every user's name at once; users[u] has
+    // index u
+    void build(const vector<UserNode*>& users) {
+        string bytes;
+        vector<NameTrie::BulkKey> keys;
+        for (size_t u = 0; u < users.size(); u++) {
+            nameWords(users[u]->name, nameScratch);
+            for (size_t i = 0; i < nameScratch.size(); i++) {
+                joinWords(nameScratch, i, key);
+                NameTrie::BulkKey k = { bytes.size(), (uint32_t)key.size(), (uint32_t)u };
+                keys.push_back(k);
+                bytes += key;
+            }
+        }
+        trie.build(bytes, keys);
+    }
+    void remove(uint32_t user, const string& name) {
+        nameWords(name, nameScratch);
+        for (size_t i = 0; i < nameScratch.size(); i++) {
+            joinWords(nameScratch, i, key);
+            trie.remove(key, user);
+        }
+    }
+    void clear() { trie.clear(); }
+
+    static void tokenize(const string& query, vector<string>& out) { nameWords(query, out); }
+
+    // Users whose names the query begins a run of words of, up to window (a
+    // user may appear twice); returns how many entries match in all
+    size_t prefixCandidates(const vector<string>& query, size_t window, vector<uint32_t>& out) {
+        out.clear();
+        joinWords(query, 0, key);
+        const NameTrie::Node* n = trie.findPrefix(key);
+        if (!n) return 0;
+        NameTrie::collect(n, window, out);
+        return n->subtree;
+    }
+    // Users matching the query once one of its words is corrected by
+    // exactly edits edits, up to window. Searching one edit away first
+    // keeps the trie walk narrow when that is enough.
+    void fuzzyCandidates(const vector<string>& query, int edits, size_t window, vector<uint32_t>& out) {
+        out.clear();
+        corrected = query;
+        for (size_t i = 0; i < query.size() && out.size() < window; i++) {
+            if (editBudget(query[i].size()) < edits) continue;
+            trie.fuzzyWords(query[i], i + 1 == query.size(), edits, rows, close);
+            sort(close.begin(), close.end(), closerWord);
+            for (size_t c = 0; c < close.size() && out.size() < window; c++) {
+                if (close[c].first != edits) continue; // closer ones were looked up before
+                corrected[i] = close[c].second;
+                joinWords(corrected, 0, key);
+                const NameTrie::Node* n = trie.findPrefix(key);
+                if (n) NameTrie::collect(n, window, out);
+            }
+            corrected[i] = query[i];
+        }
+    }
+    // Edits needed for the query's words to begin consecutive words of the
+    // name (the last word as a prefix), correcting at most one within its
+    // budget if fuzzy; -1 if they cannot
+    int matchEdits(const string& name, const vector<string>& query, bool fuzzy) {
+        nameWords(name, nameScratch);
+        int best = -1;
+        for (size_t s = 0; s + query.size() <= nameScratch.size() && best != 0; s++) {
+            int edits = 0;
+            for (size_t i = 0; i < query.size() && edits >= 0; i++) {
+                const string& q = query[i];
+                const string& w = nameScratch[s + i];
+                bool last = i + 1 == query.size();
+                if (last ? w.compare(0, q.size(), q) == 0 : w == q) continue;
+                int budget = fuzzy && edits == 0 ? editBudget(q.size()) : 0;
+                int d = budget ? editDistance(q, w, last, budget) : 1;
+                edits = d > budget ? -1 : d;
+            }
+            if (edits >= 0 && (best < 0 || edits < best)) best = edits;
+        }
+        return best;
+    }
+
+    size_t trieNodes() const { return trie.nodes(); }
+};
+
+// Per-target tally of a bulk friend request
+struct FriendRequestBatchResult {
+    int sent;
+    int alreadyFriends;
+    int alreadyPending; // either direction
+    int self;
+    int unknown; // IDs that do not exist
+    int duplicates; // repeated targets in the same batch
+};
+
+// A ranked friend suggestion
+struct Suggestion {
+    UserNode* user;
+    int mutualFriends;
+    int attributeMask; // bit per UserAttribute shared with the target user
+    int score;
+};
+
+// The users an operation resolved from its ID arguments, in argument
+// order, so a frontend can word the outcome without looking them up
+// again. Left untouched if the operation fails before resolving them.
+struct ResolvedUsers {
+    UserNode* first;
+    UserNode* second;
+};
+
+// A user found by name search
+struct NameMatch {
+    UserNode* user;
+    bool isFriend;     // of the searching user
+    int mutualFriends; // with the searching user
+    int edits;         // typos forgiven; 0 for a prefix match
+};
+
+// Outcome of a Profile operation
+enum Status {
+    STATUS_OK = 0,
+    STATUS_UNKNOWN_USER,
+    STATUS_UNKNOWN_GROUP,
+    STATUS_SELF,            // the user named themselves as the other party
+    STATUS_EMPTY_FIELD,
+    STATUS_INVALID_FIELD,
+    STATUS_DUPLICATE_ID,
+    STATUS_ALREADY_FRIENDS,
+    STATUS_REQUEST_PENDING,
+    STATUS_NOT_FRIENDS,
+    STATUS_NO_REQUEST,
+    STATUS_GROUP_EXISTS,
+    STATUS_ALREADY_MEMBER,
+    STATUS_NOT_MEMBER,
+    STATUS_NOT_EMPTY,       // snapshots and stores load into an empty network only
+    STATUS_IO_ERROR,
+    STATUS_CORRUPT,
+    STATUS_LOG_MISMATCH,    // a log record does not apply to the loaded state
+    STATUS_NO_STORE,
+    STATUS_STORE_OPEN,
+    STATUS_NO_PATH          // the users are not connected within the hop limit
+};
+
+inline const char* statusText(Status status) {
+    switch (status) {
+    case STATUS_OK: return "ok";
+    case STATUS_UNKNOWN_USER: return "unknown user";
+    case STATUS_UNKNOWN_GROUP: return "unknown group";
+    case STATUS_SELF: return "user and target are the same";
+    case STATUS_EMPTY_FIELD: return "empty field";
+    case STATUS_INVALID_FIELD: return "invalid field";
+    case STATUS_DUPLICATE_ID: return "user ID already exists";
+    case STATUS_ALREADY_FRIENDS: return "already friends";
+    case STATUS_REQUEST_PENDING: return "friend request already pending";
+    case STATUS_NOT_FRIENDS: return "not friends";
+    case STATUS_NO_REQUEST: return "no pending friend request";
+    case STATUS_GROUP_EXISTS: return "group already exists";
+    case STATUS_ALREADY_MEMBER: return "already a group member";
+    case STATUS_NOT_MEMBER: return "not a group member";
+    case STATUS_NOT_EMPTY: return "network is not empty";
+    case STATUS_IO_ERROR: return "I/O error";
+    case STATUS_CORRUPT: return "corrupt or incompatible file";
+    case STATUS_LOG_MISMATCH: return "log does not match the snapshot";
+    case STATUS_NO_STORE: return "no data store open";
+    case STATUS_STORE_OPEN: return "data store already open";
+    case STATUS_NO_PATH: return "no connection within the hop limit";
+    }
+    return "unknown status";
+}
+
+// Editable profile fields, numbered as in the Edit Profile menu
+enum ProfileField { FIELD_NAME = 1, FIELD_CITY, FIELD_INTEREST, FIELD_INSTITUTION };
+
+// Iteration over an intrusive user list (friends, requests, group members)
+// without copying it. Valid until the list is next modified.
+template <typename Node>
+class UserListRange {
+    Node* head;
+
+public:
+    class iterator {
+        Node* node;
+    public:
+        iterator(Node* n) : node(n) {}
+        UserNode* operator*() const { return node->user; }
+        iterator& operator++() { node = node->next; return *this; }
+        bool operator!=(const iterator& other) const { return node != other.node; }
+        bool operator==(const iterator& other) const { return node == other.node; }
+    };
+
+    UserListRange(Node* first = NULL) : head(first) {}
+    iterator begin() const { return iterator(head); }
+    iterator end() const { return iterator(NULL); }
+    bool empty() const { return head == NULL; }
+};
+typedef UserListRange<FriendNode> FriendRange;
+typedef UserListRange<GroupMemberNode> MemberRange;
+
+// The groups a user belongs to, over the reverse membership list
+class GroupRange {
+    GroupMemberNode* head;
+
+public:
+    class iterator {
+        GroupMemberNode* node;
+    public:
+        iterator(GroupMemberNode* n) : node(n) {}
+        GroupNode* operator*() const { return node->group; }
+        iterator& operator++() { node = node->nextOfUser; return *this; }
+        bool operator!=(const iterator& other) const { return node != other.node; }
+        bool operator==(const iterator& other) const { return node == other.node; }
+    };
+
+    GroupRange(GroupMemberNode* first = NULL) : head(first) {}
+    iterator begin() const { return iterator(head); }
+    iterator end() const { return iterator(NULL); }
+    bool empty() const { return head == NULL; }
+};
+
+// A message in a user's merged view: from the inbox (group NULL) or a group log
+struct MessageRef {
+    const MessageNode* msg;
+    GroupNode* group;
+    bool unread; // newer than the reader's read marker when the page was taken
+};
+
+// One page of a user's messages, plus counts taken before it was marked read
+struct MessagePage {
+    vector<MessageRef> messages;
+    size_t unread;
+    size_t total;
+};
+
+// Bytes per user for the profile fields, the old layout (five inline
+// std::strings per UserNode) against the current one (name/id inline,
+// attributes as pooled handles)
+struct MemoryUsage {
+    size_t users;
+    size_t distinctValues;
+    double legacyAttributeBytes, compactAttributeBytes;
+    double legacyProfileBytes, compactProfileBytes;
+};
+
+// What openStore() found
+struct StoreInfo {
+    uint64_t replayed;       // log records applied on top of the snapshot
+    uint64_t discardedBytes; // torn tail cut off the log
+    uint64_t failedRecord;   // sequence number, for STATUS_LOG_MISMATCH
+};
+
+// Immutable compressed-sparse-row copy of the friend graph. Row u holds the
+// sorted dense indices of u's friends in neighbors[offsets[u] .. offsets[u+1]).
+class FriendGraphSnapshot {
+    vector<uint32_t> offsets;
+    vector<uint32_t> neighbors;
+
+    static void appendRow(const vector<uint32_t>& row, vector<uint32_t>& out) {
+        out.insert(out.end(), row.begin(), row.end());
+    }
+
+public:
+    FriendGraphSnapshot() : offsets(1, 0) {}
+
+    uint32_t userCount() const { return (uint32_t)(offsets.size() - 1); }
+    size_t edgeCount() const { return neighbors.size(); } // each friendship counted twice
+    uint32_t degree(uint32_t u) const { return offsets[u + 1] - offsets[u]; }
+    const uint32_t* begin(uint32_t u) const { return neighbors.data() + offsets[u]; }
+    const uint32_t* end(uint32_t u) const { return neighbors.data() + offsets[u + 1]; }
+
+    void build(const MutualFriendsEngine& rows) {
+        offsets.assign(1, 0);
+        offsets.reserve(rows.userCount() + 1);
+        neighbors.clear();
+        for (uint32_t u = 0; u < rows.userCount(); u++) {
+            appendRow(rows.friendsOf(u), neighbors);
+            offsets.push_back((uint32_t)neighbors.size());
+        }
+    }
+
+    // Re-reads only the changed rows (plus users created since the last
+    // refresh); every other row is block-copied from the old arrays.
+    void refresh(const MutualFriendsEngine& rows, const vector<uint32_t>& changed) {
+        uint32_t oldCount = userCount();
+        vector<char> dirty(rows.userCount(), 0);
+        for (size_t i = 0; i < changed.size(); i++) dirty[changed[i]] = 1;
+
+        vector<uint32_t> newOffsets(1, 0);
+        vector<uint32_t> newNeighbors;
+        newOffsets.reserve(rows.userCount() + 1);
+        newNeighbors.reserve(neighbors.size() + changed.size());
+        for (uint32_t u = 0; u < rows.userCount(); u++) {
+            if (u < oldCount && !dirty[u])
+                newNeighbors.insert(newNeighbors.end(), begin(u), end(u));
+            else
+                appendRow(rows.friendsOf(u), newNeighbors);
+            newOffsets.push_back((uint32_t)newNeighbors.size());
+        }
+        offsets.swap(newOffsets);
+        neighbors.swap(newNeighbors);
+    }
+};
+
+// Binary snapshot format (native byte order, 8-byte aligned sections):
+//   header | users | friend CSR | pending CSR | inboxes | groups | string table
+// Every string (names, ids, attribute values, group names, message text)
+// is stored once in the string table and referenced by index.
+static const char SNAPSHOT_MAGIC[8] = { 'S', 'N', 'E', 'T', 'S', 'N', 'A', 'P' };
+static const uint32_t SNAPSHOT_VERSION = 1;
+static const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t userCount, groupCount, memberCount, groupMessageCount, stringCount;
+    uint64_t messageClock;
+    uint64_t logSequence; // last write-ahead log record the snapshot includes, 0 if none
+    uint64_t usersOffset, friendsOffset, pendingOffset, inboxOffset, groupsOffset, stringsOffset;
+    uint64_t fileSize;
+};
+
+struct SnapshotUser {
+    uint32_t name, id;
+    uint32_t attributes[ATTR_COUNT];
+    uint32_t reserved;
+    uint64_t readSeq;
+};
+
+struct SnapshotMessage {
+    uint32_t sender, text;
+    uint64_t seq;
+};
+
+struct SnapshotGroup {
+    uint32_t name;
+    uint32_t memberCount;
+    uint64_t messageCount;
+};
+
+struct SnapshotMember {
+    uint32_t user;
+    uint32_t reserved;
+    uint64_t joinedAt;
+};
+
+// Sequential snapshot writer; sections are padded to 8 bytes
+class SnapshotWriter {
+    FILE* file;
+    uint64_t offset;
+    bool failed;
+
+public:
+    SnapshotWriter(FILE* f) : file(f), offset(0), failed(false) {}
+
+    void write(const void* data, size_t bytes) {
+        if (bytes && fwrite(data, 1, bytes, file) != bytes) failed = true;
+        offset += bytes;
+    }
+    template <typename T> void put(const T& value) { write(&value, sizeof(T)); }
+    template <typename T> void putArray(const vector<T>& values) { write(values.data(), values.size() * sizeof(T)); }
+    uint64_t align() {
+        static const char zeros[8] = { 0 };
+        if (offset % 8) write(zeros, 8 - offset % 8);
+        return offset;
+    }
+    uint64_t position() const { return offset; }
+    bool ok() const { return !failed; }
+};
+
+// Read-only view of a whole file: memory-mapped where available, otherwise
+// read into an 8-byte aligned buffer.
+class MappedFile {
+    const char* bytes;
+    size_t length;
+#ifdef HAVE_MMAP
+    void* mapping;
+#else
+    vector<uint64_t> buffer;
+#endif
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+public:
+#ifdef HAVE_MMAP
+    MappedFile() : bytes(NULL), length(0), mapping(NULL) {}
+    ~MappedFile() { if (mapping) munmap(mapping, length); }
+
+    bool open(const string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) { close(fd); return false; }
+        length = (size_t)st.st_size;
+        mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) { mapping = NULL; return false; }
+        madvise(mapping, length, MADV_SEQUENTIAL);
+        bytes = (const char*)mapping;
+        return true;
+    }
+#else
+    MappedFile() : bytes(NULL), length(0) {}
+
+    bool open(const string& path) {
+        FILE* f = fopen(path.c_str(), "rb");
+        if (!f) return false;
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        if (size <= 0) { fclose(f); return false; }
+        length = (size_t)size;
+        buffer.resize((length + 7) / 8);
+        bool ok = fread(buffer.data(), 1, length, f) == length;
+        fclose(f);
+        bytes = (const char*)buffer.data();
+        return ok;
+    }
+#endif
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+    // Typed array at a file offset, or NULL if it would run past the end
+    template <typename T> const T* array(uint64_t offset, uint64_t count) const {
+        if (offset % alignof(T) || offset > length || count > (length - offset) / sizeof(T)) return NULL;
+        return (const T*)(bytes + offset);
+    }
+};
+
+inline uint64_t nowNanos() {
+    return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// CRC-32C (Castagnoli), used to detect torn or corrupt log records
+struct Crc32cTable {
+    uint32_t entries[256];
+    Crc32cTable() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+            entries[i] = c;
+        }
+    }
+};
+
+inline uint32_t crc32cTable(uint32_t crc, const void* data, size_t bytes) {
+    static const Crc32cTable table;
+    const unsigned char* p = (const unsigned char*)data;
+    crc = ~crc;
+    for (size_t i = 0; i < bytes; i++) crc = table.entries[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+#ifdef HAVE_X86_SIMD
+// Same polynomial as the table version, eight bytes per crc32 instruction
+__attribute__((target("sse4.2")))
+inline uint32_t crc32cSSE(uint32_t crc, const void* data, size_t bytes) {
+    const unsigned char* p = (const unsigned char*)data;
+    crc = ~crc;
+#ifdef __x86_64__
+    for (; bytes >= 8; p += 8, bytes -= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc = (uint32_t)_mm_crc32_u64(crc, v);
+    }
+#endif
+    for (; bytes; p++, bytes--) crc = _mm_crc32_u8(crc, *p);
+    return ~crc;
+}
+#endif
+
+typedef uint32_t (*Crc32cFn)(uint32_t crc, const void* data, size_t bytes);
+
+inline Crc32cFn selectCrc32c() {
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) return crc32cSSE;
+#endif
+    return crc32cTable;
+}
+
+inline uint32_t crc32c(uint32_t crc, const void* data, size_t bytes) {
+    static const Crc32cFn fn = selectCrc32c();
+    return fn(crc, data, bytes);
+}
+
+// Write-ahead log: a 16-byte header followed by records of
+//   u32 payload length | u32 crc | u64 sequence | u8 op | payload
+// The CRC covers sequence, op and payload, so a record torn by a crash is
+// detected and cut off during recovery. Integers are native-endian, as in
+// the snapshot.
+static const char WAL_MAGIC[8] = { 'S', 'N', 'E', 'T', 'W', 'A', 'L', '1' };
+static const uint32_t WAL_VERSION = 1;
+static const size_t WAL_HEADER_BYTES = 16;
+static const size_t WAL_RECORD_HEADER = 17;
+static const uint32_t WAL_MAX_PAYLOAD = 1u << 30;
+
+enum WalOp {
+    WAL_CREATE_USER = 1,  // name, id, attribute values
+    WAL_RENAME_USER,      // user, name
+    WAL_SET_ATTRIBUTE,    // user, attribute, value
+    WAL_FRIEND_REQUEST,   // sender, receiver
+    WAL_ACCEPT_REQUEST,   // user, sender
+    WAL_REJECT_REQUEST,   // user, sender
+    WAL_UNFRIEND,         // user, friend
+    WAL_CREATE_GROUP,     // group
+    WAL_JOIN_GROUP,       // user, group
+    WAL_LEAVE_GROUP,      // user, group
+    WAL_MESSAGE,          // sender, receiver, seq, text
+    WAL_GROUP_MESSAGE,    // sender, group, seq, text
+    WAL_MARK_READ,        // user, seq
+    WAL_QUEUED_MESSAGE,   // sender, receiver, text: onto the receiver's queue
+    WAL_DRAIN             // user, first seq, count, then each queued record's sequence
+};
+
+// Record payload; users are written by index, groups and text as strings
+class WalRecord {
+    string bytes;
+
+public:
+    WalRecord& u32(uint32_t v) { bytes.append((const char*)&v, sizeof(v)); return *this; }
+    WalRecord& u64(uint64_t v) { bytes.append((const char*)&v, sizeof(v)); return *this; }
+    WalRecord& str(const string& v) { u32((uint32_t)v.size()); bytes.append(v); return *this; }
+    const string& data() const { return bytes; }
+};
+
+// Bounds-checked payload decoder; ok() is false after any overrun or if
+// bytes are left over
+class WalReader {
+    const char* p;
+    const char* end;
+    bool failed;
+
+    bool take(size_t n) {
+        if (failed || (size_t)(end - p) < n) { failed = true; return false; }
+        return true;
+    }
+
+public:
+    WalReader(const char* data, size_t bytes) : p(data), end(data + bytes), failed(false) {}
+
+    uint32_t u32() {
+        uint32_t v = 0;
+        if (take(sizeof(v))) { memcpy(&v, p, sizeof(v)); p += sizeof(v); }
+        return v;
+    }
+    uint64_t u64() {
+        uint64_t v = 0;
+        if (take(sizeof(v))) { memcpy(&v, p, sizeof(v)); p += sizeof(v); }
+        return v;
+    }
+    string str() {
+        uint32_t n = u32();
+        if (!take(n)) return string();
+        string v(p, n);
+        p += n;
+        return v;
+    }
+    bool ok() const { return !failed && p == end; }
+};
+
+// Walks the intact records of a mapped log. Stops at the first record that
+// is truncated or fails its CRC; validBytes() is then where appending resumes.
+class WalScanner {
+    const MappedFile& file;
+    size_t pos;
+    bool headerOk;
+
+public:
+    WalScanner(const MappedFile& f) : file(f), pos(WAL_HEADER_BYTES), headerOk(false) {
+        uint32_t version = 0, byteOrder = 0;
+        if (file.size() >= WAL_HEADER_BYTES && memcmp(file.data(), WAL_MAGIC, sizeof(WAL_MAGIC)) == 0) {
+            memcpy(&version, file.data() + 8, 4);
+            memcpy(&byteOrder, file.data() + 12, 4);
+        }
+        headerOk = version == WAL_VERSION && byteOrder == SNAPSHOT_BYTE_ORDER;
+    }
+
+    bool valid() const { return headerOk; }
+    uint64_t validBytes() const { return headerOk ? pos : 0; }
+
+    bool next(uint64_t& seq, uint8_t& op, const char*& payload, uint32_t& length) {
+        if (!headerOk || file.size() - pos < WAL_RECORD_HEADER) return false;
+        const char* rec = file.data() + pos;
+        uint32_t crc;
+        memcpy(&length, rec, 4);
+        memcpy(&crc, rec + 4, 4);
+        if (length > WAL_MAX_PAYLOAD || file.size() - pos - WAL_RECORD_HEADER < length) return false;
+        if (crc32c(0, rec + 8, WAL_RECORD_HEADER - 8 + length) != crc) return false;
+        memcpy(&seq, rec + 8, 8);
+        op = (uint8_t)rec[16];
+        payload = rec + WAL_RECORD_HEADER;
+        pos += WAL_RECORD_HEADER + length;
+        return true;
+    }
+};
+
+// Append side of the log with group commit. append() only buffers; a
+// flusher thread writes the buffer out with a single write and fdatasync
+// once GROUP_BYTES are pending or the oldest pending record is GROUP_NANOS
+// old, and commit() does so at once. Any thread may append. After a failed
+// write the log stays failed: nothing more is appended or written.
+class WriteAheadLog {
+#ifdef HAVE_POSIX_IO
+    int fd;
+#else
+    FILE* file;
+#endif
+    mutex lock;       // pending buffer and flusher state
+    mutex io;         // one write-out at a time, so the file keeps append order
+    condition_variable wake;    // flusher: records pending, or stop
+    condition_variable drained; // appenders held back by MAX_PENDING
+    string pending, writing;
+    uint64_t pendingSince;
+    uint64_t sequence; // last record sequence handed out
+    atomic<uint64_t> recordCount, syncCount;
+    atomic<bool> failed;
+    bool stopping;
+    thread flusher;
+
+    WriteAheadLog(const WriteAheadLog&);
+    WriteAheadLog& operator=(const WriteAheadLog&);
+
+public:
+    static constexpr size_t GROUP_BYTES = 1 << 20;
+    static constexpr uint64_t GROUP_NANOS = 2000000; // 2 ms
+    static constexpr size_t MAX_PENDING = 16 * GROUP_BYTES; // appenders wait beyond this
+
+#ifdef HAVE_POSIX_IO
+    WriteAheadLog() : fd(-1), pendingSince(0), sequence(0), recordCount(0), syncCount(0), failed(false), stopping(false) {}
+#else
+    WriteAheadLog() : file(NULL), pendingSince(0), sequence(0), recordCount(0), syncCount(0), failed(false), stopping(false) {}
+#endif
+    ~WriteAheadLog() {
+        if (flusher.joinable()) {
+            {
+                lock_guard<mutex> hold(lock);
+                stopping = true;
+            }
+            wake.notify_one();
+            flusher.join();
+        }
+        commit();
+#ifdef HAVE_POSIX_IO
+        if (fd >= 0) close(fd);
+#else
+        if (file) fclose(file);
+#endif
+    }
+
+    // Opens the log for appending after its first validBytes bytes (a torn
+    // tail beyond that is cut off). validBytes == 0 starts a new log.
+    // Records appended from now on are numbered after lastSeq.
+    bool open(const string& path, uint64_t validBytes, uint64_t lastSeq) {
+        sequence = lastSeq;
+#ifdef HAVE_POSIX_IO
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+        if (fd < 0) return false;
+#else
+        file = fopen(path.c_str(), validBytes ? "r+b" : "wb");
+        if (!file) return false;
+#endif
+        if (validBytes == 0 ? !reset() : !truncateTo(validBytes) || !syncFile()) return false;
+        flusher = thread(&WriteAheadLog::flushLoop, this);
+        return true;
+    }
+
+    // Buffers one record and returns its sequence number; no I/O happens
+    // here. Records are numbered in the order they are appended.
+    uint64_t append(uint8_t op, const WalRecord& rec) {
+        const string& payload = rec.data();
+        char header[WAL_RECORD_HEADER];
+        uint32_t length = (uint32_t)payload.size();
+        memcpy(header, &length, 4);
+        header[16] = (char)op;
+        unique_lock<mutex> hold(lock);
+        while (pending.size() >= MAX_PENDING && !failed) drained.wait(hold);
+        uint64_t seq = ++sequence;
+        if (failed) return seq;
+        memcpy(header + 8, &seq, 8);
+        uint32_t crc = crc32c(crc32c(0, header + 8, WAL_RECORD_HEADER - 8), payload.data(), payload.size());
+        memcpy(header + 4, &crc, 4);
+        if (pending.empty()) {
+            pendingSince = nowNanos();
+            wake.notify_one(); // starts the deadline
+        }
+        pending.append(header, WAL_RECORD_HEADER);
+        pending.append(payload);
+        recordCount++;
+        if (pending.size() >= GROUP_BYTES) wake.notify_one();
+        return seq;
+    }
+
+    // Makes every record appended before the call durable
+    bool commit() {
+        lock_guard<mutex> serial(io);
+        {
+            lock_guard<mutex> hold(lock);
+            if (pending.empty() || failed) return !failed;
+            writing.swap(pending);
+        }
+        drained.notify_all();
+        bool written = writeAll(writing.data(), writing.size()) && syncFile();
+        writing.clear();
+        syncCount++;
+        if (!written) fail();
+        return written;
+    }
+
+    // Empties the log, keeping only the header (after compaction)
+    bool reset() {
+        lock_guard<mutex> serial(io);
+        {
+            lock_guard<mutex> hold(lock);
+            if (failed) return false;
+            pending.clear();
+        }
+        drained.notify_all();
+        char header[WAL_HEADER_BYTES];
+        uint32_t version = WAL_VERSION, byteOrder = SNAPSHOT_BYTE_ORDER;
+        memcpy(header, WAL_MAGIC, 8);
+        memcpy(header + 8, &version, 4);
+        memcpy(header + 12, &byteOrder, 4);
+        if (!truncateTo(0) || !writeAll(header, sizeof(header)) || !syncFile()) fail();
+        return !failed;
+    }
+
+    // Sequence of the last record appended
+    uint64_t lastSequence() {
+        lock_guard<mutex> hold(lock);
+        return sequence;
+    }
+    uint64_t records() const { return recordCount; }
+    uint64_t syncs() const { return syncCount; }
+    bool ok() const { return !failed; }
+
+private:
+    void fail() {
+        {
+            lock_guard<mutex> hold(lock);
+            failed = true;
+            pending.clear();
+        }
+        drained.notify_all();
+    }
+    // Writes the buffer out when it is full or its oldest record is due
+    void flushLoop() {
+        unique_lock<mutex> hold(lock);
+        while (!stopping) {
+            if (pending.empty() || failed) {
+                wake.wait(hold);
+                continue;
+            }
+            uint64_t age = nowNanos() - pendingSince;
+            if (pending.size() < GROUP_BYTES && age < GROUP_NANOS) {
+                wake.wait_for(hold, chrono::nanoseconds(GROUP_NANOS - age));
+                continue;
+            }
+            hold.unlock();
+            commit();
+            hold.lock();
+        }
+    }
+#ifdef HAVE_POSIX_IO
+    bool writeAll(const char* data, size_t bytes) {
+        while (bytes) {
+            ssize_t n = write(fd, data, bytes);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += n;
+            bytes -= (size_t)n;
+        }
+        return true;
+    }
+    bool syncFile() {
+#ifdef __APPLE__
+        return fsync(fd) == 0;
+#else
+        return fdatasync(fd) == 0;
+#endif
+    }
+    bool truncateTo(uint64_t bytes) {
+        return ftruncate(fd, (off_t)bytes) == 0 && lseek(fd, (off_t)bytes, SEEK_SET) == (off_t)bytes;
+    }
+#else
+    bool writeAll(const char* data, size_t bytes) { return fwrite(data, 1, bytes, file) == bytes; }
+    bool syncFile() { return fflush(file) == 0; }
+    bool truncateTo(uint64_t bytes) {
+        if (bytes == 0) return freopen(NULL, "wb", file) != NULL; // no portable truncate in stdio
+        return fseek(file, (long)bytes, SEEK_SET) == 0;
+    }
+#endif
+};
+
+// A piece of parallel work over an index range. worker (0 .. threads-1)
+// picks per-worker scratch, so tasks need no locks of their own.
+class RangeTask {
+public:
+    virtual ~RangeTask() {}
+    virtual void run(uint32_t begin, uint32_t end, unsigned worker) = 0;
+};
+
+// Fixed set of threads running parallelFor() jobs. Each worker keeps a
+// deque of index ranges: it takes from the back, halving anything above
+// the grain size and pushing the far half back, and once its own deque is
+// empty it steals from the front of another's, where the biggest ranges
+// wait. Uneven work (a hub's friend list) ends up spread over all workers.
+// The calling thread works as worker 0.
+class WorkStealingPool {
+    struct Range { uint32_t begin, end; };
+    struct alignas(64) Queue {
+        mutex lock;
+        deque<Range> ranges;
+    };
+
+    unsigned workerCount;
+    Queue* queues;
+    vector<thread> threads;
+
+    mutex m;
+    condition_variable wake, finished;
+    uint64_t generation; // bumped per job
+    unsigned busy;       // helper threads still in the current job
+    bool stopping;
+    RangeTask* task;
+    uint32_t grain;
+    atomic<uint64_t> remaining; // indices not yet run
+
+    WorkStealingPool(const WorkStealingPool&);
+    WorkStealingPool& operator=(const WorkStealingPool&);
+
+    void push(unsigned w, Range r) {
+        lock_guard<mutex> hold(queues[w].lock);
+        queues[w].ranges.push_back(r);
+    }
+    bool take(unsigned w, Range& r) {
+        lock_guard<mutex> hold(queues[w].lock);
+        if (queues[w].ranges.empty()) return false;
+        r = queues[w].ranges.back();
+        queues[w].ranges.pop_back();
+        return true;
+    }
+    bool steal(unsigned self, Range& r) {
+        for (unsigned i = 1; i < workerCount; i++) {
+            Queue& victim = queues[(self + i) % workerCount];
+            lock_guard<mutex> hold(victim.lock);
+            if (victim.ranges.empty()) continue;
+            r = victim.ranges.front();
+            victim.ranges.pop_front();
+            return true;
+        }
+        return false;
+    }
+    void work(unsigned self) {
+        Range r;
+        while (remaining.load() > 0) {
+            if (!take(self, r) && !steal(self, r)) {
+                this_thread::yield(); // the last ranges are running elsewhere
+                continue;
+            }
+            while (r.end - r.begin > grain) {
+                uint32_t mid = r.begin + (r.end - r.begin) / 2;
+                Range far = { mid, r.end };
+                push(self, far);
+                r.end = mid;
+            }
+            task->run(r.begin, r.end, self);
+            remaining.fetch_sub(r.end - r.begin);
+        }
+    }
+    void threadMain(unsigned self) {
+        uint64_t seen = 0;
+        for (;;) {
+            {
+                unique_lock<mutex> hold(m);
+                while (generation == seen && !stopping) wake.wait(hold);
+                if (stopping) return;
+                seen = generation;
+            }
+            work(self);
+            lock_guard<mutex> hold(m);
+            if (--busy == 0) finished.notify_all();
+        }
+    }
+
+public:
+    // 0 threads: one per core
+    WorkStealingPool(unsigned threadCount = 0)
+        : generation(0), busy(0), stopping(false), task(NULL), grain(1), remaining(0) {
+        workerCount = threadCount ? threadCount : max(thread::hardware_concurrency(), 1u);
+        queues = new Queue[workerCount];
+        for (unsigned w = 1; w < workerCount; w++) threads.push_back(thread(&WorkStealingPool::threadMain, this, w));
+    }
+    ~WorkStealingPool() {
+        {
+            lock_guard<mutex> hold(m);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+        delete[] queues;
+    }
+
+    unsigned size() const { return workerCount; }
+
+    // Runs job over [0, n) in ranges of at most grainSize indices and
+    // returns once all of them are done
+    void parallelFor(uint32_t n, uint32_t grainSize, RangeTask& job) {
+        if (n == 0) return;
+        task = &job;
+        grain = max(grainSize, 1u);
+        remaining = n;
+        for (unsigned w = 0; w < workerCount; w++) { // an even slice each to start with
+            Range r = { (uint32_t)((uint64_t)n * w / workerCount), (uint32_t)((uint64_t)n * (w + 1) / workerCount) };
+            if (r.begin < r.end) push(w, r);
+        }
+        if (workerCount > 1) {
+            {
+                lock_guard<mutex> hold(m);
+                busy = workerCount - 1;
+                generation++;
+            }
+            wake.notify_all();
+        }
+        work(0);
+        unique_lock<mutex> hold(m);
+        while (busy) finished.wait(hold);
+    }
+};
+
+// Whole-network statistics from GraphAnalytics
+struct GraphReport {
+    uint32_t users;
+    uint64_t friendships;
+
+    uint32_t components;
+    uint32_t largestComponent; // users
+    uint32_t isolatedUsers;    // no friends
+
+    uint32_t minDegree, maxDegree, medianDegree;
+    double meanDegree;
+    vector<uint32_t> degreeBuckets; // [0]: no friends, [b]: 2^(b-1) .. 2^b - 1 friends
+
+    uint64_t triangles; // friend trios who are all friends with each other
+    uint64_t wedges;    // pairs of friends of the same user
+    double averageClustering; // mean share of a user's friend pairs who are friends
+    double transitivity;      // 3 * triangles / wedges
+
+    uint32_t maxCore;     // largest k with a group where everyone has k friends inside it
+    uint32_t maxCoreSize; // users in that innermost core
+
+    double seconds[4]; // components, degrees, triangles, cores
+};
+
+// Parallel whole-graph analytics over a CSR snapshot: connected components
+// (lock-free union-find), degree distribution, triangle counts with
+// clustering coefficients, and k-core decomposition. Per-user results stay
+// in the public arrays after run().
+class GraphAnalytics {
+    static constexpr uint32_t NO_CORE = 0xFFFFFFFFu;
+    static constexpr uint32_t GRAIN = 256; // users per stolen range at the finest
+
+    const FriendGraphSnapshot& graph;
+    WorkStealingPool& pool;
+    uint32_t n;
+
+    // Connected components: union-find over atomic parent links. Roots are
+    // only ever linked below a smaller root, by CAS, so concurrent unions
+    // cannot form a cycle and every root ends up the smallest index in its
+    // component. Finds halve paths as they go.
+    vector<atomic<uint32_t> > parent;
+
+    uint32_t find(uint32_t x) {
+        for (;;) {
+            uint32_t p = parent[x].load(memory_order_relaxed);
+            if (p == x) return x;
+            uint32_t gp = parent[p].load(memory_order_relaxed);
+            if (gp != p) parent[x].compare_exchange_weak(p, gp, memory_order_relaxed);
+            x = gp;
+        }
+    }
+    void unite(uint32_t a, uint32_t b) {
+        for (;;) {
+            a = find(a);
+            b = find(b);
+            if (a == b) return;
+            if (a < b) swap(a, b);
+            uint32_t root = a;
+            if (parent[a].compare_exchange_strong(root, b)) return;
+        }
+    }
+    struct UnionTask : RangeTask {
+        GraphAnalytics& a;
+        UnionTask(GraphAnalytics& owner) : a(owner) {}
+        void run(uint32_t begin, uint32_t end, unsigned) {
+            for (uint32_t u = begin; u < end; u++)
+                for (const uint32_t* v = a.graph.begin(u); v != a.graph.end(u) && *v < u; v++) a.unite(u, *v);
+        }
+    };
+    struct LabelTask : RangeTask {
+        GraphAnalytics& a;
+        LabelTask(GraphAnalytics& owner) : a(owner) {}
+        void run(uint32_t begin, uint32_t end, unsigned) {
+            for (uint32_t u = begin; u < end; u++) a.component[u] = a.find(u);
+        }
+    };
+
+    // Degrees, one partial result per worker
+    struct DegreePart {
+        uint32_t minDegree, maxDegree;
+        uint64_t sum, wedges;
+        vector<uint32_t> buckets;
+    };
+    static uint32_t degreeBucket(uint32_t d) {
+        uint32_t b = 0;
+        while (d) { b++; d >>= 1; }
+        return b;
+    }
+    struct DegreeTask : RangeTask {
+        GraphAnalytics& a;
+        vector<DegreePart> parts;
+        DegreeTask(GraphAnalytics& owner) : a(owner), parts(owner.pool.size()) {
+            for (size_t w = 0; w < parts.size(); w++) {
+                parts[w].minDegree = 0xFFFFFFFFu;
+                parts[w].maxDegree = 0;
+                parts[w].sum = parts[w].wedges = 0;
+                parts[w].buckets.assign(33, 0);
+            }
+        }
+        void run(uint32_t begin, uint32_t end, unsigned worker) {
+            DegreePart& p = parts[worker];
+            for (uint32_t u = begin; u < end; u++) {
+                uint32_t d = a.graph.degree(u);
+                p.minDegree = min(p.minDegree, d);
+                p.maxDegree = max(p.maxDegree, d);
+                p.sum += d;
+                p.wedges += (uint64_t)d * (d - (d > 0)) / 2;
+                p.buckets[degreeBucket(d)]++;
+            }
+        }
+    };
+
+    // Triangles: each friendship is pointed from the lower-ranked user to
+    // the higher one, ranking by (degree, index), so every triangle is found
+    // exactly once and no user has more than about sqrt(2m) out-edges;
+    // hubs stop dominating. Out-rows stay sorted by index for intersectSorted.
+    vector<uint32_t> outOffsets, outNeighbors;
+    vector<atomic<uint64_t> > triangleCounts; // up to d(d-1)/2 per user, past 32 bits for big hubs
+
+    bool ranksBelow(uint32_t u, uint32_t v) const {
+        uint32_t du = graph.degree(u), dv = graph.degree(v);
+        return du < dv || (du == dv && u < v);
+    }
+    struct OutDegreeTask : RangeTask {
+        GraphAnalytics& a;
+        OutDegreeTask(GraphAnalytics& owner) : a(owner) {}
+        void run(uint32_t begin, uint32_t end, unsigned) {
+            for (uint32_t u = begin; u < end; u++) {
+                uint32_t count = 0;
+                for (const uint32_t* v = a.graph.begin(u); v != a.graph.end(u); v++) count += a.ranksBelow(u, *v);
+                a.outOffsets[u + 1] = count;
+            }
+        }
+    };
+    struct OutRowTask : RangeTask {
+        GraphAnalytics& a;
+        OutRowTask(GraphAnalytics& owner) : a(owner) {}
+        void run(uint32_t begin, uint32_t end, unsigned) {
+            for (uint32_t u = begin; u < end; u++) {
+                uint32_t* out = a.outNeighbors.data() + a.outOffsets[u];
+                for (const uint32_t* v = a.graph.begin(u); v != a.graph.end(u); v++)
+                    if (a.ranksBelow(u, *v)) *out++ = *v;
+            }
+        }
+    };
+    struct TriangleTask : RangeTask {
+        GraphAnalytics& a;
+        vector<vector<uint32_t> > common; // per worker
+        vector<uint64_t> found;           // per worker
+        TriangleTask(GraphAnalytics& owner, uint32_t maxOutDegree)
+            : a(owner), common(owner.pool.size(), vector<uint32_t>(maxOutDegree)), found(owner.pool.size(), 0) {}
+        void run(uint32_t begin, uint32_t end, unsigned worker) {
+            uint32_t* buf = common[worker].data();
+            for (uint32_t u = begin; u < end; u++) {
+                const uint32_t* ub = a.outNeighbors.data() + a.outOffsets[u];
+                size_t un = a.outOffsets[u + 1] - a.outOffsets[u];
+                uint64_t here = 0;
+                for (size_t i = 0; i < un; i++) {
+                    uint32_t v = ub[i];
+                    const uint32_t* vb = a.outNeighbors.data() + a.outOffsets[v];
+                    size_t k = intersectSorted(ub, un, vb, a.outOffsets[v + 1] - a.outOffsets[v], buf);
+                    if (!k) continue;
+                    here += k;
+                    a.triangleCounts[v].fetch_add(k, memory_order_relaxed);
+                    for (size_t j = 0; j < k; j++) a.triangleCounts[buf[j]].fetch_add(1, memory_order_relaxed);
+                }
+                if (here) a.triangleCounts[u].fetch_add(here, memory_order_relaxed);
+                found[worker] += here;
+            }
+        }
+    };
+
+    // k-cores by level-synchronous peeling: at level k every remaining user
+    // with exactly k remaining friends gets core k and is peeled; a friend
+    // whose count drops from k + 1 to k joins the next sub-round. Counts
+    // never go below k (an overshoot is put back), so each user is queued once.
+    vector<atomic<uint32_t> > remainingDegree;
+    vector<uint32_t> frontier;
+    vector<vector<uint32_t> > nextFrontier; // per worker
+    uint32_t level;
+
+    struct CoreScanTask : RangeTask {
+        GraphAnalytics& a;
+        vector<uint32_t> minAbove; // per worker: smallest remaining count above the level
+        CoreScanTask(GraphAnalytics& owner) : a(owner), minAbove(owner.pool.size(), 0xFFFFFFFFu) {}
+        void run(uint32_t begin, uint32_t end, unsigned worker) {
+            for (uint32_t u = begin; u < end; u++) {
+                if (a.core[u] != NO_CORE) continue;
+                uint32_t d = a.remainingDegree[u].load(memory_order_relaxed);
+                if (d == a.level) a.nextFrontier[worker].push_back(u);
+                else if (d > a.level) minAbove[worker] = min(minAbove[worker], d);
+            }
+        }
+    };
+    struct PeelTask : RangeTask {
+        GraphAnalytics& a;
+        PeelTask(GraphAnalytics& owner) : a(owner) {}
+        void run(uint32_t begin, uint32_t end, unsigned worker) {
+            uint32_t k = a.level;
+            for (uint32_t i = begin; i < end; i++) {
+                uint32_t u = a.frontier[i];
+                a.core[u] = k;
+                for (const uint32_t* v = a.graph.begin(u); v != a.graph.end(u); v++) {
+                    if (a.remainingDegree[*v].load(memory_order_relaxed) <= k) continue;
+                    uint32_t before = a.remainingDegree[*v].fetch_sub(1, memory_order_relaxed);
+                    if (before == k + 1) a.nextFrontier[worker].push_back(*v);
+                    else if (before <= k) a.remainingDegree[*v].fetch_add(1, memory_order_relaxed);
+                }
+            }
+        }
+    };
+    // Moves the per-worker queues into frontier
+    void gatherFrontier() {
+        frontier.clear();
+        for (size_t w = 0; w < nextFrontier.size(); w++) {
+            frontier.insert(frontier.end(), nextFrontier[w].begin(), nextFrontier[w].end());
+            nextFrontier[w].clear();
+        }
+    }
+
+public:
+    vector<uint32_t> component; // per user: smallest user index in their component
+    vector<uint64_t> triangles; // per user: triangles they are part of
+    vector<uint32_t> core;      // per user: core number
+
+    GraphAnalytics(const FriendGraphSnapshot& snapshot, WorkStealingPool& threads)
+        : graph(snapshot), pool(threads), n(snapshot.userCount()), level(0) {}
+
+    void components(GraphReport& report) {
+        parent = vector<atomic<uint32_t> >(n);
+        for (uint32_t u = 0; u < n; u++) parent[u].store(u, memory_order_relaxed);
+        UnionTask unions(*this);
+        pool.parallelFor(n, GRAIN, unions);
+        component.resize(n);
+        LabelTask labels(*this);
+        pool.parallelFor(n, GRAIN * 16, labels);
+        parent = vector<atomic<uint32_t> >();
+
+        vector<uint32_t> sizes(n, 0);
+        report.components = report.largestComponent = report.isolatedUsers = 0;
+        for (uint32_t u = 0; u < n; u++) {
+            if (component[u] == u) report.components++;
+            report.largestComponent = max(report.largestComponent, ++sizes[component[u]]);
+            if (graph.degree(u) == 0) report.isolatedUsers++;
+        }
+    }
+
+    void degrees(GraphReport& report) {
+        DegreeTask task(*this);
+        pool.parallelFor(n, GRAIN * 16, task);
+        DegreePart total = task.parts[0];
+        for (size_t w = 1; w < task.parts.size(); w++) {
+            const DegreePart& p = task.parts[w];
+            total.minDegree = min(total.minDegree, p.minDegree);
+            total.maxDegree = max(total.maxDegree, p.maxDegree);
+            total.sum += p.sum;
+            total.wedges += p.wedges;
+            for (size_t b = 0; b < total.buckets.size(); b++) total.buckets[b] += p.buckets[b];
+        }
+        while (total.buckets.size() > 1 && total.buckets.back() == 0) total.buckets.pop_back();
+        report.minDegree = n ? total.minDegree : 0;
+        report.maxDegree = total.maxDegree;
+        report.meanDegree = n ? (double)total.sum / n : 0;
+        report.wedges = total.wedges;
+        report.degreeBuckets = total.buckets;
+
+        // Median by counting, since degrees are bounded by maxDegree
+        vector<uint32_t> counts(total.maxDegree + 1, 0);
+        for (uint32_t u = 0; u < n; u++) counts[graph.degree(u)]++;
+        report.medianDegree = 0;
+        for (uint32_t d = 0, seen = 0; d < counts.size(); d++) {
+            seen += counts[d];
+            if (seen * 2 >= n) { report.medianDegree = d; break; }
+        }
+    }
+
+    void trianglesAndClustering(GraphReport& report) {
+        outOffsets.assign(n + 1, 0);
+        OutDegreeTask outDegrees(*this);
+        pool.parallelFor(n, GRAIN * 4, outDegrees);
+        uint32_t maxOut = 0;
+        for (uint32_t u = 0; u < n; u++) {
+            maxOut = max(maxOut, outOffsets[u + 1]);
+            outOffsets[u + 1] += outOffsets[u];
+        }
+        outNeighbors.resize(outOffsets[n]);
+        OutRowTask outRows(*this);
+        pool.parallelFor(n, GRAIN * 4, outRows);
+
+        triangleCounts = vector<atomic<uint64_t> >(n);
+        TriangleTask task(*this, maxOut);
+        pool.parallelFor(n, GRAIN, task);
+        report.triangles = 0;
+        for (size_t w = 0; w < task.found.size(); w++) report.triangles += task.found[w];
+
+        triangles.resize(n);
+        double clusteringSum = 0;
+        for (uint32_t u = 0; u < n; u++) {
+            triangles[u] = triangleCounts[u].load(memory_order_relaxed);
+            uint64_t d = graph.degree(u);
+            if (d >= 2) clusteringSum += 2.0 * triangles[u] / ((double)d * (d - 1));
+        }
+        report.averageClustering = n ? clusteringSum / n : 0;
+        report.transitivity = report.wedges ? 3.0 * report.triangles / report.wedges : 0;
+        triangleCounts = vector<atomic<uint64_t> >();
+        outOffsets = vector<uint32_t>();
+        outNeighbors = vector<uint32_t>();
+    }
+
+    void cores(GraphReport& report) {
+        core.assign(n, NO_CORE);
+        remainingDegree = vector<atomic<uint32_t> >(n);
+        for (uint32_t u = 0; u < n; u++) remainingDegree[u].store(graph.degree(u), memory_order_relaxed);
+        nextFrontier.assign(pool.size(), vector<uint32_t>());
+        uint32_t peeled = 0;
+        report.maxCore = 0;
+        level = 0;
+        while (peeled < n) {
+            CoreScanTask scan(*this);
+            pool.parallelFor(n, GRAIN * 16, scan);
+            gatherFrontier();
+            if (frontier.empty()) { // no user sits at this level; jump to the next one that does
+                level = *min_element(scan.minAbove.begin(), scan.minAbove.end());
+                continue;
+            }
+            report.maxCore = level;
+            while (!frontier.empty()) {
+                PeelTask peel(*this);
+                pool.parallelFor((uint32_t)frontier.size(), GRAIN, peel);
+                peeled += (uint32_t)frontier.size();
+                gatherFrontier();
+            }
+            level++;
+        }
+        report.maxCoreSize = (uint32_t)count(core.begin(), core.end(), report.maxCore);
+        remainingDegree = vector<atomic<uint32_t> >();
+    }
+
+    void run(GraphReport& report) {
+        report.users = n;
+        report.friendships = graph.edgeCount() / 2;
+        uint64_t t0 = nowNanos();
+        components(report);
+        uint64_t t1 = nowNanos();
+        degrees(report); // before triangles, which need the wedge count
+        uint64_t t2 = nowNanos();
+        trianglesAndClustering(report);
+        uint64_t t3 = nowNanos();
+        cores(report);
+        uint64_t t4 = nowNanos();
+        report.seconds[0] = (t1 - t0) / 1e9;
+        report.seconds[1] = (t2 - t1) / 1e9;
+        report.seconds[2] = (t3 - t2) / 1e9;
+        report.seconds[3] = (t4 - t3) / 1e9;
+    }
+};
+
+// Log-linear histogram in the style of HdrHistogram: values below 16 are
+// exact, and above that every power of two is split into 16 buckets, so
+// any reading is within about 6% of the true value. Counters are relaxed
+// atomics, so recording from several threads never takes a lock; a single
+// recorder skips the locked increments altogether.
+class Histogram {
+    static constexpr int SUB_BITS = 4;
+    static constexpr int SUB = 1 << SUB_BITS;
+    static constexpr int BUCKETS = 41 * SUB; // up to 2^44, about five hours in nanoseconds
+
+    atomic<uint64_t> counts[BUCKETS];
+    atomic<uint64_t> sum, largest;
+
+    static int bucketOf(uint64_t v) {
+        if (v < SUB) return (int)v;
+        int magnitude = 63 - __builtin_clzll(v);
+        int b = (magnitude - SUB_BITS + 1) * SUB + (int)((v >> (magnitude - SUB_BITS)) & (SUB - 1));
+        return min(b, BUCKETS - 1);
+    }
+    // Largest value that lands in bucket b
+    static uint64_t highestOf(int b) {
+        if (b < SUB) return (uint64_t)b;
+        int shift = b / SUB - 1;
+        return (((uint64_t)(SUB + b % SUB) + 1) << shift) - 1;
+    }
+
+    Histogram(const Histogram&);
+    Histogram& operator=(const Histogram&);
+
+public:
+    Histogram() : sum(0), largest(0) {
+        for (int b = 0; b < BUCKETS; b++) counts[b].store(0, memory_order_relaxed);
+    }
+
+    // shared: other threads may record into this histogram at the same time
+    void record(uint64_t v, bool shared) {
+        atomic<uint64_t>& bucket = counts[bucketOf(v)];
+        if (shared) {
+            bucket.fetch_add(1, memory_order_relaxed);
+            sum.fetch_add(v, memory_order_relaxed);
+        } else {
+            bucket.store(bucket.load(memory_order_relaxed) + 1, memory_order_relaxed);
+            sum.store(sum.load(memory_order_relaxed) + v, memory_order_relaxed);
+        }
+        uint64_t seen = largest.load(memory_order_relaxed);
+        while (v > seen && !largest.compare_exchange_weak(seen, v, memory_order_relaxed)) {}
+    }
+
+    uint64_t count() const {
+        uint64_t n = 0;
+        for (int b = 0; b < BUCKETS; b++) n += counts[b].load(memory_order_relaxed);
+        return n;
+    }
+    uint64_t maxValue() const { return largest.load(memory_order_relaxed); }
+    double mean() const {
+        uint64_t n = count();
+        return n ? (double)sum.load(memory_order_relaxed) / n : 0;
+    }
+    // Upper bound of the bucket holding the q-quantile (0 < q <= 1)
+    uint64_t percentile(double q) const {
+        uint64_t n = count();
+        if (!n) return 0;
+        uint64_t rank = max<uint64_t>((uint64_t)ceil(q * n), 1), seen = 0;
+        for (int b = 0; b < BUCKETS; b++) {
+            seen += counts[b].load(memory_order_relaxed);
+            if (seen >= rank) return min(highestOf(b), maxValue());
+        }
+        return maxValue();
+    }
+};
+
+// Public Profile operations with their own latency histogram
+enum ProfileOp {
+    OP_CREATE_PROFILE, OP_EDIT_PROFILE, OP_FIND_USER, OP_ALL_USERS, OP_FRIEND_GRAPH, OP_ANALYZE_GRAPH,
+    OP_SEND_REQUEST, OP_SEND_REQUESTS, OP_REQUEST_GROUP, OP_ACCEPT_REQUEST, OP_REJECT_REQUEST, OP_DELETE_FRIEND,
+    OP_ARE_FRIENDS, OP_FRIENDS_OF, OP_PENDING_OF, OP_MUTUAL_FRIENDS, OP_COUNT_MUTUALS, OP_CONNECTION_PATH,
+    OP_SUGGEST_FRIENDS, OP_FIND_BY_ATTRIBUTE, OP_SEND_MESSAGE, OP_SEND_GROUP_MESSAGE, OP_READ_MESSAGES,
+    OP_SEARCH_MESSAGES, OP_SEARCH_NAMES,
+    OP_CREATE_GROUP, OP_JOIN_GROUP, OP_LEAVE_GROUP, OP_GROUP_MEMBERS, OP_GROUPS_OF, OP_MEMORY_USAGE,
+    OP_SAVE_SNAPSHOT, OP_LOAD_SNAPSHOT, OP_OPEN_STORE, OP_COMPACT_STORE, OP_COMMIT_LOG,
+    OP_COUNT
+};
+
+static const char* const PROFILE_OP_NAMES[OP_COUNT] = {
+    "createProfile", "editProfileField", "findUser", "allUsers", "friendGraph", "analyzeGraph",
+    "sendFriendRequest", "sendFriendRequests", "sendFriendRequestToGroup", "acceptFriendRequest",
+    "rejectFriendRequest", "deleteFriend", "areFriends", "friendsOf", "pendingRequestsOf", "mutualFriends",
+    "countMutualFriends", "connectionPath", "suggestFriends", "findUsersByAttribute", "sendMessage",
+    "sendGroupMessage", "readMessages", "searchMessages", "searchUsersByName", "createGroup", "joinGroup", "leaveGroup", "groupMembers", "groupsOf",
+    "memoryUsage", "saveSnapshot", "loadSnapshot", "openStore", "compactStore", "commitLog"
+};
+
+// Sizes of the structures the hot paths walk, recorded on every call
+// (internal ones too): a deep index, a celebrity's friend list or a giant
+// group shows up here before it shows up as latency.
+enum ProfileShape { SHAPE_LOOKUP_STEPS, SHAPE_FRIEND_LIST, SHAPE_GROUP_SIZE, SHAPE_COUNT };
+
+static const char* const PROFILE_SHAPE_NAMES[SHAPE_COUNT] = {
+    "lookup_steps", "friend_list_length", "group_post_recipients"
+};
+
+struct ProfileMetrics {
+    Histogram operations[OP_COUNT]; // nanoseconds per outermost call
+    Histogram shapes[SHAPE_COUNT];
+    atomic<int64_t> queuedMessages; // pushed to inbox queues, not drained yet
+
+    ProfileMetrics() : queuedMessages(0) {}
+};
+
+// Times a public operation. Operations call each other (sendMessage looks
+// up both users), so only the outermost one on each thread is recorded.
+class OperationScope {
+    Histogram* target;
+    uint64_t start;
+    bool shared;
+
+    static unsigned& depth() {
+        static thread_local unsigned nesting = 0;
+        return nesting;
+    }
+
+public:
+    OperationScope(ProfileMetrics* metrics, ProfileOp op, bool concurrent) : target(NULL), start(0), shared(concurrent) {
+        if (depth()++ == 0) {
+            target = &metrics->operations[op];
+            start = nowNanos();
+        }
+    }
+    ~OperationScope() {
+        depth()--;
+        if (target) target->record(nowNanos() - start, shared);
+    }
+};
+
+// Instrumentation compiles out with -DPROFILE_METRICS=0
+#if PROFILE_METRICS
+#define PROFILE_OP(op) OperationScope operationScope(metrics, op, concurrent)
+#define PROFILE_SHAPE(shape, value) metrics->shapes[shape].record(value, concurrent)
+#else
+#define PROFILE_OP(op) ((void)0)
+#define PROFILE_SHAPE(shape, value) ((void)0)
+#endif
+
+// Current sizes of the network, computed on demand
+struct MetricGauges {
+    uint64_t users, friendships, pendingRequests;
+    uint64_t groups, groupMemberships;
+    uint64_t storedMessages; // inbox and group logs
+    int64_t queuedMessages;  // waiting in inbox queues (ConcurrentProfile)
+    uint64_t searchTerms;    // distinct words in the message search dictionary
+    uint64_t nameTrieNodes;  // nodes of the user name index
+};
+
+static void writeLatencyRow(ostream& out, const char* name, const Histogram& h, double scale) {
+    out << left << setw(26) << name << right << setw(10) << h.count() << setw(11) << h.mean() / scale
+        << setw(11) << h.percentile(0.50) / scale << setw(11) << h.percentile(0.99) / scale << setw(11)
+        << h.percentile(0.999) / scale << setw(12) << h.maxValue() / scale << "\n";
+}
+
+// Plain-text dump: every operation called so far, the shape histograms and the gauges.
+// metrics is NULL when instrumentation is compiled out.
+static void writeMetricsText(ostream& out, const ProfileMetrics* metrics, const MetricGauges& g) {
+    out << fixed << setprecision(2);
+    if (metrics) {
+        out << left << setw(26) << "operation (us)" << right << setw(10) << "calls" << setw(11) << "mean"
+            << setw(11) << "p50" << setw(11) << "p99" << setw(11) << "p99.9" << setw(12) << "max" << "\n";
+        for (int op = 0; op < OP_COUNT; op++)
+            if (metrics->operations[op].count()) writeLatencyRow(out, PROFILE_OP_NAMES[op], metrics->operations[op], 1e3);
+        out << left << setw(26) << "shape" << right << setw(10) << "samples" << setw(11) << "mean" << setw(11)
+            << "p50" << setw(11) << "p99" << setw(11) << "p99.9" << setw(12) << "max" << "\n";
+        for (int s = 0; s < SHAPE_COUNT; s++)
+            if (metrics->shapes[s].count()) writeLatencyRow(out, PROFILE_SHAPE_NAMES[s], metrics->shapes[s], 1);
+    } else {
+        out << "Operation metrics are compiled out (PROFILE_METRICS=0).\n";
+    }
+    out << "users " << g.users << ", friendships " << g.friendships << ", pending requests " << g.pendingRequests
+        << ", groups " << g.groups << ", memberships " << g.groupMemberships << ", stored messages "
+        << g.storedMessages << ", queued messages " << g.queuedMessages << ", search terms " << g.searchTerms
+        << ", name trie nodes " << g.nameTrieNodes << "\n";
+    out.unsetf(ios::floatfield);
+}
+
+static void writeHistogramJson(ostream& out, const Histogram& h) {
+    out << "{\"count\":" << h.count() << ",\"mean\":" << h.mean() << ",\"p50\":" << h.percentile(0.50)
+        << ",\"p90\":" << h.percentile(0.90) << ",\"p99\":" << h.percentile(0.99) << ",\"p999\":"
+        << h.percentile(0.999) << ",\"max\":" << h.maxValue() << "}";
+}
+
+// One JSON object; latencies are in nanoseconds
+static void writeMetricsJson(ostream& out, const ProfileMetrics* metrics, const MetricGauges& g) {
+    out << fixed << setprecision(1);
+    out << "{\"gauges\":{\"users\":" << g.users << ",\"friendships\":" << g.friendships
+        << ",\"pending_requests\":" << g.pendingRequests << ",\"groups\":" << g.groups
+        << ",\"group_memberships\":" << g.groupMemberships << ",\"stored_messages\":" << g.storedMessages
+        << ",\"queued_messages\":" << g.queuedMessages << ",\"search_terms\":" << g.searchTerms
+        << ",\"name_trie_nodes\":" << g.nameTrieNodes << "}";
+    if (metrics) {
+        out << ",\"operations_ns\":{";
+        bool first = true;
+        for (int op = 0; op < OP_COUNT; op++) {
+            if (!metrics->operations[op].count()) continue;
+            out << (first ? "" : ",") << "\"" << PROFILE_OP_NAMES[op] << "\":";
+            writeHistogramJson(out, metrics->operations[op]);
+            first = false;
+        }
+        out << "},\"shapes\":{";
+        for (int s = 0; s < SHAPE_COUNT; s++) {
+            out << (s ? "," : "") << "\"" << PROFILE_SHAPE_NAMES[s] << "\":";
+            writeHistogramJson(out, metrics->shapes[s]);
+        }
+        out << "}";
+    }
+    out << "}\n";
+    out.unsetf(ios::floatfield);
+}
+
+class Profile {
+    UserIndex* users; // user lookup by id
+    UserIndexKind indexKind;
+    vector<UserNode*> byIndex; // users by dense index
+    GroupRegistry groups; // groups by name
+
+    SlabPool<FriendNode> friendNodes; // friends and pending requests
+    MessageChunkPool messageChunks; // inbox and group log storage
+    SlabPool<GroupMemberNode> memberNodes;
+    InboxItemPool inboxItems; // queued private messages (concurrent mode)
+    atomic<uint64_t> messageClock; // stamps messages as they enter an inbox or group log
+    MessageSearchIndex messageSearch; // words of inbox and group messages
+    NameIndex names; // words of user names
+
+    MutualFriendsEngine mutuals;
+    ConnectionSearch connections;
+
+    // Incremental mode (setIncrementalSuggestions): materialized mutual
+    // counts plus each user's last suggestion list, dropped when a
+    // friendship or request near the user changes. Attribute edits bump a
+    // version per value instead of touching everyone who shares it.
+    struct CachedSuggestions {
+        vector<Suggestion> top;
+        size_t limit;                      // asked for when computed; fewer entries means no more candidates
+        uint32_t handles[ATTR_COUNT];      // the user's values then
+        uint32_t versions[ATTR_COUNT];     // and their versions
+        bool valid;
+        CachedSuggestions() : limit(0), valid(false) {}
+    };
+    bool incremental;
+    bool incrementalFresh; // false after bulk loads and concurrent use, rebuilt on the next read
+    CommonFriendCounts commonCounts;
+    vector<CachedSuggestions> suggestionCache;
+    vector<uint32_t> attributeVersions[ATTR_COUNT]; // by value handle
+    vector<uint32_t> affectedUsers;
+    vector<uint32_t> connectionScratch;
+    UserRecordStore records; // city/interest/institution by user index
+    AttributeIndex attributes;
+
+    FriendGraphSnapshot graphSnapshot;
+    vector<uint32_t> changedRows; // scratch for snapshot refreshes
+
+    // Per-user scratch for recommendations and batch dedup, reset by bumping the epoch instead of clearing
+    vector<uint32_t> candidateEpoch;
+    vector<int> candidateMutuals;
+    vector<int> candidateAttributes;
+    uint32_t epoch;
+
+    // Durable store: <prefix>.snap plus <prefix>.wal with every mutation since
+    WriteAheadLog* wal;
+    string storePrefix;
+    uint64_t logSequence; // last log record applied
+    // Replay only: logged WAL_QUEUED_MESSAGEs not drained yet, by record sequence
+    struct QueuedMessage {
+        UserNode* receiver;
+        InboxItem* item;
+    };
+    map<uint64_t, QueuedMessage> replayQueue;
+
+    // Guards the state every user shares (node pools, the mutual-friends
+    // engine's changed rows) while ConcurrentProfile drives the engine from
+    // several threads. Held only around those touches, never while taking
+    // another lock.
+    mutex stateMutex;
+    bool concurrent;
+
+#if PROFILE_METRICS
+    ProfileMetrics* metrics;
+#endif
+    class StateLock {
+        Profile& owner;
+    public:
+        StateLock(Profile& p) : owner(p) { if (owner.concurrent) owner.stateMutex.lock(); }
+        ~StateLock() { if (owner.concurrent) owner.stateMutex.unlock(); }
+    };
+
+public:
+    Profile(UserIndexKind kind = INDEX_AVL)
+        : indexKind(kind), messageClock(0), incremental(false), incrementalFresh(false), epoch(0), wal(NULL),
+          logSequence(0), concurrent(false) {
+        users = newUserIndex();
+#if PROFILE_METRICS
+        metrics = new ProfileMetrics;
+#endif
+    }
+    ~Profile() { // deleting the log commits it
+        delete wal;
+        clearUsers();
+        clearGroups();
+        delete users;
+#if PROFILE_METRICS
+        delete metrics;
+#endif
+    }
+
+    // The engine API: operations report a Status and hand back users, ranges
+    // and pages; nothing here reads stdin or writes to cout (see ProfileConsole).
+
+    Status createProfile(const string& name, const string& id, const string values[ATTR_COUNT]) {
+        PROFILE_OP(OP_CREATE_PROFILE);
+        if (logFailed()) return STATUS_IO_ERROR;
+        if (name.empty() || id.empty()) return STATUS_EMPTY_FIELD;
+        return createUser(name, id, values) ? STATUS_OK : STATUS_DUPLICATE_ID;
+    }
+
+    Status editProfileField(const string& userId, ProfileField field, const string& value) {
+        PROFILE_OP(OP_EDIT_PROFILE);
+        if (logFailed()) return STATUS_IO_ERROR;
+        UserNode* user = findUser(userId);
+        if (!user) return STATUS_UNKNOWN_USER;
+        if (value.empty()) return STATUS_EMPTY_FIELD;
+        switch (field) {
+            case FIELD_NAME: renameUser(user, value); break;
+            case FIELD_CITY: updateAttribute(user, ATTR_CITY, value); break;
+            case FIELD_INTEREST: updateAttribute(user, ATTR_INTEREST, value); break;
+            case FIELD_INSTITUTION: updateAttribute(user, ATTR_INSTITUTION, value); break;
+            default: return STATUS_INVALID_FIELD;
+        }
+        return STATUS_OK;
+    }
+
+    UserNode* findUser(const string& id) {
+        PROFILE_OP(OP_FIND_USER);
+#if PROFILE_METRICS
+        unsigned steps = 0;
+        UserNode* user = users->find(id, steps);
+        PROFILE_SHAPE(SHAPE_LOOKUP_STEPS, steps);
+        return user;
+#else
+        return users->find(id);
+#endif
+    }
+
+    UserNode* userAt(uint32_t index) {
+        return index < byIndex.size() ? byIndex[index] : NULL;
+    }
+
+    size_t userCount() const { return byIndex.size(); }
+    size_t groupCount() const { return groups.size(); }
+
+    const string& attribute(const UserNode* user, UserAttribute attr) const {
+        return records.get(user->index, attr);
+    }
+
+    // All users, ordered by ID
+    void allUsers(vector<UserNode*>& out) {
+        PROFILE_OP(OP_ALL_USERS);
+        out.clear();
+        users->inOrder(out);
+    }
+
+    // CSR view of the friend graph for analytics, brought up to date on demand
+    const FriendGraphSnapshot& friendGraph() {
+        PROFILE_OP(OP_FRIEND_GRAPH);
+        if (!mutuals.takeChanges(changedRows)) graphSnapshot.build(mutuals);
+        else if (!changedRows.empty() || graphSnapshot.userCount() != mutuals.userCount())
+            graphSnapshot.refresh(mutuals, changedRows);
+        return graphSnapshot;
+    }
+
+    // Components, degree distribution, triangles and k-cores of the whole
+    // friend graph, computed on pool's threads
+    void analyzeGraph(WorkStealingPool& pool, GraphReport& report) {
+        PROFILE_OP(OP_ANALYZE_GRAPH);
+        GraphAnalytics analytics(friendGraph(), pool);
+        analytics.run(report);
+    }
+
+    Status sendFriendRequest(const string& senderId, const string& receiverId, ResolvedUsers* resolved = NULL) {
+        PROFILE_OP(OP_SEND_REQUEST);
+        if (logFailed()) return STATUS_IO_ERROR;
+        if (senderId == receiverId) return STATUS_SELF;
+        UserNode* sender = findUser(senderId);
+        UserNode* receiver = findUser(receiverId);
+        setResolved(resolved, sender, receiver);
+        if (!sender || !receiver) return STATUS_UNKNOWN_USER;
+        if (areFriends(sender, receiver)) return STATUS_ALREADY_FRIENDS;
+        if (hasPendingRequest(receiver, sender) || hasPendingRequest(sender, receiver)) return STATUS_REQUEST_PENDING;
+        addPendingRequest(sender, receiver);
+        return STATUS_OK;
+    }
+
+    // Bulk friend request: every target is resolved once, checked against
+    // the existing friend/pending sets and deduplicated in a single pass.
+    Status sendFriendRequests(const string& senderId, const vector<string>& receiverIds, FriendRequestBatchResult& result) {
+        PROFILE_OP(OP_SEND_REQUESTS);
+        FriendRequestBatchResult none = { 0, 0, 0, 0, 0, 0 };
+        result = none;
+        if (logFailed()) return STATUS_IO_ERROR;
+        UserNode* sender = findUser(senderId);
+        if (!sender) {
+            result.unknown = (int)receiverIds.size();
+            return STATUS_UNKNOWN_USER;
+        }
+        vector<UserNode*> targets;
+        targets.reserve(receiverIds.size());
+        for (size_t i = 0; i < receiverIds.size(); i++) {
+            UserNode* u = findUser(receiverIds[i]);
+            if (u) targets.push_back(u);
+            else result.unknown++;
+        }
+        sendFriendRequestsTo(sender, targets, result);
+        return STATUS_OK;
+    }
+
+    Status sendFriendRequestToGroup(const string& userId, const string& groupName, FriendRequestBatchResult& result) {
+        PROFILE_OP(OP_REQUEST_GROUP);
+        FriendRequestBatchResult none = { 0, 0, 0, 0, 0, 0 };
+        result = none;
+        if (logFailed()) return STATUS_IO_ERROR;
+        UserNode* user = findUser(userId);
+        if (!user) return STATUS_UNKNOWN_USER;
+        GroupNode* group = findGroup(groupName);
+        if (!group) return STATUS_UNKNOWN_GROUP;
+        // Members are already resolved, so no per-member findUser
+        vector<UserNode*> targets;
+        targets.reserve(group->members.size());
+        for (GroupMemberNode* m = group->members.first(); m; m = m->next)
+            if (m->user != user) targets.push_back(m->user);
+        sendFriendRequestsTo(user, targets, result);
+        return STATUS_OK;
+    }
+
+    Status acceptFriendRequest(const string& userId, const string& senderId, ResolvedUsers* resolved = NULL) {
+        PROFILE_OP(OP_ACCEPT_REQUEST);
+        if (logFailed()) return STATUS_IO_ERROR;
+        UserNode* user = findUser(userId);
+        UserNode* sender = findUser(senderId);
+        setResolved(resolved, user, sender);
+        if (!user || !sender) return STATUS_UNKNOWN_USER;
+        return acceptRequest(user, sender) ? STATUS_OK : STATUS_NO_REQUEST;
+    }
+
+    Status rejectFriendRequest(const string& userId, const string& senderId, ResolvedUsers* resolved = NULL) {
+        PROFILE_OP(OP_REJECT_REQUEST);
+        if (logFailed()) return STATUS_IO_ERROR;
+        UserNode* user = findUser(userId);
+        UserNode* sender = findUser(senderId);
+        setResolved(resolved, user, sender);
+        if (!user || !sender) return STATUS_UNKNOWN_USER;
+        return rejectRequest(user, sender) ? STATUS_OK : STATUS_NO_REQUEST;
+    }
+
+    Status deleteFriend(const string& userId, const string& friendId, ResolvedUsers* resolved = NULL) {
+        PROFILE_OP(OP_DELETE_FRIEND);
+        if (logFailed()) return STATUS_IO_ERROR;
+        if (userId == friendId) return STATUS_SELF;
+        UserNode* user = findUser(userId);
+        UserNode* friendUser = findUser(friendId);
+        setResolved(resolved, user, friendUser);
+        if (!user || !friendUser) return STATUS_UNKNOWN_USER;
+        if (!areFriends(user, friendUser)) return STATUS_NOT_FRIENDS;
+        unfriend(user, friendUser);
+        return STATUS_OK;
+    }
+
+    void addFriend(UserNode* user, UserNode* friendUser) {
+        if (areFriends(user, friendUser)) return;
+        user->friends.add(newFriendNode(friendUser));
+        StateLock lock(*this); // the engine's list of changed rows is shared
+        mutuals.addEdge(user->index, friendUser->index);
+    }
+
+    bool areFriends(UserNode* a, UserNode* b) {
+        PROFILE_OP(OP_ARE_FRIENDS);
+        PROFILE_SHAPE(SHAPE_FRIEND_LIST, a->friends.size());
+        return a->friends.contains(b);
+    }
+
+    bool hasPendingRequest(UserNode* receiver, UserNode* sender) {
+        return receiver->pendingRequests.contains(sender);
+    }
+
+    // Newest friends first
+    Status friendsOf(const string& userId, FriendRange& out, ResolvedUsers* resolved = NULL) {
+        PROFILE_OP(OP_FRIENDS_OF);
+        UserNode* user = findUser(userId);
+        setResolved(resolved, user, NULL);
+        if (!user) return STATUS_UNKNOWN_USER;
+        out = FriendRange(user->friends.first());
+        return STATUS_OK;
+    }
+
+    // Senders of the user's pending requests, newest first
+    Status pendingRequestsOf(const string& userId, FriendRange& out, ResolvedUsers* resolved = NULL) {
+        PROFILE_OP(OP_PENDING_OF);
+        UserNode* user = findUser(userId);
+        setResolved(resolved, user, NULL);
+        if (!user) return STATUS_UNKNOWN_USER;
+        out = FriendRange(user->pendingRequests.first());
+        return STATUS_OK;
+    }
+
+    Status mutualFriends(const string& user1Id, const string& user2Id, vector<UserNode*>& out, ResolvedUsers* resolved = NULL) {
+        PROFILE_OP(OP_MUTUAL_FRIENDS);
+        out.clear();
+        UserNode* u1 = findUser(user1Id);
+        UserNode* u2 = findUser(user2Id);
+        setResolved(resolved, u1, u2);
+        if (!u1 || !u2) return STATUS_UNKNOWN_USER;
+        vector<uint32_t> common;
+        mutuals.list(u1->index, u2->index, common);
+        out.reserve(common.size());
+        for (size_t i = 0; i < common.size(); i++) out.push_back(byIndex[common[i]]);
+        return STATUS_OK;
+    }
+
+    // Number of mutual friends, or -1 if either ID is unknown
+    int countMutualFriends(const string& user1Id, const string& user2Id) {
+        PROFILE_OP(OP_COUNT_MUTUALS);
+        UserNode* u1 = findUser(user1Id);
+        UserNode* u2 = findUser(user2Id);
+        if (!u1 || !u2) return -1;
+        if (u1 != u2 && incrementalReady()) return (int)commonCounts.get(u1->index, u2->index);
+        return (int)mutuals.count(u1->index, u2->index);
+    }
+
+    // Shortest chain of friends from one user to another, both included,
+    // if they are at most maxHops friendships apart
+    Status connectionPath(const string& fromId, const string& toId, size_t maxHops, vector<UserNode*>& out, ResolvedUsers* resolved = NULL) {
+        PROFILE_OP(OP_CONNECTION_PATH);
+        out.clear();
+        UserNode* from = findUser(fromId);
+        UserNode* to = findUser(toId);
+        setResolved(resolved, from, to);
+        if (!from || !to) return STATUS_UNKNOWN_USER;
+        if (from == to) return STATUS_SELF;
+        uint32_t limit = (uint32_t)min<size_t>(maxHops, byIndex.size());
+        if (!connections.find(mutuals, (uint32_t)byIndex.size(), from->index, to->index, limit, connectionScratch))
+            return STATUS_NO_PATH;
+        for (size_t i = 0; i < connectionScratch.size(); i++) out.push_back(byIndex[connectionScratch[i]]);
+        return STATUS_OK;
+    }
+
+    Status suggestFriends(const string& userId, size_t limit, vector<Suggestion>& out, ResolvedUsers* resolved = NULL) {
+        PROFILE_OP(OP_SUGGEST_FRIENDS);
+        out.clear();
+        UserNode* user = findUser(userId);
+        setResolved(resolved, user, NULL);
+        if (!user) return STATUS_UNKNOWN_USER;
+        if (incrementalReady()) cachedSuggestions(user, limit, out);
+        else recommendFriends(user, limit, out);
+        return STATUS_OK;
+    }
+
+    // Top-k friend-of-friend and shared-attribute candidates, best first.
+    // Work is bounded by the caps below, not by the number of users.
+    void recommendFriends(UserNode* user, size_t k, vector<Suggestion>& out) {
+        static const size_t MAX_FRIENDS_EXPANDED = 512;
+        static const size_t MAX_FANOUT_PER_FRIEND = 512;
+
+        out.clear();
+        if (k == 0) return;
+        beginEpoch();
+        vector<uint32_t> touched;
+
+        // 2-hop expansion over the friend arrays
+        const vector<uint32_t>& direct = mutuals.friendsOf(user->index);
+        for (size_t i = 0; i < direct.size() && i < MAX_FRIENDS_EXPANDED; i++) {
+            const vector<uint32_t>& hop = mutuals.friendsOf(direct[i]);
+            for (size_t j = 0; j < hop.size() && j < MAX_FANOUT_PER_FRIEND; j++) {
+                uint32_t c = hop[j];
+                if (candidateEpoch[c] != epoch) {
+                    candidateEpoch[c] = epoch;
+                    candidateMutuals[c] = candidateAttributes[c] = 0;
+                    touched.push_back(c);
+                }
+                candidateMutuals[c]++;
+            }
+        }
+        addAttributeCandidates(user, touched);
+        selectSuggestions(user, k, touched, out);
+    }
+
+    // Users whose names match the query, best first. The query's words
+    // must be consecutive words of the name, in order, the last one only
+    // its beginning ("kari mor" finds "Kari Morasa" and "Ali Kari Moreno");
+    // if fewer than limit users match that way, names with one word a typo
+    // or two off (NameIndex::editBudget) fill in after them, fewer edits
+    // first. With a searcher, friends rank first, then users with more
+    // mutual friends; the searcher is left out. A broad prefix is ranked
+    // over its first MAX_NAME_CANDIDATES matches and the searcher's friends.
+    Status searchUsersByName(const string& searcherId, const string& query, size_t limit, vector<NameMatch>& out) {
+        PROFILE_OP(OP_SEARCH_NAMES);
+        out.clear();
+        UserNode* searcher = NULL;
+        if (!searcherId.empty() && !(searcher = findUser(searcherId))) return STATUS_UNKNOWN_USER;
+        vector<string> words;
+        NameIndex::tokenize(query, words);
+        if (words.empty()) return STATUS_EMPTY_FIELD;
+        beginEpoch(); // stamps users already matched
+        vector<uint32_t> candidates;
+        if (searcher) {
+            const vector<uint32_t>& direct = mutuals.friendsOf(searcher->index);
+            candidates.assign(direct.begin(), direct.begin() + min(direct.size(), MAX_NAME_FRIENDS));
+            addNameMatches(searcher, words, candidates, true, true, out);
+        }
+        names.prefixCandidates(words, MAX_NAME_CANDIDATES, candidates);
+        addNameMatches(searcher, words, candidates, false, false, out); // the trie matched these exactly
+        for (int edits = 1; edits <= NameIndex::MAX_EDITS; edits++) {
+            size_t closer = 0;
+            for (size_t i = 0; i < out.size(); i++) closer += out[i].edits < edits;
+            if (closer >= limit) break; // anything further off would rank below them
+            names.fuzzyCandidates(words, edits, MAX_NAME_CANDIDATES, candidates);
+            addNameMatches(searcher, words, candidates, true, true, out);
+        }
+        size_t shown = min(limit, out.size());
+        partial_sort(out.begin(), out.begin() + shown, out.end(), betterNameMatch);
+        out.resize(shown);
+        return STATUS_OK;
+    }
+
+    Status findUsersByAttribute(const vector<AttributeTerm>& terms, bool matchAll, vector<UserNode*>& out) {
+        PROFILE_OP(OP_FIND_BY_ATTRIBUTE);
+        out.clear();
+        if (terms.empty()) return STATUS_EMPTY_FIELD;
+        vector<uint32_t> matches;
+        attributes.query(terms, records.values(), matchAll, matches);
+        out.reserve(matches.size());
+        for (size_t i = 0; i < matches.size(); i++) out.push_back(byIndex[matches[i]]);
+        return STATUS_OK;
+    }
+
+    Status sendMessage(const string& senderId, const string& receiverId, const string& message, ResolvedUsers* resolved = NULL) {
+        PROFILE_OP(OP_SEND_MESSAGE);
+        if (logFailed()) return STATUS_IO_ERROR;
+        UserNode* sender = findUser(senderId);
+        UserNode* receiver = findUser(receiverId);
+        setResolved(resolved, sender, receiver);
+        if (!sender || !receiver) return STATUS_UNKNOWN_USER;
+        if (!areFriends(sender, receiver)) return STATUS_NOT_FRIENDS;
+        deliverMessage(sender, receiver, message);
+        return STATUS_OK;
+    }
+
+    // recipients, if given, receives the number of other members reached
+    Status sendGroupMessage(const string& senderId, const string& groupName, const string& message, size_t* recipients = NULL) {
+        PROFILE_OP(OP_SEND_GROUP_MESSAGE);
+        if (logFailed()) return STATUS_IO_ERROR;
+        UserNode* sender = findUser(senderId);
+        if (!sender) return STATUS_UNKNOWN_USER;
+        GroupNode* group = findGroup(groupName);
+        if (!group) return STATUS_UNKNOWN_GROUP;
+        GroupMemberNode* membership = group->members.find(sender);
+        if (!membership) return STATUS_NOT_MEMBER;
+        postToGroup(membership, message);
+        PROFILE_SHAPE(SHAPE_GROUP_SIZE, group->members.size() - 1);
+        if (recipients) *recipients = group->members.size() - 1;
+        return STATUS_OK;
+    }
+
+    // Latest messages first, capped at limit; everything up to the newest is marked read
+    Status readMessages(const string& userId, size_t limit, MessagePage& page, ResolvedUsers* resolved = NULL) {
+        PROFILE_OP(OP_READ_MESSAGES);
+        if (logFailed()) return STATUS_IO_ERROR;
+        UserNode* user = findUser(userId);
+        setResolved(resolved, user, NULL);
+        if (!user) return STATUS_UNKNOWN_USER;
+        drainInbox(user);
+        page.unread = unreadCount(user);
+        page.total = totalMessages(user);
+        collectMessages(user, 0, limit, true, page.messages);
+        if (!page.messages.empty()) markRead(user, page.messages[0].msg->seq);
+        return STATUS_OK;
+    }
+
+    // Oldest-first page of messages with seq > afterSeq; marks the page read
+    Status readMessages(const string& userId, uint64_t afterSeq, size_t limit, MessagePage& page, ResolvedUsers* resolved = NULL) {
+        PROFILE_OP(OP_READ_MESSAGES);
+        if (logFailed()) return STATUS_IO_ERROR;
+        UserNode* user = findUser(userId);
+        setResolved(resolved, user, NULL);
+        if (!user) return STATUS_UNKNOWN_USER;
+        drainInbox(user);
+        page.unread = unreadCount(user);
+        page.total = totalMessages(user);
+        collectMessages(user, afterSeq, limit, false, page.messages);
+        if (!page.messages.empty()) markRead(user, page.messages.back().msg->seq);
+        return STATUS_OK;
+    }
+
+    // Messages the user can read that contain every word of the query
+    // (case-insensitive; "word*" matches any word starting with it), newest
+    // first, capped at limit. page.total and page.unread count all matches.
+    // Nothing is marked read.
+    Status searchMessages(const string& userId, const string& query, size_t limit, MessagePage& page, ResolvedUsers* resolved = NULL) {
+        PROFILE_OP(OP_SEARCH_MESSAGES);
+        page.messages.clear();
+        page.unread = page.total = 0;
+        UserNode* user = findUser(userId);
+        setResolved(resolved, user, NULL);
+        if (!user) return STATUS_UNKNOWN_USER;
+        // Index first: words of the unindexed messages may be new to the dictionary
+        drainInbox(user);
+        messageSearch.catchUp(user->inbox);
+        for (GroupMemberNode* m = user->groups; m; m = m->nextOfUser) messageSearch.catchUp(m->group->log);
+        vector<SearchTerm> terms;
+        if (!messageSearch.parse(query, terms)) return STATUS_EMPTY_FIELD;
+        vector<uint32_t> hits;
+        messageSearch.match(user->inbox, terms, hits);
+        for (size_t i = 0; i < hits.size(); i++) addSearchHit(user, user->inbox.at(hits[i]), NULL, page);
+        for (GroupMemberNode* m = user->groups; m; m = m->nextOfUser) {
+            const MessageLog& log = m->group->log;
+            messageSearch.match(log, terms, hits);
+            vector<uint32_t>::const_iterator it = lower_bound(hits.begin(), hits.end(), (uint32_t)m->joinedAt);
+            for (; it != hits.end(); ++it)
+                if (log.at(*it).sender != user) addSearchHit(user, log.at(*it), m->group, page);
+        }
+        page.total = page.messages.size();
+        size_t shown = min(limit, page.messages.size());
+        partial_sort(page.messages.begin(), page.messages.begin() + shown, page.messages.end(), newerMessage);
+        page.messages.resize(shown);
+        return STATUS_OK;
+    }
+
+    Status createGroup(const string& groupName) {
+        PROFILE_OP(OP_CREATE_GROUP);
+        if (logFailed()) return STATUS_IO_ERROR;
+        if (findGroup(groupName)) return STATUS_GROUP_EXISTS;
+        addGroup(groupName);
+        return STATUS_OK;
+    }
+
+    Status joinGroup(const string& userId, const string& groupName, ResolvedUsers* resolved = NULL) {
+        PROFILE_OP(OP_JOIN_GROUP);
+        if (logFailed()) return STATUS_IO_ERROR;
+        UserNode* user = findUser(userId);
+        setResolved(resolved, user, NULL);
+        if (!user) return STATUS_UNKNOWN_USER;
+        GroupNode* group = findGroup(groupName);
+        if (!group) return STATUS_UNKNOWN_GROUP;
+        if (isGroupMember(group, user)) return STATUS_ALREADY_MEMBER;
+        enterGroup(user, group);
+        return STATUS_OK;
+    }
+
+    Status leaveGroup(const string& userId, const string& groupName, ResolvedUsers* resolved = NULL) {
+        PROFILE_OP(OP_LEAVE_GROUP);
+        if (logFailed()) return STATUS_IO_ERROR;
+        UserNode* user = findUser(userId);
+        setResolved(resolved, user, NULL);
+        if (!user) return STATUS_UNKNOWN_USER;
+        GroupNode* group = findGroup(groupName);
+        if (!group) return STATUS_UNKNOWN_GROUP;
+        return exitGroup(user, group) ? STATUS_OK : STATUS_NOT_MEMBER;
+    }
+
+    // Newest members first
+    Status groupMembers(const string& groupName, MemberRange& out) {
+        PROFILE_OP(OP_GROUP_MEMBERS);
+        GroupNode* group = findGroup(groupName);
+        if (!group) return STATUS_UNKNOWN_GROUP;
+        out = MemberRange(group->members.first());
+        return STATUS_OK;
+    }
+
+    Status groupsOf(const string& userId, GroupRange& out, ResolvedUsers* resolved = NULL) {
+        PROFILE_OP(OP_GROUPS_OF);
+        UserNode* user = findUser(userId);
+        setResolved(resolved, user, NULL);
+        if (!user) return STATUS_UNKNOWN_USER;
+        out = GroupRange(user->groups);
+        return STATUS_OK;
+    }
+
+    void memoryUsage(MemoryUsage& out) {
+        PROFILE_OP(OP_MEMORY_USAGE);
+        size_t n = byIndex.size();
+        out.users = n;
+        out.distinctValues = records.values().size();
+        size_t nameIdBytes = 0, legacyAttrBytes = 0;
+        for (size_t i = 0; i < n; i++) {
+            nameIdBytes += 2 * sizeof(string) + UserRecordStore::heapBytes(byIndex[i]->name)
+                         + UserRecordStore::heapBytes(byIndex[i]->id);
+            for (int a = 0; a < ATTR_COUNT; a++)
+                legacyAttrBytes += sizeof(string) + UserRecordStore::heapBytes(records.get((uint32_t)i, (UserAttribute)a));
+        }
+        size_t compactAttrBytes = n * ATTR_COUNT * sizeof(uint32_t) + records.poolBytes();
+        double users = (double)max<size_t>(n, 1);
+        out.legacyAttributeBytes = legacyAttrBytes / users;
+        out.compactAttributeBytes = compactAttrBytes / users;
+        out.legacyProfileBytes = (nameIdBytes + legacyAttrBytes) / users;
+        out.compactProfileBytes = (nameIdBytes + compactAttrBytes) / users;
+    }
+
+    // Writes the whole network to a versioned binary snapshot
+    Status saveSnapshot(const string& path) {
+        PROFILE_OP(OP_SAVE_SNAPSHOT);
+        for (size_t u = 0; u < byIndex.size(); u++) drainInbox(byIndex[u]);
+        string tmpPath = path + ".tmp";
+        FILE* f = fopen(tmpPath.c_str(), "wb");
+        if (!f) return STATUS_IO_ERROR;
+        SnapshotWriter w(f);
+        vector<const string*> strings;
+        SnapshotHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+        h.version = SNAPSHOT_VERSION;
+        h.byteOrder = SNAPSHOT_BYTE_ORDER;
+        h.userCount = byIndex.size();
+        h.groupCount = groups.size();
+        h.messageClock = messageClock;
+        h.logSequence = wal ? wal->lastSequence() : logSequence;
+        w.put(h); // rewritten with the offsets at the end
+
+        // Attribute values first, so string index == pool handle
+        const StringPool& values = records.values();
+        for (uint32_t v = 0; v < values.size(); v++) strings.push_back(&values.str(v));
+
+        h.usersOffset = w.align();
+        for (size_t u = 0; u < byIndex.size(); u++) {
+            SnapshotUser rec;
+            memset(&rec, 0, sizeof(rec));
+            rec.name = stringRef(strings, byIndex[u]->name);
+            rec.id = stringRef(strings, byIndex[u]->id);
+            for (int a = 0; a < ATTR_COUNT; a++) rec.attributes[a] = records.handle((uint32_t)u, (UserAttribute)a);
+            rec.readSeq = byIndex[u]->readSeq;
+            w.put(rec);
+        }
+        h.friendsOffset = w.align();
+        writeAdjacency(w, false);
+        h.pendingOffset = w.align();
+        writeAdjacency(w, true);
+
+        h.inboxOffset = w.align();
+        uint64_t total = 0;
+        w.put(total);
+        for (size_t u = 0; u < byIndex.size(); u++) {
+            total += byIndex[u]->inbox.size();
+            w.put(total);
+        }
+        for (size_t u = 0; u < byIndex.size(); u++)
+            writeMessages(w, strings, byIndex[u]->inbox);
+
+        h.groupsOffset = w.align();
+        for (size_t g = 0; g < groups.size(); g++) {
+            SnapshotGroup rec;
+            rec.name = stringRef(strings, groups.at(g)->groupName);
+            rec.memberCount = (uint32_t)groups.at(g)->members.size();
+            rec.messageCount = groups.at(g)->log.size();
+            h.memberCount += rec.memberCount;
+            h.groupMessageCount += rec.messageCount;
+            w.put(rec);
+        }
+        for (size_t g = 0; g < groups.size(); g++) {
+            for (GroupMemberNode* m = groups.at(g)->members.first(); m; m = m->next) {
+                SnapshotMember rec = { m->user->index, 0, m->joinedAt };
+                w.put(rec);
+            }
+        }
+        for (size_t g = 0; g < groups.size(); g++)
+            writeMessages(w, strings, groups.at(g)->log);
+
+        h.stringsOffset = w.align();
+        h.stringCount = strings.size();
+        uint64_t end = 0;
+        w.put(end);
+        for (size_t i = 0; i < strings.size(); i++) {
+            end += strings[i]->size();
+            w.put(end);
+        }
+        for (size_t i = 0; i < strings.size(); i++) w.write(strings[i]->data(), strings[i]->size());
+        h.fileSize = w.align();
+
+        bool ok = w.ok() && fseek(f, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, f) == 1 && fflush(f) == 0;
+#ifdef HAVE_POSIX_IO
+        ok = ok && fsync(fileno(f)) == 0; // on disk before it replaces the old snapshot
+#endif
+        ok = (fclose(f) == 0) && ok;
+        if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+            remove(tmpPath.c_str());
+            return STATUS_IO_ERROR;
+        }
+        return STATUS_OK;
+    }
+
+    // Loads a snapshot into an empty network. The file is memory-mapped and
+    // records are linked by index; the id, name and attribute indexes are
+    // built in bulk rather than user by user. Ill-formed files, including
+    // message seqs out of order or past the stored clock, are rejected.
+    Status loadSnapshot(const string& path) {
+        PROFILE_OP(OP_LOAD_SNAPSHOT);
+        if (!byIndex.empty() || groups.size()) return STATUS_NOT_EMPTY;
+        MappedFile file;
+        if (!file.open(path)) return STATUS_IO_ERROR;
+        // Loaded state is not logged record by record; an open store is
+        // compacted afterwards instead
+        WriteAheadLog* log = wal;
+        wal = NULL;
+        bool loaded = loadSnapshotData(file);
+        wal = log;
+        if (!loaded) {
+            resetAll();
+            return STATUS_CORRUPT;
+        }
+        return wal ? compactStore() : STATUS_OK;
+    }
+
+    // Opens <prefix>.snap and <prefix>.wal: loads the snapshot, replays the
+    // log records written after it, then logs every further mutation.
+    Status openStore(const string& prefix, StoreInfo& info) {
+        PROFILE_OP(OP_OPEN_STORE);
+        info.replayed = info.discardedBytes = info.failedRecord = 0;
+        if (wal) return STATUS_STORE_OPEN;
+        if (!byIndex.empty() || groups.size()) return STATUS_NOT_EMPTY;
+        string snapPath = prefix + ".snap", walPath = prefix + ".wal";
+        FILE* probe = fopen(snapPath.c_str(), "rb");
+        if (probe) {
+            fclose(probe);
+            Status loaded = loadSnapshot(snapPath);
+            if (loaded != STATUS_OK) return loaded;
+        }
+
+        uint64_t validBytes = 0;
+        MappedFile log;
+        if (log.open(walPath)) {
+            WalScanner scanner(log);
+            if (!scanner.valid()) {
+                resetAll();
+                return STATUS_CORRUPT;
+            }
+            uint64_t seq;
+            uint8_t op;
+            const char* payload;
+            uint32_t length;
+            while (scanner.next(seq, op, payload, length)) {
+                if (seq <= logSequence) continue; // already in the snapshot
+                WalReader in(payload, length);
+                if (!applyLogRecord(seq, op, in)) {
+                    resetAll();
+                    info.failedRecord = seq;
+                    return STATUS_LOG_MISMATCH;
+                }
+                logSequence = seq;
+                info.replayed++;
+            }
+            validBytes = scanner.validBytes();
+            info.discardedBytes = log.size() - validBytes;
+        }
+        // Messages queued but not read before the crash go back on their
+        // queues, keeping their records for the drain that will name them
+        for (map<uint64_t, QueuedMessage>::iterator it = replayQueue.begin(); it != replayQueue.end(); ++it)
+            queueMessage(it->second.receiver, it->second.item);
+        replayQueue.clear();
+
+        wal = new WriteAheadLog;
+        if (!wal->open(walPath, validBytes, logSequence)) {
+            delete wal;
+            wal = NULL;
+            resetAll();
+            return STATUS_IO_ERROR;
+        }
+        storePrefix = prefix;
+        return STATUS_OK;
+    }
+
+    // Folds the log into a fresh snapshot and empties it
+    Status compactStore() {
+        PROFILE_OP(OP_COMPACT_STORE);
+        if (!wal) return STATUS_NO_STORE;
+        if (!wal->commit()) return STATUS_IO_ERROR;
+        Status saved = saveSnapshot(storePrefix + ".snap");
+        if (saved != STATUS_OK) return saved;
+        // A crash before the reset is harmless: replay skips records the snapshot already has
+        return wal->reset() ? STATUS_OK : STATUS_IO_ERROR;
+    }
+
+    // Makes logged mutations durable; called before waiting for more input
+    Status commitLog() {
+        PROFILE_OP(OP_COMMIT_LOG);
+        StateLock lock(*this);
+        return !wal || wal->commit() ? STATUS_OK : STATUS_IO_ERROR;
+    }
+    bool storeOpen() const { return wal != NULL; }
+    // A failed log write leaves the store failed: mutations are refused
+    // with STATUS_IO_ERROR from then on, as they could not be made durable
+    bool logFailed() const { return wal && !wal->ok(); }
+    const string& storeName() const { return storePrefix; }
+    uint64_t logSyncs() const { return wal ? wal->syncs() : 0; }
+
+    // Latency and shape histograms, or NULL when compiled out
+    const ProfileMetrics* operationMetrics() const {
+#if PROFILE_METRICS
+        return metrics;
+#else
+        return NULL;
+#endif
+    }
+    void metricGauges(MetricGauges& out) {
+        out.users = byIndex.size();
+        out.friendships = out.pendingRequests = out.storedMessages = 0;
+        for (size_t i = 0; i < byIndex.size(); i++) {
+            out.friendships += byIndex[i]->friends.size();
+            out.pendingRequests += byIndex[i]->pendingRequests.size();
+            out.storedMessages += byIndex[i]->inbox.size();
+        }
+        out.friendships /= 2;
+        out.groups = groups.size();
+        out.groupMemberships = 0;
+        for (size_t g = 0; g < groups.size(); g++) {
+            out.groupMemberships += groups.at(g)->members.size();
+            out.storedMessages += groups.at(g)->log.size();
+        }
+#if PROFILE_METRICS
+        out.queuedMessages = metrics->queuedMessages.load(memory_order_relaxed);
+#else
+        out.queuedMessages = 0;
+#endif
+        out.searchTerms = messageSearch.termCount();
+        out.nameTrieNodes = names.trieNodes();
+    }
+
+    // Set by ConcurrentProfile; the caller then owns all locking except the
+    // shared state above. Private messages go through the receivers' queues
+    // while it is on; they are all in the inboxes again once it is off.
+    void setConcurrent(bool on) {
+        concurrent = on;
+        incrementalFresh = false; // not maintained under concurrent use
+        if (!on)
+            for (size_t u = 0; u < byIndex.size(); u++) drainInbox(byIndex[u]);
+    }
+
+    // Incremental mode: mutual-friend counts are kept for every pair of
+    // users two hops apart, and suggestion lists are cached per user until
+    // something near them changes. Counts then read in O(1) and repeated
+    // suggestions in O(k), at the cost of memory for the pair counts and
+    // O(deg(u) + deg(v)) extra work per accept or unfriend. Suggestions
+    // use exact mutual counts rather than the capped 2-hop expansion.
+    void setIncrementalSuggestions(bool on) {
+        incremental = on;
+        incrementalFresh = false;
+        if (!on) {
+            commonCounts.clear();
+            vector<CachedSuggestions>().swap(suggestionCache);
+        }
+    }
+    bool incrementalSuggestions() const { return incremental; }
+    // Two-hop pairs with a materialized count and the bytes they take
+    size_t commonFriendPairs() const { return commonCounts.pairs(); }
+    size_t commonFriendBytes() const { return commonCounts.heapBytes(); }
+
+private:
+    UserIndex* newUserIndex() {
+        if (indexKind == INDEX_HASH) return new HashUserIndex;
+        return new AVLUserIndex;
+    }
+    // Adds a user with the given fields; NULL if the id is taken
+    UserNode* createUser(const string& name, const string& id, const string values[ATTR_COUNT]) {
+        UserNode* newUser = new UserNode;
+        newUser->name = name;
+        newUser->id = id;
+        newUser->left = newUser->right = NULL;
+        newUser->height = 1;
+        newUser->readSeq = 0;
+        newUser->groups = NULL;
+        newUser->index = (uint32_t)byIndex.size();
+        if (!users->insert(newUser)) {
+            delete newUser;
+            return NULL;
+        }
+        byIndex.push_back(newUser);
+        names.add(newUser->index, name);
+        mutuals.addUser();
+        records.addUser();
+        for (int a = 0; a < ATTR_COUNT; a++)
+            setAttribute(newUser, (UserAttribute)a, values[a]);
+        if (wal) {
+            WalRecord rec;
+            rec.str(name).str(id);
+            for (int a = 0; a < ATTR_COUNT; a++) rec.str(values[a]);
+            logRecord(WAL_CREATE_USER, rec);
+        }
+        return newUser;
+    }
+
+    // Mutations below are shared by the console and log replay, and each
+    // logs itself while a store is open. Checks are done by the callers.
+    // The log numbers records itself and has its own lock, so logging needs
+    // no state lock; conflicting mutations are already serialized by the
+    // caller and log in the order they were applied.
+    uint64_t logRecord(WalOp op, const WalRecord& rec) {
+        return wal->append((uint8_t)op, rec);
+    }
+    FriendNode* newFriendNode(UserNode* user) {
+        StateLock lock(*this);
+        FriendNode* f = friendNodes.create();
+        f->user = user;
+        return f;
+    }
+    void freeFriendNode(FriendNode* f) {
+        StateLock lock(*this);
+        friendNodes.destroy(f);
+    }
+    void renameUser(UserNode* user, const string& name) {
+        names.remove(user->index, user->name);
+        user->name = name;
+        names.add(user->index, name);
+        if (wal) logRecord(WAL_RENAME_USER, WalRecord().u32(user->index).str(name));
+    }
+    void updateAttribute(UserNode* user, UserAttribute attr, const string& value) {
+        setAttribute(user, attr, value);
+        if (wal) logRecord(WAL_SET_ATTRIBUTE, WalRecord().u32(user->index).u32(attr).str(value));
+    }
+    bool acceptRequest(UserNode* user, UserNode* sender) {
+        FriendNode* req = user->pendingRequests.remove(sender);
+        if (!req) return false;
+        freeFriendNode(req);
+        addFriend(user, sender);
+        addFriend(sender, user);
+        friendshipChanged(user, sender, true);
+        if (wal) logRecord(WAL_ACCEPT_REQUEST, WalRecord().u32(user->index).u32(sender->index));
+        return true;
+    }
+    bool rejectRequest(UserNode* user, UserNode* sender) {
+        FriendNode* req = user->pendingRequests.remove(sender);
+        if (!req) return false;
+        freeFriendNode(req);
+        requestsChanged(user, sender);
+        if (wal) logRecord(WAL_REJECT_REQUEST, WalRecord().u32(user->index).u32(sender->index));
+        return true;
+    }
+    void unfriend(UserNode* user, UserNode* friendUser) {
+        removeFriend(user, friendUser);
+        removeFriend(friendUser, user);
+        friendshipChanged(user, friendUser, false);
+        if (wal) logRecord(WAL_UNFRIEND, WalRecord().u32(user->index).u32(friendUser->index));
+    }
+    GroupNode* addGroup(const string& groupName) {
+        GroupNode* g = new GroupNode;
+        g->groupName = groupName;
+        groups.add(g);
+        if (wal) logRecord(WAL_CREATE_GROUP, WalRecord().str(groupName));
+        return g;
+    }
+    void enterGroup(UserNode* user, GroupNode* group) {
+        addMembership(user, group, group->log.size());
+        if (wal) logRecord(WAL_JOIN_GROUP, WalRecord().u32(user->index).str(group->groupName));
+    }
+    bool exitGroup(UserNode* user, GroupNode* group) {
+        GroupMemberNode* m = group->members.remove(user);
+        if (!m) return false;
+        if (m->prevOfUser) m->prevOfUser->nextOfUser = m->nextOfUser;
+        else user->groups = m->nextOfUser;
+        if (m->nextOfUser) m->nextOfUser->prevOfUser = m->prevOfUser;
+        {
+            StateLock lock(*this);
+            memberNodes.destroy(m);
+        }
+        if (wal) logRecord(WAL_LEAVE_GROUP, WalRecord().u32(user->index).str(group->groupName));
+        return true;
+    }
+    // Concurrent senders only push onto the receiver's queue, which the
+    // receiver drains when reading; the message gets its seq then. Nothing
+    // on this path takes the state lock.
+    void deliverMessage(UserNode* sender, UserNode* receiver, const string& text) {
+        if (!concurrent) {
+            uint64_t seq = ++messageClock;
+            receiver->inbox.append(messageChunks, sender, text, seq);
+            messageSearch.appended(receiver->inbox);
+            if (wal) logRecord(WAL_MESSAGE, WalRecord().u32(sender->index).u32(receiver->index).u64(seq).str(text));
+            return;
+        }
+        InboxItem* item = inboxItems.create();
+        item->sender = sender;
+        item->text = text;
+        item->logSeq = wal ? logRecord(WAL_QUEUED_MESSAGE, WalRecord().u32(sender->index).u32(receiver->index).str(text)) : 0;
+        queueMessage(receiver, item);
+    }
+    void queueMessage(UserNode* receiver, InboxItem* item) {
+#if PROFILE_METRICS
+        metrics->queuedMessages.fetch_add(1, memory_order_relaxed);
+#endif
+        receiver->incoming.push(item);
+    }
+    void postToGroup(GroupMemberNode* membership, const string& text) {
+        GroupNode* group = membership->group;
+        // Appended once; members pick it up from the log when they read
+        membership->ownPosts.push_back(group->log.size());
+        reserveMessages(group->log, group->log.size() + 1);
+        uint64_t seq = ++messageClock;
+        group->log.append(messageChunks, membership->user, text, seq);
+        if (wal) logRecord(WAL_GROUP_MESSAGE, WalRecord().u32(membership->user->index).str(group->groupName).u64(seq).str(text));
+        // The dictionary is shared by every group, so concurrent posts leave it to the next search
+        if (!concurrent) messageSearch.appended(group->log);
+    }
+    // Chunk allocation is the only step of an append that touches shared state
+    void reserveMessages(MessageLog& log, size_t total) {
+        if (log.capacity() >= total) return;
+        StateLock lock(*this);
+        log.reserve(messageChunks, total);
+    }
+    // Moves queued private messages into the inbox log, stamping them with
+    // one clock step for the batch; the owner's side
+    void drainInbox(UserNode* user) {
+        vector<InboxItem*> items;
+        for (InboxItem* item; (item = user->incoming.pop()) != NULL;) items.push_back(item);
+        if (items.empty()) return;
+#if PROFILE_METRICS
+        metrics->queuedMessages.fetch_sub((int64_t)items.size(), memory_order_relaxed);
+#endif
+        reserveMessages(user->inbox, user->inbox.size() + items.size());
+        uint64_t first = messageClock.fetch_add(items.size()) + 1;
+        for (size_t i = 0; i < items.size(); i++)
+            user->inbox.append(messageChunks, items[i]->sender, move(items[i]->text), first + i);
+        if (wal) {
+            WalRecord rec;
+            rec.u32(user->index).u64(first).u32((uint32_t)items.size());
+            for (size_t i = 0; i < items.size(); i++) rec.u64(items[i]->logSeq);
+            logRecord(WAL_DRAIN, rec);
+        }
+        inboxItems.destroy(items);
+    }
+    // Replay appends at the logged seq, which must come after the log's last
+    void appendLogged(MessageLog& log, UserNode* sender, const string& text, uint64_t seq) {
+        log.append(messageChunks, sender, text, seq);
+        messageSearch.appended(log);
+        if (seq > messageClock) messageClock = seq;
+    }
+
+    // Re-applies one logged mutation, record number seq of the log; false
+    // if it does not fit the current state (the log belongs to a different
+    // snapshot)
+    bool applyLogRecord(uint64_t seq, uint8_t op, WalReader& in) {
+        switch (op) {
+        case WAL_CREATE_USER: {
+            string name = in.str(), id = in.str(), values[ATTR_COUNT];
+            for (int a = 0; a < ATTR_COUNT; a++) values[a] = in.str();
+            return in.ok() && createUser(name, id, values) != NULL;
+        }
+        case WAL_RENAME_USER: {
+            UserNode* user = loggedUser(in);
+            string name = in.str();
+            if (!in.ok() || !user) return false;
+            renameUser(user, name);
+            return true;
+        }
+        case WAL_SET_ATTRIBUTE: {
+            UserNode* user = loggedUser(in);
+            uint32_t attr = in.u32();
+            string value = in.str();
+            if (!in.ok() || !user || attr >= ATTR_COUNT) return false;
+            updateAttribute(user, (UserAttribute)attr, value);
+            return true;
+        }
+        case WAL_FRIEND_REQUEST: {
+            UserNode* sender = loggedUser(in);
+            UserNode* receiver = loggedUser(in);
+            if (!in.ok() || !sender || !receiver || sender == receiver || hasPendingRequest(receiver, sender)) return false;
+            addPendingRequest(sender, receiver);
+            return true;
+        }
+        case WAL_ACCEPT_REQUEST:
+        case WAL_REJECT_REQUEST:
+        case WAL_UNFRIEND: {
+            UserNode* user = loggedUser(in);
+            UserNode* other = loggedUser(in);
+            if (!in.ok() || !user || !other) return false;
+            if (op == WAL_ACCEPT_REQUEST) return acceptRequest(user, other);
+            if (op == WAL_REJECT_REQUEST) return rejectRequest(user, other);
+            if (!areFriends(user, other)) return false;
+            unfriend(user, other);
+            return true;
+        }
+        case WAL_CREATE_GROUP: {
+            string name = in.str();
+            if (!in.ok() || findGroup(name)) return false;
+            addGroup(name);
+            return true;
+        }
+        case WAL_JOIN_GROUP:
+        case WAL_LEAVE_GROUP: {
+            UserNode* user = loggedUser(in);
+            GroupNode* group = findGroup(in.str());
+            if (!in.ok() || !user || !group) return false;
+            if (op == WAL_LEAVE_GROUP) return exitGroup(user, group);
+            if (isGroupMember(group, user)) return false;
+            enterGroup(user, group);
+            return true;
+        }
+        case WAL_MESSAGE: {
+            UserNode* sender = loggedUser(in);
+            UserNode* receiver = loggedUser(in);
+            uint64_t messageSeq = in.u64();
+            string text = in.str();
+            if (!in.ok() || !sender || !receiver || !seqFits(receiver->inbox, messageSeq)) return false;
+            appendLogged(receiver->inbox, sender, text, messageSeq);
+            return true;
+        }
+        case WAL_GROUP_MESSAGE: {
+            UserNode* sender = loggedUser(in);
+            GroupNode* group = findGroup(in.str());
+            uint64_t messageSeq = in.u64();
+            string text = in.str();
+            if (!in.ok() || !sender || !group || !seqFits(group->log, messageSeq)) return false;
+            GroupMemberNode* membership = group->members.find(sender);
+            if (!membership) return false;
+            membership->ownPosts.push_back(group->log.size());
+            appendLogged(group->log, sender, text, messageSeq);
+            return true;
+        }
+        case WAL_QUEUED_MESSAGE: {
+            UserNode* sender = loggedUser(in);
+            UserNode* receiver = loggedUser(in);
+            string text = in.str();
+            if (!in.ok() || !sender || !receiver) return false;
+            QueuedMessage queued = { receiver, inboxItems.create() };
+            queued.item->sender = sender;
+            queued.item->text = text;
+            queued.item->logSeq = seq;
+            replayQueue[seq] = queued;
+            return true;
+        }
+        case WAL_DRAIN: {
+            UserNode* user = loggedUser(in);
+            uint64_t first = in.u64();
+            uint32_t count = in.u32();
+            if (!user || !seqFits(user->inbox, first) || count == 0) return false;
+            vector<InboxItem*> items;
+            for (uint32_t i = 0; i < count; i++) {
+                map<uint64_t, QueuedMessage>::iterator it = replayQueue.find(in.u64());
+                if (it == replayQueue.end() || it->second.receiver != user) break;
+                items.push_back(it->second.item);
+                replayQueue.erase(it);
+            }
+            bool fits = in.ok() && items.size() == count;
+            if (fits) {
+                for (size_t i = 0; i < items.size(); i++) appendLogged(user->inbox, items[i]->sender, items[i]->text, first + i);
+            }
+            inboxItems.destroy(items);
+            return fits;
+        }
+        case WAL_MARK_READ: {
+            UserNode* user = loggedUser(in);
+            uint64_t seq = in.u64();
+            if (!in.ok() || !user) return false;
+            markRead(user, seq);
+            return true;
+        }
+        }
+        return false;
+    }
+    UserNode* loggedUser(WalReader& in) {
+        uint32_t index = in.u32();
+        return index < byIndex.size() ? byIndex[index] : NULL;
+    }
+    // Back to an empty network (used when a load fails halfway)
+    void resetAll() {
+        clearReplayQueue();
+        clearUsers();
+        clearGroups();
+        delete users;
+        users = newUserIndex();
+        mutuals.clear();
+        records.clear();
+        attributes.clear();
+        graphSnapshot = FriendGraphSnapshot();
+        names.clear();
+        incrementalFresh = false;
+        messageClock = 0;
+        logSequence = 0;
+    }
+    void clearReplayQueue() {
+        for (map<uint64_t, QueuedMessage>::iterator it = replayQueue.begin(); it != replayQueue.end(); ++it) {
+            vector<InboxItem*> item(1, it->second.item);
+            inboxItems.destroy(item);
+        }
+        replayQueue.clear();
+    }
+
+    static uint32_t stringRef(vector<const string*>& strings, const string& s) {
+        strings.push_back(&s);
+        return (uint32_t)(strings.size() - 1);
+    }
+    // CSR rows in list order (newest first), so loading restores the order
+    void writeAdjacency(SnapshotWriter& w, bool pending) {
+        uint64_t total = 0;
+        w.put(total);
+        for (size_t u = 0; u < byIndex.size(); u++) {
+            total += pending ? byIndex[u]->pendingRequests.size() : byIndex[u]->friends.size();
+            w.put(total);
+        }
+        for (size_t u = 0; u < byIndex.size(); u++) {
+            const FriendSet& set = pending ? byIndex[u]->pendingRequests : byIndex[u]->friends;
+            for (FriendNode* f = set.first(); f; f = f->next) w.put(f->user->index);
+        }
+    }
+    static void writeMessages(SnapshotWriter& w, vector<const string*>& strings, const MessageLog& log) {
+        for (size_t i = 0; i < log.size(); i++) {
+            const MessageNode& msg = log.at(i);
+            SnapshotMessage rec = { msg.sender->index, stringRef(strings, msg.text), msg.seq };
+            w.put(rec);
+        }
+    }
+
+    bool loadSnapshotData(const MappedFile& file) {
+        const SnapshotHeader* h = file.array<SnapshotHeader>(0, 1);
+        if (!h || memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) != 0 || h->version != SNAPSHOT_VERSION
+            || h->byteOrder != SNAPSHOT_BYTE_ORDER || h->fileSize != file.size() || h->userCount >= 0xFFFFFFFFu)
+            return false;
+
+        // String table
+        const uint64_t* stringEnds = offsetTable(file, h->stringsOffset, h->stringCount);
+        if (!stringEnds) return false;
+        uint64_t bytesOffset = h->stringsOffset + (h->stringCount + 1) * sizeof(uint64_t);
+        const char* stringBytes = file.array<char>(bytesOffset, stringEnds[h->stringCount]);
+        if (!stringBytes) return false;
+        if (!loadSnapshotUsers(file, h, stringEnds, stringBytes)) return false;
+
+        // The name index needs nothing but the users, so it is built in one
+        // pass on a second thread while friends, inboxes and groups load
+        thread nameBuilder(&NameIndex::build, &names, cref(byIndex));
+        bool linked = loadSnapshotLinks(file, h, stringEnds, stringBytes);
+        nameBuilder.join();
+        if (!linked) return false;
+        incrementalFresh = false;
+        messageClock = h->messageClock;
+        logSequence = h->logSequence;
+        return true;
+    }
+    #define SNAPSHOT_STRING(i) string(stringBytes + stringEnds[i], stringEnds[(i) + 1] - stringEnds[i])
+    // Users, with each distinct attribute value interned once and postings
+    // growing in index order
+    bool loadSnapshotUsers(const MappedFile& file, const SnapshotHeader* h, const uint64_t* stringEnds,
+                           const char* stringBytes) {
+        uint64_t n = h->userCount;
+        const SnapshotUser* userRecs = file.array<SnapshotUser>(h->usersOffset, n);
+        if (!userRecs) return false;
+        byIndex.reserve(n);
+        records.reserve(n);
+        users->reserve(n);
+        vector<uint32_t> valueHandles; // by string index, NONE until interned
+        for (uint64_t u = 0; u < n; u++) {
+            const SnapshotUser& rec = userRecs[u];
+            if (rec.name >= h->stringCount || rec.id >= h->stringCount || rec.readSeq > h->messageClock) return false;
+            uint32_t handles[ATTR_COUNT];
+            for (int a = 0; a < ATTR_COUNT; a++) {
+                uint32_t s = rec.attributes[a];
+                if (s >= h->stringCount) return false;
+                if (s >= valueHandles.size()) valueHandles.resize(s + 1, StringPool::NONE);
+                if (valueHandles[s] == StringPool::NONE) valueHandles[s] = records.intern(SNAPSHOT_STRING(s));
+                handles[a] = valueHandles[s];
+            }
+            UserNode* user = new UserNode;
+            user->name = SNAPSHOT_STRING(rec.name);
+            user->id = SNAPSHOT_STRING(rec.id);
+            user->left = user->right = NULL;
+            user->height = 1;
+            user->readSeq = rec.readSeq;
+            user->groups = NULL;
+            user->index = (uint32_t)u;
+            if (!users->insert(user)) { // duplicate id
+                delete user;
+                return false;
+            }
+            byIndex.push_back(user);
+            mutuals.addUser();
+            records.addUser(handles);
+            for (int a = 0; a < ATTR_COUNT; a++) attributes.add((UserAttribute)a, handles[a], user->index);
+        }
+        return true;
+    }
+    // Everything that links users: friends, pending requests, inboxes and
+    // groups. Message seqs must rise along each log and not pass the clock.
+    bool loadSnapshotLinks(const MappedFile& file, const SnapshotHeader* h, const uint64_t* stringEnds,
+                           const char* stringBytes) {
+        uint64_t n = h->userCount;
+
+        // Friends and pending requests
+        if (!loadAdjacency(file, h->friendsOffset, false) || !loadAdjacency(file, h->pendingOffset, true)) return false;
+
+        // Private inboxes
+        const uint64_t* inboxEnds = offsetTable(file, h->inboxOffset, n);
+        if (!inboxEnds) return false;
+        const SnapshotMessage* inboxMsgs = file.array<SnapshotMessage>(h->inboxOffset + (n + 1) * sizeof(uint64_t), inboxEnds[n]);
+        if (!inboxMsgs) return false;
+        for (uint64_t u = 0; u < n; u++) {
+            for (uint64_t i = inboxEnds[u]; i < inboxEnds[u + 1]; i++) {
+                const SnapshotMessage& m = inboxMsgs[i];
+                if (m.sender >= n || m.text >= h->stringCount || !seqFits(byIndex[u]->inbox, m.seq)
+                    || m.seq > h->messageClock)
+                    return false;
+                byIndex[u]->inbox.append(messageChunks, byIndex[m.sender], SNAPSHOT_STRING(m.text), m.seq);
+            }
+        }
+
+        // Groups, members (stored newest first) and logs
+        const SnapshotGroup* groupRecs = file.array<SnapshotGroup>(h->groupsOffset, h->groupCount);
+        uint64_t membersOffset = h->groupsOffset + h->groupCount * sizeof(SnapshotGroup);
+        const SnapshotMember* memberRecs = file.array<SnapshotMember>(membersOffset, h->memberCount);
+        const SnapshotMessage* groupMsgs = file.array<SnapshotMessage>(
+            membersOffset + h->memberCount * sizeof(SnapshotMember), h->groupMessageCount);
+        if (!groupRecs || !memberRecs || !groupMsgs) return false;
+        uint64_t nextMember = 0, nextMsg = 0;
+        for (uint64_t g = 0; g < h->groupCount; g++) {
+            const SnapshotGroup& rec = groupRecs[g];
+            if (rec.name >= h->stringCount || rec.memberCount > h->memberCount - nextMember
+                || rec.messageCount > h->groupMessageCount - nextMsg) return false;
+            GroupNode* group = new GroupNode;
+            group->groupName = SNAPSHOT_STRING(rec.name);
+            if (groups.find(group->groupName)) { delete group; return false; }
+            groups.add(group);
+            for (uint64_t i = 0; i < rec.messageCount; i++) {
+                const SnapshotMessage& m = groupMsgs[nextMsg + i];
+                if (m.sender >= n || m.text >= h->stringCount || !seqFits(group->log, m.seq)
+                    || m.seq > h->messageClock)
+                    return false;
+                group->log.append(messageChunks, byIndex[m.sender], SNAPSHOT_STRING(m.text), m.seq);
+            }
+            nextMsg += rec.messageCount;
+            for (uint64_t i = rec.memberCount; i-- > 0;) {
+                const SnapshotMember& m = memberRecs[nextMember + i];
+                if (m.user >= n || m.joinedAt > group->log.size() || group->members.contains(byIndex[m.user])) return false;
+                addMembership(byIndex[m.user], group, m.joinedAt);
+            }
+            nextMember += rec.memberCount;
+            // Own-post positions are derived from the log rather than stored
+            for (size_t pos = 0; pos < group->log.size(); pos++) {
+                GroupMemberNode* member = group->members.find(group->log.at(pos).sender);
+                if (member && pos >= member->joinedAt) member->ownPosts.push_back(pos);
+            }
+        }
+        return true;
+    }
+    #undef SNAPSHOT_STRING
+    // A loaded message must come after the one before it in its log
+    static bool seqFits(const MessageLog& log, uint64_t seq) {
+        return seq != 0 && (log.size() == 0 || log.at(log.size() - 1).seq < seq);
+    }
+    // The rows + 1 running totals that delimit a CSR section, or NULL unless
+    // they start at zero and never decrease
+    static const uint64_t* offsetTable(const MappedFile& file, uint64_t offset, uint64_t rows) {
+        const uint64_t* ends = file.array<uint64_t>(offset, rows + 1);
+        if (!ends || ends[0] != 0) return NULL;
+        for (uint64_t i = 0; i < rows; i++)
+            if (ends[i] > ends[i + 1]) return NULL;
+        return ends;
+    }
+    bool loadAdjacency(const MappedFile& file, uint64_t offset, bool pending) {
+        uint64_t n = byIndex.size();
+        const uint64_t* ends = offsetTable(file, offset, n);
+        if (!ends) return false;
+        const uint32_t* neighbors = file.array<uint32_t>(offset + (n + 1) * sizeof(uint64_t), ends[n]);
+        if (!neighbors) return false;
+        for (uint64_t u = 0; u < n; u++) {
+            UserNode* user = byIndex[u];
+            FriendSet& set = pending ? user->pendingRequests : user->friends;
+            for (uint64_t i = ends[u + 1]; i-- > ends[u];) { // oldest first, so add() restores the order
+                if (neighbors[i] >= n || set.contains(byIndex[neighbors[i]])) return false;
+                FriendNode* f = friendNodes.create();
+                f->user = byIndex[neighbors[i]];
+                set.add(f);
+            }
+            if (!pending) mutuals.setRow((uint32_t)u, neighbors + ends[u], neighbors + ends[u + 1]);
+        }
+        return true;
+    }
+
+    static constexpr size_t MAX_ATTRIBUTE_SCAN = 2048;
+    static constexpr size_t MAX_NAME_CANDIDATES = 64;
+    static constexpr size_t MAX_NAME_FRIENDS = 1024;
+    static constexpr int MUTUAL_WEIGHT = 10;
+    static constexpr int ATTRIBUTE_WEIGHT[ATTR_COUNT] = { 3, 2, 4 }; // city, interest, institution
+
+    // Attribute matches from the inverted indexes, into the epoch scratch
+    void addAttributeCandidates(UserNode* user, vector<uint32_t>& touched) {
+        for (int a = 0; a < ATTR_COUNT; a++) {
+            const vector<uint32_t>* list = attributes.find((UserAttribute)a, records.handle(user->index, (UserAttribute)a));
+            if (!list) continue;
+            for (size_t j = 0; j < list->size() && j < MAX_ATTRIBUTE_SCAN; j++) {
+                uint32_t c = (*list)[j];
+                if (candidateEpoch[c] != epoch) {
+                    candidateEpoch[c] = epoch;
+                    candidateMutuals[c] = candidateAttributes[c] = 0;
+                    touched.push_back(c);
+                }
+                candidateAttributes[c] |= 1 << a;
+            }
+        }
+    }
+    // Scores the touched candidates and keeps the k best, best first
+    void selectSuggestions(UserNode* user, size_t k, const vector<uint32_t>& touched, vector<Suggestion>& out) {
+        // Bounded min-heap keeps the k best
+        priority_queue<pair<int, uint32_t>, vector<pair<int, uint32_t> >, greater<pair<int, uint32_t> > > heap;
+        // Friendship is tested on the set directly so these per-candidate checks stay out of the areFriends metrics
+        for (size_t i = 0; i < touched.size(); i++) {
+            UserNode* c = byIndex[touched[i]];
+            if (c == user || user->friends.contains(c) || hasPendingRequest(user, c) || hasPendingRequest(c, user)) continue;
+            int score = candidateMutuals[c->index] * MUTUAL_WEIGHT;
+            for (int a = 0; a < ATTR_COUNT; a++)
+                if (candidateAttributes[c->index] & (1 << a)) score += ATTRIBUTE_WEIGHT[a];
+            heap.push(make_pair(score, c->index));
+            if (heap.size() > k) heap.pop();
+        }
+        out.resize(heap.size());
+        for (size_t i = heap.size(); i-- > 0; heap.pop()) {
+            uint32_t c = heap.top().second;
+            out[i].user = byIndex[c];
+            out[i].mutualFriends = candidateMutuals[c];
+            out[i].attributeMask = candidateAttributes[c];
+            out[i].score = heap.top().first;
+        }
+    }
+
+    // True when the incremental structures may be used, rebuilding them first if a bulk load or concurrent use left them stale
+    bool incrementalReady() {
+        if (!incremental || concurrent) return false;
+        if (!incrementalFresh) {
+            commonCounts.build(mutuals, (uint32_t)byIndex.size());
+            suggestionCache.assign(byIndex.size(), CachedSuggestions());
+            incrementalFresh = true;
+        }
+        return true;
+    }
+    // Whether changes must be applied to the incremental structures now
+    bool incrementalLive() const { return incremental && incrementalFresh && !concurrent; }
+
+    uint32_t attributeVersion(UserAttribute attr, uint32_t handle) {
+        vector<uint32_t>& versions = attributeVersions[attr];
+        if (versions.size() <= handle) versions.resize(handle + 1, 0);
+        return versions[handle];
+    }
+    void invalidateSuggestions(uint32_t user) {
+        if (user < suggestionCache.size()) suggestionCache[user].valid = false;
+    }
+    void friendshipChanged(UserNode* a, UserNode* b, bool added) {
+        if (!incrementalLive()) return;
+        affectedUsers.clear();
+        commonCounts.friendshipChanged(mutuals, a->index, b->index, added, affectedUsers);
+        invalidateSuggestions(a->index);
+        invalidateSuggestions(b->index);
+        for (size_t i = 0; i < affectedUsers.size(); i++) invalidateSuggestions(affectedUsers[i]);
+    }
+    void requestsChanged(UserNode* a, UserNode* b) {
+        if (!incrementalLive()) return;
+        invalidateSuggestions(a->index);
+        invalidateSuggestions(b->index);
+    }
+
+    // Serves suggestions from the user's cached list, recomputing it from
+    // the materialized counts when it is stale or too short
+    void cachedSuggestions(UserNode* user, size_t limit, vector<Suggestion>& out) {
+        static const size_t MIN_CACHED = 10;
+        out.clear();
+        if (limit == 0) return;
+        if (suggestionCache.size() <= user->index) suggestionCache.resize(byIndex.size());
+        CachedSuggestions& cache = suggestionCache[user->index];
+        bool fresh = cache.valid && (limit <= cache.limit || cache.top.size() < cache.limit);
+        for (int a = 0; a < ATTR_COUNT && fresh; a++) {
+            uint32_t h = records.handle(user->index, (UserAttribute)a);
+            fresh = cache.handles[a] == h && cache.versions[a] == attributeVersion((UserAttribute)a, h);
+        }
+        if (!fresh) {
+            cache.limit = max(limit, MIN_CACHED);
+            beginEpoch();
+            vector<uint32_t> touched;
+            const CountMap& counts = commonCounts.of(user->index);
+            for (uint32_t i = 0; i < counts.slotCount(); i++) {
+                const CountMap::Entry& e = counts.slot(i);
+                if (!e.count) continue;
+                candidateEpoch[e.key] = epoch;
+                candidateMutuals[e.key] = (int)e.count;
+                candidateAttributes[e.key] = 0;
+                touched.push_back(e.key);
+            }
+            addAttributeCandidates(user, touched);
+            selectSuggestions(user, cache.limit, touched, cache.top);
+            for (int a = 0; a < ATTR_COUNT; a++) {
+                cache.handles[a] = records.handle(user->index, (UserAttribute)a);
+                cache.versions[a] = attributeVersion((UserAttribute)a, cache.handles[a]);
+            }
+            cache.valid = true;
+        }
+        out.assign(cache.top.begin(), cache.top.begin() + min(limit, cache.top.size()));
+    }
+
+    // Candidates not yet matched, checked against the name first if check
+    void addNameMatches(UserNode* searcher, const vector<string>& words, const vector<uint32_t>& candidates, bool check,
+                        bool fuzzy, vector<NameMatch>& out) {
+        for (size_t i = 0; i < candidates.size(); i++) {
+            uint32_t c = candidates[i];
+            if (candidateEpoch[c] == epoch || (searcher && c == searcher->index)) continue;
+            int edits = check ? names.matchEdits(byIndex[c]->name, words, fuzzy) : 0;
+            if (edits < 0) continue;
+            candidateEpoch[c] = epoch;
+            NameMatch m = { byIndex[c], searcher && searcher->friends.contains(byIndex[c]),
+                            searcher ? (int)mutuals.count(searcher->index, c) : 0, edits };
+            out.push_back(m);
+        }
+    }
+    static bool betterNameMatch(const NameMatch& a, const NameMatch& b) {
+        if (a.edits != b.edits) return a.edits < b.edits;
+        if (a.isFriend != b.isFriend) return a.isFriend;
+        if (a.mutualFriends != b.mutualFriends) return a.mutualFriends > b.mutualFriends;
+        if (a.user->name.size() != b.user->name.size()) return a.user->name.size() < b.user->name.size();
+        if (a.user->name != b.user->name) return a.user->name < b.user->name;
+        return a.user->index < b.user->index;
+    }
+    static void setResolved(ResolvedUsers* resolved, UserNode* first, UserNode* second) {
+        if (!resolved) return;
+        resolved->first = first;
+        resolved->second = second;
+    }
+    // Fresh stamp for the per-user scratch arrays, sized to the current user count
+    void beginEpoch() {
+        if (candidateEpoch.size() < byIndex.size()) {
+            candidateEpoch.resize(byIndex.size(), 0);
+            candidateMutuals.resize(byIndex.size());
+            candidateAttributes.resize(byIndex.size());
+        }
+        if (++epoch == 0) { // wrapped: stale stamps could alias the new epoch
+            fill(candidateEpoch.begin(), candidateEpoch.end(), 0);
+            epoch = 1;
+        }
+    }
+    // Links a membership into the group's member set and the user's group list
+    GroupMemberNode* addMembership(UserNode* user, GroupNode* group, size_t joinedAt) {
+        GroupMemberNode* m;
+        {
+            StateLock lock(*this);
+            m = memberNodes.create();
+        }
+        m->user = user;
+        m->group = group;
+        m->joinedAt = joinedAt;
+        group->members.add(m);
+        m->prevOfUser = NULL;
+        m->nextOfUser = user->groups;
+        if (user->groups) user->groups->prevOfUser = m;
+        user->groups = m;
+        return m;
+    }
+    void addPendingRequest(UserNode* sender, UserNode* receiver) {
+        receiver->pendingRequests.add(newFriendNode(sender));
+        requestsChanged(sender, receiver);
+        if (wal) logRecord(WAL_FRIEND_REQUEST, WalRecord().u32(sender->index).u32(receiver->index));
+    }
+    void sendFriendRequestsTo(UserNode* sender, const vector<UserNode*>& targets, FriendRequestBatchResult& result) {
+        beginEpoch();
+        candidateEpoch[sender->index] = epoch; // the sender counts as already seen
+        for (size_t i = 0; i < targets.size(); i++) {
+            UserNode* t = targets[i];
+            if (t == sender) result.self++;
+            else if (candidateEpoch[t->index] == epoch) result.duplicates++;
+            else if (areFriends(sender, t)) result.alreadyFriends++;
+            else if (hasPendingRequest(t, sender) || hasPendingRequest(sender, t)) result.alreadyPending++;
+            else {
+                addPendingRequest(sender, t);
+                result.sent++;
+            }
+            candidateEpoch[t->index] = epoch;
+        }
+    }
+
+    // One input of the inbox/group-log merge, covering positions [lo, hi)
+    struct MessageSource {
+        const MessageLog* log;
+        GroupMemberNode* membership; // NULL for the private inbox
+        size_t lo, hi;
+    };
+
+    void messageSources(UserNode* user, vector<MessageSource>& sources) {
+        MessageSource inbox = { &user->inbox, NULL, 0, user->inbox.size() };
+        sources.push_back(inbox);
+        for (GroupMemberNode* m = user->groups; m; m = m->nextOfUser) {
+            MessageSource src = { &m->group->log, m, m->joinedAt, m->group->log.size() };
+            sources.push_back(src);
+        }
+    }
+    static void addSearchHit(UserNode* reader, const MessageNode& msg, GroupNode* group, MessagePage& page) {
+        MessageRef ref = { &msg, group, msg.seq > reader->readSeq };
+        page.messages.push_back(ref);
+        if (ref.unread) page.unread++;
+    }
+    static bool newerMessage(const MessageRef& a, const MessageRef& b) { return a.msg->seq > b.msg->seq; }
+    static bool isOwnPost(const MessageSource& src, size_t pos) {
+        return src.membership && src.log->at(pos).sender == src.membership->user;
+    }
+    // Messages after the given seq that the user did not post, per source
+    static size_t countAfter(const MessageSource& src, uint64_t seq) {
+        size_t start = max(src.lo, src.log->firstAfter(seq));
+        size_t n = src.hi - start;
+        if (src.membership) {
+            const vector<size_t>& own = src.membership->ownPosts;
+            n -= own.end() - lower_bound(own.begin(), own.end(), start);
+        }
+        return n;
+    }
+
+    // k-way merge of the inbox and group logs by seq. Oldest first starting
+    // after afterSeq, or newest first down to it; stops after limit messages,
+    // so a page costs O(sources * log n + limit * sources).
+    void collectMessages(UserNode* user, uint64_t afterSeq, size_t limit, bool newestFirst, vector<MessageRef>& out) {
+        out.clear();
+        vector<MessageSource> sources;
+        messageSources(user, sources);
+        for (size_t i = 0; i < sources.size(); i++)
+            sources[i].lo = max(sources[i].lo, sources[i].log->firstAfter(afterSeq));
+        while (out.size() < limit) {
+            int best = -1;
+            uint64_t bestSeq = 0;
+            for (size_t i = 0; i < sources.size(); i++) {
+                MessageSource& src = sources[i];
+                if (newestFirst) {
+                    while (src.hi > src.lo && isOwnPost(src, src.hi - 1)) src.hi--;
+                    if (src.hi > src.lo && (best < 0 || src.log->at(src.hi - 1).seq > bestSeq)) {
+                        best = (int)i;
+                        bestSeq = src.log->at(src.hi - 1).seq;
+                    }
+                } else {
+                    while (src.lo < src.hi && isOwnPost(src, src.lo)) src.lo++;
+                    if (src.lo < src.hi && (best < 0 || src.log->at(src.lo).seq < bestSeq)) {
+                        best = (int)i;
+                        bestSeq = src.log->at(src.lo).seq;
+                    }
+                }
+            }
+            if (best < 0) break;
+            MessageSource& src = sources[best];
+            MessageRef ref;
+            ref.msg = newestFirst ? &src.log->at(--src.hi) : &src.log->at(src.lo++);
+            ref.group = src.membership ? src.membership->group : NULL;
+            ref.unread = ref.msg->seq > user->readSeq;
+            out.push_back(ref);
+        }
+    }
+    size_t unreadCount(UserNode* user) {
+        vector<MessageSource> sources;
+        messageSources(user, sources);
+        size_t n = 0;
+        for (size_t i = 0; i < sources.size(); i++) n += countAfter(sources[i], user->readSeq);
+        return n;
+    }
+    size_t totalMessages(UserNode* user) {
+        vector<MessageSource> sources;
+        messageSources(user, sources);
+        size_t n = 0;
+        for (size_t i = 0; i < sources.size(); i++) n += countAfter(sources[i], 0);
+        return n;
+    }
+    void markRead(UserNode* user, uint64_t seq) {
+        if (seq <= user->readSeq) return;
+        user->readSeq = seq;
+        if (wal) logRecord(WAL_MARK_READ, WalRecord().u32(user->index).u64(seq));
+    }
+
+    // Updates the record and its inverted index together
+    void setAttribute(UserNode* user, UserAttribute attr, const string& value) {
+        uint32_t old = records.handle(user->index, attr);
+        attributes.remove(attr, old, user->index);
+        records.set(user->index, attr, value);
+        uint32_t now = records.handle(user->index, attr);
+        attributes.add(attr, now, user->index);
+        if (incrementalLive()) { // both value lists changed: cached lists built from either are stale
+            attributeVersion(attr, max(old, now));
+            attributeVersions[attr][old]++;
+            attributeVersions[attr][now]++;
+        }
+    }
+    void removeFriend(UserNode* user, UserNode* friendToRemove) {
+        FriendNode* f = user->friends.remove(friendToRemove);
+        if (!f) return;
+        freeFriendNode(f);
+        StateLock lock(*this);
+        mutuals.removeEdge(user->index, friendToRemove->index);
+    }
+    // Friend and request nodes are dropped with their slabs, not one by one
+    void clearUsers() {
+        for (size_t i = 0; i < byIndex.size(); i++)
+            clearUser(byIndex[i]);
+        byIndex.clear();
+        friendNodes.releaseAll();
+    }
+    void clearUser(UserNode* node) {
+        vector<InboxItem*> queued;
+        for (InboxItem* item; (item = node->incoming.pop()) != NULL;) queued.push_back(item);
+        inboxItems.destroy(queued);
+        node->friends.release();
+        node->pendingRequests.release();
+        // Message text owns heap memory, so chunks are destroyed (64 messages each)
+        node->inbox.release(messageChunks);
+        delete node;
+    }
+    void clearGroups() {
+        for (size_t i = 0; i < groups.size(); i++) {
+            GroupNode* g = groups.at(i);
+            for (GroupMemberNode* m = g->members.release(); m; m = m->next) m->~GroupMemberNode(); // frees ownPosts
+            g->log.release(messageChunks);
+            delete g;
+        }
+        groups.clear();
+        memberNodes.releaseAll();
+    }
+    GroupNode* findGroup(const string& groupName) {
+        return groups.find(groupName);
+    }
+    bool isGroupMember(GroupNode* group, UserNode* user) {
+        return group->members.contains(user);
+    }
+};
+
+// Reader/writer lock that lets a waiting writer in ahead of newly arriving
+// readers: the writer bit goes up first, turning new readers away, and the
+// writer then waits for the readers already inside to leave. Uncontended
+// acquires are one CAS; only waiters touch the mutex. std::shared_mutex is
+// glibc's reader-preferring rwlock, under which a steady stream of inbox
+// reads on a busy group can hold off its posts indefinitely.
+class FairSharedMutex {
+    static constexpr unsigned WRITER = 1u << 31;
+
+    atomic<unsigned> state;    // WRITER | readers inside
+    atomic<unsigned> sleepers; // threads waiting for WRITER to clear
+    mutex m;
+    condition_variable gate1;  // readers and writers waiting for WRITER to clear
+    condition_variable gate2;  // the writer waiting for readers to leave
+
+    FairSharedMutex(const FairSharedMutex&);
+    FairSharedMutex& operator=(const FairSharedMutex&);
+
+    bool enterShared() {
+        unsigned s = state.load();
+        while (!(s & WRITER))
+            if (state.compare_exchange_weak(s, s + 1)) return true;
+        return false;
+    }
+    bool enterWriter() {
+        unsigned s = state.load();
+        while (!(s & WRITER))
+            if (state.compare_exchange_weak(s, s | WRITER)) return true;
+        return false;
+    }
+
+public:
+    FairSharedMutex() : state(0), sleepers(0) {}
+
+    void lock_shared() {
+        if (enterShared()) return;
+        unique_lock<mutex> hold(m);
+        sleepers++; // before the retry, so unlock() cannot miss us
+        while (!enterShared()) gate1.wait(hold);
+        sleepers--;
+    }
+    void unlock_shared() {
+        if (state.fetch_sub(1) == (WRITER | 1)) { // last reader out, a writer is waiting
+            lock_guard<mutex> hold(m);
+            gate2.notify_one();
+        }
+    }
+    void lock() {
+        if (!enterWriter()) {
+            unique_lock<mutex> hold(m);
+            sleepers++;
+            while (!enterWriter()) gate1.wait(hold);
+            sleepers--;
+        }
+        if (state.load() != WRITER) {
+            unique_lock<mutex> hold(m);
+            while (state.load() != WRITER) gate2.wait(hold);
+        }
+    }
+    void unlock() {
+        state.store(0);
+        if (sleepers.load()) {
+            lock_guard<mutex> hold(m); // a sleeper between its retry and its wait holds m
+            gate1.notify_all();
+        }
+    }
+};
+
+// Thread-safe front for a Profile. Users are spread over lock shards by ID
+// hash and groups over shards by name; an operation locks only the shards
+// it touches, shared to read and exclusive to write. Private messages skip
+// the receiver's shard and go through its InboxQueue. Locks are always taken
+// in one order (structure lock, then user shards, then group shards, each
+// lowest index first), so two operations can never wait on each other.
+// Adding users or groups, editing profiles, bulk requests, suggestions and
+// store operations take the structure lock exclusively and run alone.
+//
+// Lists are copied out while the locks are held. UserNode pointers stay
+// valid (users are never removed), but their lists may change as soon as
+// the call returns.
+class ConcurrentProfile {
+public:
+    static constexpr size_t USER_SHARDS = 64;   // one bit each in a uint64_t mask
+    static constexpr size_t GROUP_SHARDS = 32;  // one bit each in a uint32_t mask
+
+private:
+    struct alignas(64) Shard { FairSharedMutex lock; }; // own cache line, no false sharing
+
+    Profile& engine;
+    FairSharedMutex structure; // the user index, group registry and attribute indexes
+    Shard userShards[USER_SHARDS];
+    Shard groupShards[GROUP_SHARDS];
+
+    static uint64_t userShard(const string& id) { return (uint64_t)1 << (hashString(id) & (USER_SHARDS - 1)); }
+    static uint32_t groupShard(const string& name) { return (uint32_t)1 << (hashString(name) & (GROUP_SHARDS - 1)); }
+
+    // Holds the shards whose mask bits are set, lowest bit first; user
+    // shards must be locked before group shards
+    class ShardLocks {
+        ConcurrentProfile& owner;
+        uint64_t users;
+        uint32_t groups;
+        bool usersExclusive, groupsExclusive;
+
+        static void lockAll(Shard* shards, uint64_t mask, bool exclusive) {
+            for (; mask; mask &= mask - 1) {
+                Shard& s = shards[__builtin_ctzll(mask)];
+                if (exclusive) s.lock.lock();
+                else s.lock.lock_shared();
+            }
+        }
+        static void unlockAll(Shard* shards, uint64_t mask, bool exclusive) {
+            for (; mask; mask &= mask - 1) {
+                Shard& s = shards[__builtin_ctzll(mask)];
+                if (exclusive) s.lock.unlock();
+                else s.lock.unlock_shared();
+            }
+        }
+
+    public:
+        ShardLocks(ConcurrentProfile& p, uint64_t userMask, bool exclusive)
+            : owner(p), users(userMask), groups(0), usersExclusive(exclusive), groupsExclusive(false) {
+            lockAll(owner.userShards, users, exclusive);
+        }
+        void lockGroups(uint32_t mask, bool exclusive) { // once, after the user shards
+            groups = mask;
+            groupsExclusive = exclusive;
+            lockAll(owner.groupShards, groups, exclusive);
+        }
+        ~ShardLocks() {
+            unlockAll(owner.groupShards, groups, groupsExclusive);
+            unlockAll(owner.userShards, users, usersExclusive);
+        }
+    };
+
+    static void copyUsers(const FriendRange& range, vector<UserNode*>& out) {
+        for (FriendRange::iterator it = range.begin(); it != range.end(); ++it) out.push_back(*it);
+    }
+    // Shards of the groups a user belongs to; the user's shard must be held
+    static uint32_t groupShardsOf(UserNode* user) {
+        uint32_t mask = 0;
+        for (GroupMemberNode* m = user->groups; m; m = m->nextOfUser) mask |= groupShard(m->group->groupName);
+        return mask;
+    }
+
+public:
+    ConcurrentProfile(Profile& p) : engine(p) { engine.setConcurrent(true); }
+    ~ConcurrentProfile() { engine.setConcurrent(false); }
+
+    Status createProfile(const string& name, const string& id, const string values[ATTR_COUNT]) {
+        unique_lock<FairSharedMutex> all(structure);
+        return engine.createProfile(name, id, values);
+    }
+    Status editProfileField(const string& userId, ProfileField field, const string& value) {
+        unique_lock<FairSharedMutex> all(structure);
+        return engine.editProfileField(userId, field, value);
+    }
+    UserNode* findUser(const string& id) {
+        shared_lock<FairSharedMutex> shared(structure);
+        return engine.findUser(id);
+    }
+
+    // Two-user operations lock both users' shards exclusively
+    Status sendFriendRequest(const string& senderId, const string& receiverId) {
+        shared_lock<FairSharedMutex> shared(structure);
+        ShardLocks locks(*this, userShard(senderId) | userShard(receiverId), true);
+        return engine.sendFriendRequest(senderId, receiverId);
+    }
+    Status acceptFriendRequest(const string& userId, const string& senderId) {
+        shared_lock<FairSharedMutex> shared(structure);
+        ShardLocks locks(*this, userShard(userId) | userShard(senderId), true);
+        return engine.acceptFriendRequest(userId, senderId);
+    }
+    Status rejectFriendRequest(const string& userId, const string& senderId) {
+        shared_lock<FairSharedMutex> shared(structure);
+        ShardLocks locks(*this, userShard(userId) | userShard(senderId), true);
+        return engine.rejectFriendRequest(userId, senderId);
+    }
+    Status deleteFriend(const string& userId, const string& friendId) {
+        shared_lock<FairSharedMutex> shared(structure);
+        ShardLocks locks(*this, userShard(userId) | userShard(friendId), true);
+        return engine.deleteFriend(userId, friendId);
+    }
+    // Only the friendship check needs a lock: the message goes onto the
+    // receiver's lock-free queue, so senders to one user do not serialize
+    Status sendMessage(const string& senderId, const string& receiverId, const string& message) {
+        shared_lock<FairSharedMutex> shared(structure);
+        ShardLocks locks(*this, userShard(senderId), false);
+        return engine.sendMessage(senderId, receiverId, message);
+    }
+
+    Status friendsOf(const string& userId, vector<UserNode*>& out) {
+        out.clear();
+        shared_lock<FairSharedMutex> shared(structure);
+        ShardLocks locks(*this, userShard(userId), false);
+        FriendRange range;
+        Status status = engine.friendsOf(userId, range);
+        copyUsers(range, out);
+        return status;
+    }
+    Status pendingRequestsOf(const string& userId, vector<UserNode*>& out) {
+        out.clear();
+        shared_lock<FairSharedMutex> shared(structure);
+        ShardLocks locks(*this, userShard(userId), false);
+        FriendRange range;
+        Status status = engine.pendingRequestsOf(userId, range);
+        copyUsers(range, out);
+        return status;
+    }
+    Status mutualFriends(const string& user1Id, const string& user2Id, vector<UserNode*>& out) {
+        shared_lock<FairSharedMutex> shared(structure);
+        ShardLocks locks(*this, userShard(user1Id) | userShard(user2Id), false);
+        return engine.mutualFriends(user1Id, user2Id, out);
+    }
+    int countMutualFriends(const string& user1Id, const string& user2Id) {
+        shared_lock<FairSharedMutex> shared(structure);
+        ShardLocks locks(*this, userShard(user1Id) | userShard(user2Id), false);
+        return engine.countMutualFriends(user1Id, user2Id);
+    }
+    const ProfileMetrics* operationMetrics() const { return engine.operationMetrics(); }
+    void metricGauges(MetricGauges& out) {
+        unique_lock<FairSharedMutex> all(structure);
+        engine.metricGauges(out);
+    }
+    // Walks friends of friends across every shard
+    Status suggestFriends(const string& userId, size_t limit, vector<Suggestion>& out) {
+        unique_lock<FairSharedMutex> all(structure);
+        return engine.suggestFriends(userId, limit, out);
+    }
+    Status connectionPath(const string& fromId, const string& toId, size_t maxHops, vector<UserNode*>& out) {
+        unique_lock<FairSharedMutex> all(structure);
+        return engine.connectionPath(fromId, toId, maxHops, out);
+    }
+    Status searchUsersByName(const string& searcherId, const string& query, size_t limit, vector<NameMatch>& out) {
+        unique_lock<FairSharedMutex> all(structure);
+        return engine.searchUsersByName(searcherId, query, limit, out);
+    }
+    Status findUsersByAttribute(const vector<AttributeTerm>& terms, bool matchAll, vector<UserNode*>& out) {
+        shared_lock<FairSharedMutex> shared(structure);
+        return engine.findUsersByAttribute(terms, matchAll, out);
+    }
+    Status sendFriendRequests(const string& senderId, const vector<string>& receiverIds, FriendRequestBatchResult& result) {
+        unique_lock<FairSharedMutex> all(structure);
+        return engine.sendFriendRequests(senderId, receiverIds, result);
+    }
+    Status sendFriendRequestToGroup(const string& userId, const string& groupName, FriendRequestBatchResult& result) {
+        unique_lock<FairSharedMutex> all(structure);
+        return engine.sendFriendRequestToGroup(userId, groupName, result);
+    }
+
+    // Reading drains the inbox queue (one consumer at a time) and marks
+    // messages read, so the reader's shard is exclusive; the groups it reads
+    // from are shared
+    Status readMessages(const string& userId, size_t limit, MessagePage& page) {
+        shared_lock<FairSharedMutex> shared(structure);
+        UserNode* user = engine.findUser(userId);
+        if (!user) return STATUS_UNKNOWN_USER;
+        ShardLocks locks(*this, userShard(userId), true);
+        locks.lockGroups(groupShardsOf(user), false);
+        return engine.readMessages(userId, limit, page);
+    }
+    Status readMessages(const string& userId, uint64_t afterSeq, size_t limit, MessagePage& page) {
+        shared_lock<FairSharedMutex> shared(structure);
+        UserNode* user = engine.findUser(userId);
+        if (!user) return STATUS_UNKNOWN_USER;
+        ShardLocks locks(*this, userShard(userId), true);
+        locks.lockGroups(groupShardsOf(user), false);
+        return engine.readMessages(userId, afterSeq, limit, page);
+    }
+
+    // Indexes what was delivered concurrently since the last search, into
+    // the shared term dictionary
+    Status searchMessages(const string& userId, const string& query, size_t limit, MessagePage& page) {
+        unique_lock<FairSharedMutex> all(structure);
+        return engine.searchMessages(userId, query, limit, page);
+    }
+
+    Status createGroup(const string& groupName) {
+        unique_lock<FairSharedMutex> all(structure);
+        return engine.createGroup(groupName);
+    }
+    Status joinGroup(const string& userId, const string& groupName) {
+        shared_lock<FairSharedMutex> shared(structure);
+        ShardLocks locks(*this, userShard(userId), true);
+        locks.lockGroups(groupShard(groupName), true);
+        return engine.joinGroup(userId, groupName);
+    }
+    Status leaveGroup(const string& userId, const string& groupName) {
+        shared_lock<FairSharedMutex> shared(structure);
+        ShardLocks locks(*this, userShard(userId), true);
+        locks.lockGroups(groupShard(groupName), true);
+        return engine.leaveGroup(userId, groupName);
+    }
+    // Touches only the group: the post goes into its log, not member inboxes
+    Status sendGroupMessage(const string& senderId, const string& groupName, const string& message, size_t* recipients = NULL) {
+        shared_lock<FairSharedMutex> shared(structure);
+        ShardLocks locks(*this, 0, false);
+        locks.lockGroups(groupShard(groupName), true);
+        return engine.sendGroupMessage(senderId, groupName, message, recipients);
+    }
+    Status groupMembers(const string& groupName, vector<UserNode*>& out) {
+        out.clear();
+        shared_lock<FairSharedMutex> shared(structure);
+        ShardLocks locks(*this, 0, false);
+        locks.lockGroups(groupShard(groupName), false);
+        MemberRange range;
+        Status status = engine.groupMembers(groupName, range);
+        for (MemberRange::iterator it = range.begin(); it != range.end(); ++it) out.push_back(*it);
+        return status;
+    }
+
+    Status commitLog() {
+        shared_lock<FairSharedMutex> shared(structure);
+        return engine.commitLog();
+    }
+    Status saveSnapshot(const string& path) {
+        unique_lock<FairSharedMutex> all(structure);
+        return engine.saveSnapshot(path);
+    }
+    Status compactStore() {
+        unique_lock<FairSharedMutex> all(structure);
+        return engine.compactStore();
+    }
+};
+
+// Console frontend over the Profile API: prompts, wording and all output
+// live here, so the engine can be driven from other code without cout.
+class ProfileConsole {
+    Profile& profile;
+
+    static void printLogFailure() { cout << "The data log cannot be written; nothing was changed.\n"; }
+
+public:
+    ProfileConsole(Profile& p) : profile(p) {}
+
+    void makeProfile() {
+        string name, id;
+        cout << "Enter your name: "; getline(cin, name);
+        if(name.empty()){ cout << "Name cannot be empty.\n"; return; }
+
+        cout << "Enter your id/Number: "; getline(cin, id);
+        if(id.empty()){ cout << "ID cannot be empty.\n"; return; }
+
+        string values[ATTR_COUNT];
+        cout << "Enter your city: "; getline(cin, values[ATTR_CITY]);
+        cout << "Enter your interests: "; getline(cin, values[ATTR_INTEREST]);
+        cout << "Enter Your institution: "; getline(cin, values[ATTR_INSTITUTION]);
+
+        createProfile(name, id, values);
+    }
+
+    void createProfile(const string& name, const string& id, const string values[ATTR_COUNT]) {
+        switch (profile.createProfile(name, id, values)) {
+            case STATUS_OK: cout << "Profile created successfully!\n"; break;
+            case STATUS_EMPTY_FIELD: cout << "Name and ID cannot be empty.\n"; break;
+            case STATUS_IO_ERROR: printLogFailure(); break;
+            default: cout << "User with this ID already exists!\n";
+        }
+    }
+
+    void sendFriendRequest(const string& senderId, const string& receiverId) {
+        ResolvedUsers users;
+        switch (profile.sendFriendRequest(senderId, receiverId, &users)) {
+            case STATUS_OK:
+                cout << "Friend request sent from " << users.first->name << " to " << users.second->name << ".\n";
+                break;
+            case STATUS_SELF: cout << "You cannot send a friend request to yourself.\n"; break;
+            case STATUS_ALREADY_FRIENDS: cout << "You are already friends.\n"; break;
+            case STATUS_REQUEST_PENDING: cout << "A friend request is already pending between you two.\n"; break;
+            case STATUS_IO_ERROR: printLogFailure(); break;
+            default: cout << "Invalid user IDs. Friend request not sent.\n";
+        }
+    }
+
+    void sendFriendRequestsToUsers(const string& senderId, const vector<string>& receiverIds) {
+        FriendRequestBatchResult result;
+        Status status = profile.sendFriendRequests(senderId, receiverIds, result);
+        if (status != STATUS_OK) {
+            if (status == STATUS_IO_ERROR) printLogFailure();
+            else cout << "Invalid sender ID.\n";
+            return;
+        }
+        printBatchResult(result);
+    }
+
+    void acceptFriendRequest(const string& userId, const string& senderId) {
+        ResolvedUsers users;
+        switch (profile.acceptFriendRequest(userId, senderId, &users)) {
+            case STATUS_OK: cout << users.second->name << " and " << users.first->name << " are now friends.\n"; break;
+            case STATUS_NO_REQUEST: cout << "No pending friend request from " << users.second->name << ".\n"; break;
+            case STATUS_IO_ERROR: printLogFailure(); break;
+            default: cout << "Invalid user IDs. Friend request not accepted.\n";
+        }
+    }
+
+    void sendMessage(const string& senderId, const string& receiverId, const string& message) {
+        ResolvedUsers users;
+        switch (profile.sendMessage(senderId, receiverId, message, &users)) {
+            case STATUS_OK: cout << "Message sent from " << users.first->name << " to " << users.second->name << ".\n"; break;
+            case STATUS_NOT_FRIENDS: cout << "You are not friends. Add as friends first before messaging.\n"; break;
+            case STATUS_IO_ERROR: printLogFailure(); break;
+            default: cout << "Invalid user IDs. Message not sent.\n";
+        }
+    }
+
+    void readMessages(const string& userId, size_t limit = 20) {
+        MessagePage page;
+        ResolvedUsers users;
+        Status status = profile.readMessages(userId, limit, page, &users);
+        if (status != STATUS_OK) {
+            if (status == STATUS_IO_ERROR) printLogFailure();
+            else cout << "Invalid user ID.\n";
+            return;
+        }
+        cout << "Messages for user " << users.first->name << " (" << page.unread << " unread):\n";
+        for (size_t i = 0; i < page.messages.size(); i++) printMessage(page.messages[i]);
+        if (page.messages.empty()) cout << "No messages.\n";
+        else if (page.total > page.messages.size())
+            cout << "Showing the latest " << page.messages.size() << " of " << page.total << " messages.\n";
+    }
+
+    void readMessages(const string& userId, uint64_t afterSeq, size_t limit) {
+        MessagePage page;
+        ResolvedUsers users;
+        Status status = profile.readMessages(userId, afterSeq, limit, page, &users);
+        if (status != STATUS_OK) {
+            if (status == STATUS_IO_ERROR) printLogFailure();
+            else cout << "Invalid user ID.\n";
+            return;
+        }
+        cout << "Messages for user " << users.first->name << " after #" << afterSeq << ":\n";
+        for (size_t i = 0; i < page.messages.size(); i++) printMessage(page.messages[i]);
+        if (page.messages.empty()) cout << "No messages.\n";
+        else cout << "Next page: after #" << page.messages.back().msg->seq << "\n";
+    }
+
+    void searchMessages(const string& userId, const string& query, size_t limit = 20) {
+        MessagePage page;
+        ResolvedUsers users;
+        switch (profile.searchMessages(userId, query, limit, page, &users)) {
+            case STATUS_OK: break;
+            case STATUS_UNKNOWN_USER: cout << "Invalid user ID.\n"; return;
+            default: cout << "Enter at least one word to search for.\n"; return;
+        }
+        cout << "Messages for user " << users.first->name << " matching \"" << query << "\":\n";
+        for (size_t i = 0; i < page.messages.size(); i++) printMessage(page.messages[i]);
+        if (page.messages.empty()) cout << "No matching messages.\n";
+        else if (page.total > page.messages.size())
+            cout << "Showing the latest " << page.messages.size() << " of " << page.total << " matches.\n";
+    }
+
+    void createGroup(const string& groupName) {
+        Status status = profile.createGroup(groupName);
+        if (status != STATUS_OK) {
+            if (status == STATUS_IO_ERROR) printLogFailure();
+            else cout << "Group already exists!\n";
+            return;
+        }
+        cout << "Group " << groupName << " created.\n";
+    }
+
+    void joinGroup(const string& userId, const string& groupName) {
+        ResolvedUsers users;
+        switch (profile.joinGroup(userId, groupName, &users)) {
+            case STATUS_OK: cout << users.first->name << " joined the group " << groupName << ".\n"; break;
+            case STATUS_UNKNOWN_USER: cout << "Invalid user ID. Cannot join the group.\n"; break;
+            case STATUS_UNKNOWN_GROUP: cout << "Group not found. Create the group first.\n"; break;
+            case STATUS_IO_ERROR: printLogFailure(); break;
+            default: cout << "User already in group.\n";
+        }
+    }
+
+    void leaveGroup(const string& userId, const string& groupName) {
+        ResolvedUsers users;
+        switch (profile.leaveGroup(userId, groupName, &users)) {
+            case STATUS_OK: cout << users.first->name << " left the group " << groupName << ".\n"; break;
+            case STATUS_NOT_MEMBER: cout << "User is not in this group.\n"; break;
+            case STATUS_IO_ERROR: printLogFailure(); break;
+            default: cout << "Invalid user ID or group name.\n";
+        }
+    }
+
+    void listUserGroups(const string& userId) {
+        GroupRange groups;
+        ResolvedUsers users;
+        if (profile.groupsOf(userId, groups, &users) != STATUS_OK) {
+            cout << "Invalid user ID.\n";
+            return;
+        }
+        cout << "Groups of " << users.first->name << ":\n";
+        for (GroupRange::iterator g = groups.begin(); g != groups.end(); ++g)
+            cout << (*g)->groupName << " (" << (*g)->members.size() << " members)\n";
+        if (groups.empty()) cout << "No groups.\n";
+    }
+
+    void listGroupMembers(const string& groupName) {
+        MemberRange members;
+        if (profile.groupMembers(groupName, members) != STATUS_OK) {
+            cout << "Group not found.\n";
+            return;
+        }
+        cout << "Members of the group " << groupName << ":\n";
+        if (members.empty()) cout << "No members.\n";
+        for (MemberRange::iterator m = members.begin(); m != members.end(); ++m)
+            cout << (*m)->name << " (" << (*m)->id << ")\n";
+    }
+
+    void showMutualFriends(const string& user1Id, const string& user2Id) {
+        vector<UserNode*> common;
+        ResolvedUsers users;
+        if (profile.mutualFriends(user1Id, user2Id, common, &users) != STATUS_OK) {
+            cout << "Invalid user IDs.\n";
+            return;
+        }
+        cout << "Mutual friends between " << users.first->name << " and " << users.second->name << ":\n";
+        for (size_t i = 0; i < common.size(); i++)
+            cout << common[i]->name << " (" << common[i]->id << ")\n";
+        if (common.empty()) cout << "No mutual friends.\n";
+    }
+
+    void showConnection(const string& fromId, const string& toId, size_t maxHops = 6) {
+        vector<UserNode*> path;
+        ResolvedUsers users;
+        Status status = profile.connectionPath(fromId, toId, maxHops, path, &users);
+        if (status == STATUS_UNKNOWN_USER) {
+            cout << "Invalid user IDs.\n";
+            return;
+        }
+        if (status == STATUS_SELF) {
+            cout << "Both IDs name the same user.\n";
+            return;
+        }
+        UserNode* from = users.first;
+        UserNode* to = users.second;
+        if (status == STATUS_NO_PATH) {
+            cout << from->name << " and " << to->name << " are not connected within " << maxHops << " hops.\n";
+            return;
+        }
+        size_t hops = path.size() - 1;
+        cout << "Connection from " << from->name << " to " << to->name << " (" << hops
+             << (hops == 1 ? " hop" : " hops") << "):\n";
+        for (size_t i = 0; i < path.size(); i++)
+            cout << (i ? " -> " : "") << path[i]->name << " (" << path[i]->id << ")";
+        cout << "\n";
+    }
+
+    void suggestFriends(const string& userId, size_t limit = 10) {
+        vector<Suggestion> top;
+        ResolvedUsers users;
+        if (profile.suggestFriends(userId, limit, top, &users) != STATUS_OK) {
+            cout << "Invalid user ID.\n";
+            return;
+        }
+        cout << "Friend suggestions for " << users.first->name << ":\n";
+        for (size_t i = 0; i < top.size(); i++) {
+            string reason = "";
+            if (top[i].mutualFriends) reason += "[" + to_string(top[i].mutualFriends) + " Mutual Friends] ";
+            if (top[i].attributeMask & (1 << ATTR_CITY)) reason += "[Same City] ";
+            if (top[i].attributeMask & (1 << ATTR_INTEREST)) reason += "[Same Interest] ";
+            if (top[i].attributeMask & (1 << ATTR_INSTITUTION)) reason += "[Same Institution]";
+            cout << "Name: " << top[i].user->name << ", ID: " << top[i].user->id << " - Reason: " << reason << "\n";
+        }
+        if (top.empty()) cout << "No suggestions.\n";
+    }
+
+    void findUsersByAttribute(const vector<AttributeTerm>& terms, bool matchAll) {
+        vector<UserNode*> matches;
+        if (profile.findUsersByAttribute(terms, matchAll, matches) != STATUS_OK) {
+            cout << "Enter at least one attribute to search by.\n";
+            return;
+        }
+        cout << "Users matching " << (matchAll ? "all" : "any") << " of the given attributes:\n";
+        printUsers(matches);
+        if (matches.empty()) cout << "No users found.\n";
+    }
+
+    // searcherId may be empty, for results without friend ranking
+    void searchUsersByName(const string& searcherId, const string& query, size_t limit = 10) {
+        vector<NameMatch> matches;
+        switch (profile.searchUsersByName(searcherId, query, limit, matches)) {
+            case STATUS_OK: break;
+            case STATUS_UNKNOWN_USER: cout << "Invalid user ID.\n"; return;
+            default: cout << "Enter a name or the beginning of one.\n"; return;
+        }
+        cout << "Users named like \"" << query << "\":\n";
+        for (size_t i = 0; i < matches.size(); i++) {
+            const NameMatch& m = matches[i];
+            cout << m.user->name << " (" << m.user->id << ")";
+            if (m.isFriend) cout << " - friend";
+            else if (m.mutualFriends) cout << " - " << m.mutualFriends << " mutual friend" << (m.mutualFriends == 1 ? "" : "s");
+            if (m.edits) cout << " [close match]";
+            cout << "\n";
+        }
+        if (matches.empty()) cout << "No users found.\n";
+    }
+
+    void sendFriendRequestToGroup(const string& userId, const string& groupName) {
+        FriendRequestBatchResult result;
+        Status status = profile.sendFriendRequestToGroup(userId, groupName, result);
+        if (status != STATUS_OK) {
+            if (status == STATUS_IO_ERROR) printLogFailure();
+            else cout << "Invalid user ID or group name.\n";
+            return;
+        }
+        if (result.sent == 0) cout << "No new friend requests sent.\n";
+        else printBatchResult(result);
+    }
+
+    void listAllUsers() {
+        cout << "All users:\n";
+        vector<UserNode*> all;
+        profile.allUsers(all);
+        printUsers(all);
+    }
+
+    void listFriends(const string& userId) {
+        FriendRange friends;
+        ResolvedUsers users;
+        if (profile.friendsOf(userId, friends, &users) != STATUS_OK) {
+            cout << "Invalid user ID.\n";
+            return;
+        }
+        printFriends(users.first, friends);
+    }
+
+    void listPendingRequests(const string& userId) {
+        FriendRange requests;
+        ResolvedUsers users;
+        if (profile.pendingRequestsOf(userId, requests, &users) != STATUS_OK) {
+            cout << "Invalid user ID.\n";
+            return;
+        }
+        cout << "Pending friend requests for " << users.first->name << ":\n";
+        for (FriendRange::iterator r = requests.begin(); r != requests.end(); ++r)
+            cout << (*r)->name << " (" << (*r)->id << ")\n";
+        if (requests.empty()) cout << "No pending requests.\n";
+    }
+
+    void editProfile(const string& userId) {
+        UserNode* user = profile.findUser(userId);
+        if (!user) {
+            cout << "Invalid user ID.\n";
+            return;
+        }
+
+        int choice;
+        string input;
+        while (true) {
+            cout << "\nEdit Profile for " << user->name << ":\n";
+            cout << "1. Edit Name\n";
+            cout << "2. Edit City\n";
+            cout << "3. Edit Interests\n";
+            cout << "4. Edit Institution\n";
+            cout << "0. Back to Main Menu\n";
+            cout << "Enter your choice: ";
+            cin >> choice;
+            if (!cin) {
+                cout << "Invalid input.\n";
+                cin.clear();
+                cin.ignore(10000, '\n');
+                continue;
+            }
+            cin.ignore();
+
+            if (choice == 0) break;
+
+            cout << "Enter new value: ";
+            getline(cin, input);
+            editProfileField(userId, choice, input);
+        }
+    }
+
+    // Non-interactive edit; field numbers are the Edit Profile menu entries
+    void editProfileField(const string& userId, int field, const string& value) {
+        static const char* updated[] = { "", "Name updated.\n", "City updated.\n", "Interests updated.\n", "Institution updated.\n" };
+        switch (profile.editProfileField(userId, (ProfileField)field, value)) {
+            case STATUS_OK: cout << updated[field]; break;
+            case STATUS_UNKNOWN_USER: cout << "Invalid user ID.\n"; break;
+            case STATUS_EMPTY_FIELD: cout << "Input cannot be empty.\n"; break;
+            case STATUS_IO_ERROR: printLogFailure(); break;
+            default: cout << "Invalid choice.\n";
+        }
+    }
+
+    void deleteFriend(const string& userId, const string& friendId) {
+        ResolvedUsers users;
+        switch (profile.deleteFriend(userId, friendId, &users)) {
+            case STATUS_OK: cout << "You are no longer friends with " << users.second->name << ".\n"; break;
+            case STATUS_SELF: cout << "You cannot unfriend yourself.\n"; break;
+            case STATUS_NOT_FRIENDS: cout << "You are not friends with this user.\n"; break;
+            case STATUS_IO_ERROR: printLogFailure(); break;
+            default: cout << "Invalid user ID(s).\n";
+        }
+    }
+
+    void rejectFriendRequest(const string& userId, const string& senderId) {
+        ResolvedUsers users;
+        switch (profile.rejectFriendRequest(userId, senderId, &users)) {
+            case STATUS_OK: cout << "Friend request from " << users.second->name << " rejected.\n"; break;
+            case STATUS_NO_REQUEST: cout << "No pending request from " << users.second->name << " found.\n"; break;
+            case STATUS_IO_ERROR: printLogFailure(); break;
+            default: cout << "Invalid user IDs.\n";
+        }
+    }
+
+    void sendGroupMessage(const string& senderId, const string& groupName, const string& message) {
+        size_t recipients = 0;
+        switch (profile.sendGroupMessage(senderId, groupName, message, &recipients)) {
+            case STATUS_OK: cout << "Message sent to " << recipients << " members of group " << groupName << ".\n"; break;
+            case STATUS_UNKNOWN_USER: cout << "Invalid sender ID.\n"; break;
+            case STATUS_UNKNOWN_GROUP: cout << "Group not found.\n"; break;
+            case STATUS_IO_ERROR: printLogFailure(); break;
+            default: cout << "You are not a member of this group.\n";
+        }
+    }
+
+    void viewUserProfile(const string& userId) {
+        UserNode* user = profile.findUser(userId);
+        if (!user) {
+            cout << "User not found.\n";
+            return;
+        }
+        cout << "\n--- User Profile ---\n";
+        cout << "Name: " << user->name << "\n";
+        cout << "ID: " << user->id << "\n";
+        cout << "City: " << profile.attribute(user, ATTR_CITY) << "\n";
+        cout << "Interests: " << profile.attribute(user, ATTR_INTEREST) << "\n";
+        cout << "Institution: " << profile.attribute(user, ATTR_INSTITUTION) << "\n";
+        cout << "--------------------\n";
+        printFriends(user, FriendRange(user->friends.first()));
+        cout << "--------------------\n";
+    }
+
+    void memoryReport() {
+        MemoryUsage m;
+        profile.memoryUsage(m);
+        cout << "Memory usage for " << m.users << " users:\n";
+        if (m.users == 0) {
+            cout << "No users.\n";
+            return;
+        }
+        cout << fixed << setprecision(1);
+        cout << "Distinct attribute values: " << m.distinctValues << "\n";
+        cout << "Attribute fields, 3 x std::string: " << m.legacyAttributeBytes << " bytes/user\n";
+        cout << "Attribute fields, 3 x handle + pool: " << m.compactAttributeBytes << " bytes/user\n";
+        cout << "Profile fields before (5 strings): " << m.legacyProfileBytes << " bytes/user\n";
+        cout << "Profile fields now (2 strings + handles): " << m.compactProfileBytes << " bytes/user\n";
+        cout << "Saved: " << (1.0 - m.compactProfileBytes / m.legacyProfileBytes) * 100.0 << "%\n";
+        cout.unsetf(ios::floatfield);
+    }
+
+    void showMetrics(bool json) {
+        MetricGauges gauges;
+        profile.metricGauges(gauges);
+        if (json) writeMetricsJson(cout, profile.operationMetrics(), gauges);
+        else writeMetricsText(cout, profile.operationMetrics(), gauges);
+    }
+
+    void networkStats() {
+        WorkStealingPool pool;
+        GraphReport r;
+        profile.analyzeGraph(pool, r);
+        cout << "Network statistics for " << r.users << " users:\n";
+        if (r.users == 0) {
+            cout << "No users.\n";
+            return;
+        }
+        cout << fixed << setprecision(3);
+        cout << "Friendships: " << r.friendships << "\n";
+        cout << "Connected components: " << r.components << " (largest " << r.largestComponent
+             << " users, " << r.isolatedUsers << " without friends)\n";
+        cout << "Friends per user: min " << r.minDegree << ", median " << r.medianDegree << ", mean "
+             << r.meanDegree << ", max " << r.maxDegree << "\n";
+        for (size_t b = 0; b < r.degreeBuckets.size(); b++) {
+            if (!r.degreeBuckets[b]) continue;
+            if (b == 0) cout << "  0 friends: ";
+            else if (b == 1) cout << "  1 friend: ";
+            else cout << "  " << (1u << (b - 1)) << "-" << (1u << b) - 1 << " friends: ";
+            cout << r.degreeBuckets[b] << (r.degreeBuckets[b] == 1 ? " user\n" : " users\n");
+        }
+        cout << "Triangles: " << r.triangles << "\n";
+        cout << "Average clustering coefficient: " << r.averageClustering << "\n";
+        cout << "Transitivity: " << r.transitivity << "\n";
+        cout << "Innermost k-core: k = " << r.maxCore << ", " << r.maxCoreSize << " users\n";
+        cout << "Computed on " << pool.size() << (pool.size() == 1 ? " thread" : " threads") << " in "
+             << r.seconds[0] + r.seconds[1] + r.seconds[2] + r.seconds[3] << " s\n";
+        cout.unsetf(ios::floatfield);
+    }
+
+    bool saveSnapshot(const string& path) {
+        if (profile.saveSnapshot(path) != STATUS_OK) {
+            cout << "Failed to write snapshot " << path << ".\n";
+            return false;
+        }
+        cout << "Snapshot saved: " << profile.userCount() << " users, " << profile.groupCount() << " groups.\n";
+        return true;
+    }
+
+    bool loadSnapshot(const string& path) {
+        Status status = profile.loadSnapshot(path);
+        switch (status) {
+            case STATUS_OK:
+                cout << "Snapshot loaded: " << profile.userCount() << " users, " << profile.groupCount() << " groups.\n";
+                if (profile.storeOpen()) cout << "Log compacted into " << profile.storeName() << ".snap.\n";
+                return true;
+            case STATUS_NOT_EMPTY: cout << "Snapshots can only be loaded into an empty network.\n"; break;
+            case STATUS_IO_ERROR: cout << "Cannot open snapshot " << path << ".\n"; break;
+            case STATUS_CORRUPT: cout << "Snapshot " << path << " is corrupt or from an incompatible version.\n"; break;
+            default: cout << "Snapshot loaded, but compacting the data store failed: " << statusText(status) << ".\n";
+        }
+        return false;
+    }
+
+    bool openStore(const string& prefix) {
+        StoreInfo info;
+        switch (profile.openStore(prefix, info)) {
+            case STATUS_OK:
+                cout << "Data store " << prefix << ": " << profile.userCount() << " users, " << profile.groupCount()
+                     << " groups, " << info.replayed << " log records replayed.\n";
+                if (info.discardedBytes)
+                    cout << "Discarded " << info.discardedBytes << " bytes of incomplete log records.\n";
+                return true;
+            case STATUS_STORE_OPEN: cout << "A data store is already open.\n"; break;
+            case STATUS_NOT_EMPTY: cout << "A data store can only be opened on an empty network.\n"; break;
+            case STATUS_LOG_MISMATCH:
+                cout << "Log record #" << info.failedRecord << " in " << prefix << ".wal does not apply; store not opened.\n";
+                break;
+            case STATUS_CORRUPT: cout << "Data store " << prefix << " is corrupt or from an incompatible version.\n"; break;
+            default: cout << "Cannot open data store " << prefix << ".\n";
+        }
+        return false;
+    }
+
+    void compactStore() {
+        switch (profile.compactStore()) {
+            case STATUS_OK: cout << "Log compacted into " << profile.storeName() << ".snap.\n"; break;
+            case STATUS_NO_STORE: cout << "No data store is open.\n"; break;
+            default: cout << "Compacting " << profile.storeName() << " failed.\n";
+        }
+    }
+
+    void commitLog() {
+        if (profile.commitLog() != STATUS_OK) cout << "Warning: writing the data log failed.\n";
+    }
+
+private:
+    void printUsers(const vector<UserNode*>& list) {
+        for (size_t i = 0; i < list.size(); i++)
+            cout << list[i]->name << " (" << list[i]->id << ")\n";
+    }
+    void printFriends(const UserNode* user, FriendRange friends) {
+        cout << "Friends of " << user->name << ":\n";
+        for (FriendRange::iterator f = friends.begin(); f != friends.end(); ++f)
+            cout << (*f)->name << " (" << (*f)->id << ")\n";
+        if (friends.empty()) cout << "No friends.\n";
+    }
+    void printMessage(const MessageRef& ref) {
+        cout << "#" << ref.msg->seq << (ref.unread ? " (new)" : "")
+             << " From: " << ref.msg->sender->name << " (" << ref.msg->sender->id << ")";
+        if (ref.group) cout << " in group " << ref.group->groupName;
+        cout << " - Message: " << ref.msg->text << "\n";
+    }
+    void printBatchResult(const FriendRequestBatchResult& r) {
+        cout << "Friend requests sent: " << r.sent << "\n";
+        if (r.alreadyFriends) cout << "Already friends: " << r.alreadyFriends << "\n";
+        if (r.alreadyPending) cout << "Already pending: " << r.alreadyPending << "\n";
+        if (r.duplicates) cout << "Duplicate targets: " << r.duplicates << "\n";
+        if (r.self) cout << "Skipped yourself: " << r.self << "\n";
+        if (r.unknown) cout << "Unknown IDs: " << r.unknown << "\n";
+    }
+};
+
+// Random sorted friend-index array of the given degree drawn from [0, universe)
+static void randomFriendRow(mt19937& rng, uint32_t degree, uint32_t universe, vector<uint32_t>& out) {
+    out.clear();
+    uniform_int_distribution<uint32_t> pick(0, universe - 1);
+    while (out.size() < degree) {
+        while (out.size() < degree) out.push_back(pick(rng));
+        sort(out.begin(), out.end());
+        out.erase(unique(out.begin(), out.end()), out.end());
+    }
+}
+
+// Mutual-friend microbenchmark: the old nested FriendNode loop against the
+// sorted-array kernels, over several degree distributions.
+int runMutualFriendsBenchmark() {
+    struct Case { const char* name; uint32_t degA, degB; int pairs; bool powerLaw; };
+    const Case cases[] = {
+        { "uniform-16",      16,    16,    20000, false },
+        { "uniform-256",     256,   256,   2000,  false },
+        { "uniform-4096",    4096,  4096,  40,    false },
+        { "skewed-32x32768", 32,    32768, 200,   false },
+        { "power-law",       0,     0,     2000,  true  },
+    };
+    const uint32_t universe = 1 << 17;
+    mt19937 rng(42);
+
+    cout << "Mutual friends microbenchmark (auto kernel: " << intersectKernelName() << ")\n";
+    cout << left << setw(18) << "case" << right << setw(12) << "nested ns" << setw(12) << "merge ns"
+         << setw(12) << "gallop ns" << setw(12) << "simd ns" << setw(12) << "auto ns"
+         << setw(12) << "count ns" << setw(10) << "speedup" << "\n";
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        const Case& tc = cases[c];
+        vector<vector<uint32_t> > rowsA(tc.pairs), rowsB(tc.pairs);
+        for (int p = 0; p < tc.pairs; p++) {
+            uint32_t da = tc.degA, db = tc.degB;
+            if (tc.powerLaw) { // Pareto degrees, alpha ~ 1.5, capped at 8192
+                uniform_real_distribution<double> unit(0.0, 1.0);
+                da = (uint32_t)min(8192.0, 4.0 / pow(1.0 - unit(rng), 1.0 / 1.5));
+                db = (uint32_t)min(8192.0, 4.0 / pow(1.0 - unit(rng), 1.0 / 1.5));
+            }
+            randomFriendRow(rng, da, universe, rowsA[p]);
+            randomFriendRow(rng, db, universe, rowsB[p]);
+        }
+
+        // Same data as FriendNode lists for the legacy nested loop
+        vector<UserNode*> fakeUsers(universe);
+        for (uint32_t i = 0; i < universe; i++) fakeUsers[i] = (UserNode*)(uintptr_t)((i + 1) * 64);
+        vector<FriendNode*> listA(tc.pairs), listB(tc.pairs);
+        for (int p = 0; p < tc.pairs; p++) {
+            listA[p] = listB[p] = NULL;
+            for (size_t i = 0; i < rowsA[p].size(); i++) {
+                FriendNode* f = new FriendNode;
+                f->user = fakeUsers[rowsA[p][i]]; f->next = listA[p]; listA[p] = f;
+            }
+            for (size_t i = 0; i < rowsB[p].size(); i++) {
+                FriendNode* f = new FriendNode;
+                f->user = fakeUsers[rowsB[p][i]]; f->next = listB[p]; listB[p] = f;
+            }
+        }
+
+        vector<uint32_t> out(8192 + 32768);
+        size_t expected = 0, got[6] = { 0, 0, 0, 0, 0, 0 };
+        double ns[6];
+        uint64_t t0 = nowNanos();
+        for (int p = 0; p < tc.pairs; p++)
+            for (FriendNode* f1 = listA[p]; f1; f1 = f1->next)
+                for (FriendNode* f2 = listB[p]; f2; f2 = f2->next)
+                    if (f1->user == f2->user) expected++;
+        ns[0] = (double)(nowNanos() - t0) / tc.pairs;
+        got[0] = expected;
+
+        IntersectFn kernels[4] = { intersectMerge, intersectGalloping, selectIntersectKernel(), intersectSorted };
+        for (int k = 0; k < 4; k++) {
+            t0 = nowNanos();
+            for (int p = 0; p < tc.pairs; p++) {
+                const vector<uint32_t>* a = &rowsA[p];
+                const vector<uint32_t>* b = &rowsB[p];
+                if (k == 1 && a->size() > b->size()) swap(a, b); // galloping wants the small side first
+                got[k + 1] += kernels[k](a->data(), a->size(), b->data(), b->size(), out.data());
+            }
+            ns[k + 1] = (double)(nowNanos() - t0) / tc.pairs;
+        }
+        t0 = nowNanos();
+        for (int p = 0; p < tc.pairs; p++)
+            got[5] += intersectSorted(rowsA[p].data(), rowsA[p].size(), rowsB[p].data(), rowsB[p].size(), NULL);
+        ns[5] = (double)(nowNanos() - t0) / tc.pairs;
+
+        cout << left << setw(18) << tc.name << right << fixed << setprecision(0);
+        for (int k = 0; k < 6; k++) cout << setw(12) << ns[k];
+        cout << setw(9) << setprecision(1) << ns[0] / max(ns[4], 1.0) << "x";
+        for (int k = 1; k < 6; k++)
+            if (got[k] != expected) cout << "  MISMATCH(" << k << ")";
+        cout << "\n";
+
+        for (int p = 0; p < tc.pairs; p++) {
+            while (listA[p]) { FriendNode* t = listA[p]; listA[p] = t->next; delete t; }
+            while (listB[p]) { FriendNode* t = listB[p]; listB[p] = t->next; delete t; }
+        }
+    }
+    return 0;
+}
+
+// Swallows everything written to cout while a QuietOutput is alive
+class NullBuffer : public streambuf {
+protected:
+    int overflow(int c) { return c; }
+    streamsize xsputn(const char*, streamsize n) { return n; }
+};
+
+class QuietOutput {
+    NullBuffer sink;
+    streambuf* saved;
+
+public:
+    QuietOutput(bool enabled = true) : saved(enabled ? cout.rdbuf(&sink) : NULL) {}
+    ~QuietOutput() { if (saved) cout.rdbuf(saved); }
+};
+
+// Mutation mix for the log benchmark: profiles, then friend requests and
+// acceptances to the next four users around a ring, then a message along
+// every friendship
+static uint64_t runWalWorkload(Profile& profile, uint32_t userCount, bool commitEach) {
+    const string values[ATTR_COUNT] = { "Lahore", "chess", "FAST" };
+    vector<string> ids(userCount);
+    for (uint32_t u = 0; u < userCount; u++) ids[u] = "u" + to_string(u);
+    uint64_t ops = 0;
+    for (int phase = 0; phase < 4; phase++) {
+        for (uint32_t u = 0; u < userCount; u++) {
+            for (uint32_t d = 1; d <= (phase == 0 ? 1u : 4u); d++) {
+                const string& other = ids[(u + d) % userCount];
+                if (phase == 0) profile.createProfile(ids[u], ids[u], values);
+                else if (phase == 1) profile.sendFriendRequest(ids[u], other);
+                else if (phase == 2) profile.acceptFriendRequest(other, ids[u]);
+                else profile.sendMessage(ids[u], other, "hello from " + ids[u]);
+                if (commitEach) profile.commitLog();
+                ops++;
+            }
+        }
+    }
+    profile.commitLog();
+    return ops;
+}
+
+int runWalBenchmark() {
+    struct Case { const char* name; uint32_t users; bool durable, commitEach; };
+    const Case cases[] = {
+        { "in-memory",      20000, false, false },
+        { "group commit",   20000, true,  false },
+        { "sync every op",  500,   true,  true  },
+    };
+    const string prefix = "wal-bench";
+    cout << "Write-ahead log benchmark (creates " << prefix << ".wal in the current directory)\n";
+    cout << left << setw(16) << "mode" << right << setw(10) << "ops" << setw(14) << "ops/s"
+         << setw(10) << "syncs" << setw(12) << "vs memory" << "\n";
+    double memoryRate = 0;
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        const Case& tc = cases[c];
+        remove((prefix + ".wal").c_str());
+        remove((prefix + ".snap").c_str());
+        Profile profile;
+        StoreInfo info;
+        if (tc.durable && profile.openStore(prefix, info) != STATUS_OK) {
+            cout << "Cannot open " << prefix << ".wal\n";
+            return 1;
+        }
+        uint64_t t0 = nowNanos();
+        uint64_t ops = runWalWorkload(profile, tc.users, tc.commitEach);
+        double rate = ops * 1e9 / max<uint64_t>(nowNanos() - t0, 1);
+        if (!tc.durable) memoryRate = rate;
+        cout << left << setw(16) << tc.name << right << setw(10) << ops << fixed << setprecision(0)
+             << setw(14) << rate << setw(10) << profile.logSyncs()
+             << setw(11) << setprecision(2) << memoryRate / rate << "x\n";
+    }
+    cout.unsetf(ios::floatfield);
+    remove((prefix + ".wal").c_str());
+    return 0;
+}
+
+// The old way to share a Profile between threads: one mutex around every
+// call. Same calls as ConcurrentProfile, as the benchmark's baseline.
+class SerializedProfile {
+    Profile& engine;
+    mutex lock;
+
+public:
+    SerializedProfile(Profile& p) : engine(p) {}
+
+    UserNode* findUser(const string& id) {
+        lock_guard<mutex> hold(lock);
+        return engine.findUser(id);
+    }
+    Status friendsOf(const string& userId, vector<UserNode*>& out) {
+        lock_guard<mutex> hold(lock);
+        out.clear();
+        FriendRange range;
+        Status status = engine.friendsOf(userId, range);
+        for (FriendRange::iterator it = range.begin(); it != range.end(); ++it) out.push_back(*it);
+        return status;
+    }
+    Status readMessages(const string& userId, size_t limit, MessagePage& page) {
+        lock_guard<mutex> hold(lock);
+        return engine.readMessages(userId, limit, page);
+    }
+    Status sendMessage(const string& senderId, const string& receiverId, const string& message) {
+        lock_guard<mutex> hold(lock);
+        return engine.sendMessage(senderId, receiverId, message);
+    }
+    Status sendGroupMessage(const string& senderId, const string& groupName, const string& message) {
+        lock_guard<mutex> hold(lock);
+        return engine.sendGroupMessage(senderId, groupName, message);
+    }
+    Status sendFriendRequest(const string& senderId, const string& receiverId) {
+        lock_guard<mutex> hold(lock);
+        return engine.sendFriendRequest(senderId, receiverId);
+    }
+    Status acceptFriendRequest(const string& userId, const string& senderId) {
+        lock_guard<mutex> hold(lock);
+        return engine.acceptFriendRequest(userId, senderId);
+    }
+    Status deleteFriend(const string& userId, const string& friendId) {
+        lock_guard<mutex> hold(lock);
+        return engine.deleteFriend(userId, friendId);
+    }
+};
+
+static const uint32_t CONCURRENT_GROUPS = 64;
+
+// Users around a ring, each a friend of the next four, each in one group
+static void buildConcurrentNetwork(Profile& profile, const vector<string>& ids, const vector<string>& groups) {
+    const string values[ATTR_COUNT] = { "Lahore", "chess", "FAST" };
+    uint32_t n = (uint32_t)ids.size();
+    for (uint32_t u = 0; u < n; u++) profile.createProfile(ids[u], ids[u], values);
+    for (uint32_t u = 0; u < n; u++) {
+        for (uint32_t d = 1; d <= 4; d++) {
+            profile.sendFriendRequest(ids[u], ids[(u + d) % n]);
+            profile.acceptFriendRequest(ids[(u + d) % n], ids[u]);
+        }
+    }
+    for (size_t g = 0; g < groups.size(); g++) profile.createGroup(groups[g]);
+    for (uint32_t u = 0; u < n; u++) profile.joinGroup(ids[u], groups[u % groups.size()]);
+}
+
+// One thread's share of a workload. Mixed: 70% reads (friend lists,
+// lookups, inbox pages), 30% writes (messages, posts, request/accept and
+// unfriend of pairs this thread made). Messaging: 85% private messages,
+// 10% group posts, 5% inbox pages.
+template <typename Api>
+static void concurrentWorker(Api& api, const vector<string>& ids, const vector<string>& groups, uint32_t seed, uint32_t ops, bool messaging) {
+    mt19937 rng(seed);
+    uint32_t n = (uint32_t)ids.size();
+    vector<UserNode*> users;
+    MessagePage page;
+    vector<pair<uint32_t, uint32_t> > requested, accepted;
+    for (uint32_t i = 0; i < ops; i++) {
+        uint32_t u = rng() % n, roll = rng() % 100;
+        if (messaging) {
+            if (roll < 85) api.sendMessage(ids[u], ids[(u + 1 + rng() % 4) % n], "hello");
+            else if (roll < 95) api.sendGroupMessage(ids[u], groups[u % groups.size()], "hi all");
+            else api.readMessages(ids[u], 10, page);
+        } else if (roll < 35) api.friendsOf(ids[u], users);
+        else if (roll < 50) api.findUser(ids[u]);
+        else if (roll < 70) api.readMessages(ids[u], 10, page);
+        else if (roll < 85) api.sendMessage(ids[u], ids[(u + 1) % n], "hello");
+        else if (roll < 90) api.sendGroupMessage(ids[u], groups[u % groups.size()], "hi all");
+        else if (roll < 95) {
+            uint32_t v = (u + 16 + rng() % (n - 32)) % n; // never a ring neighbour
+            if (api.sendFriendRequest(ids[u], ids[v]) == STATUS_OK) requested.push_back(make_pair(u, v));
+        } else if (!requested.empty()) {
+            pair<uint32_t, uint32_t> p = requested.back();
+            requested.pop_back();
+            if (api.acceptFriendRequest(ids[p.second], ids[p.first]) == STATUS_OK) accepted.push_back(p);
+        } else if (!accepted.empty()) {
+            api.deleteFriend(ids[accepted.back().first], ids[accepted.back().second]);
+            accepted.pop_back();
+        }
+    }
+}
+
+template <typename Api>
+static double runConcurrentRound(unsigned threads, uint32_t userCount, uint32_t opsPerThread, bool messaging) {
+    vector<string> ids(userCount), groups(CONCURRENT_GROUPS);
+    for (uint32_t u = 0; u < userCount; u++) ids[u] = "u" + to_string(u);
+    for (uint32_t g = 0; g < CONCURRENT_GROUPS; g++) groups[g] = "g" + to_string(g);
+    Profile profile(INDEX_HASH);
+    buildConcurrentNetwork(profile, ids, groups);
+    vector<thread> pool;
+    uint64_t t0 = nowNanos();
+    {
+        Api api(profile); // timed to the end of its scope, which drains queued messages
+        for (unsigned t = 0; t < threads; t++)
+            pool.push_back(thread(concurrentWorker<Api>, ref(api), cref(ids), cref(groups), 1000 + t, opsPerThread, messaging));
+        for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+    }
+    return (double)threads * opsPerThread * 1e9 / max<uint64_t>(nowNanos() - t0, 1);
+}
+
+// Throughput of each workload from one thread up to maxThreads (default:
+// one per core, and at least 4), doubling, behind a single mutex and behind
+// the sharded locks. scaling is against the sharded run on one thread.
+int runConcurrentBenchmark(unsigned maxThreads = 0) {
+    const uint32_t userCount = 100000, opsPerThread = 200000;
+    unsigned cores = max(thread::hardware_concurrency(), 1u);
+    if (maxThreads == 0) maxThreads = max(cores, 4u);
+    cout << "Concurrent benchmark: " << userCount << " users, " << opsPerThread << " ops per thread, "
+         << cores << " hardware thread" << (cores == 1 ? "" : "s") << "\n";
+    for (int messaging = 0; messaging < 2; messaging++) {
+        cout << (messaging ? "messaging" : "mixed") << "\n";
+        cout << right << setw(8) << "threads" << setw(16) << "one mutex/s" << setw(16) << "sharded/s"
+             << setw(10) << "speedup" << setw(10) << "scaling" << "\n";
+        double single = 0;
+        for (unsigned threads = 1;; threads = min(threads * 2, maxThreads)) {
+            double serialized = runConcurrentRound<SerializedProfile>(threads, userCount, opsPerThread, messaging);
+            double sharded = runConcurrentRound<ConcurrentProfile>(threads, userCount, opsPerThread, messaging);
+            if (threads == 1) single = sharded;
+            cout << setw(8) << threads << fixed << setprecision(0) << setw(16) << serialized << setw(16) << sharded
+                 << setprecision(2) << setw(9) << sharded / serialized << "x" << setw(9) << sharded / single << "x"
+                 << (threads > cores ? "  *" : "") << "\n";
+            cout.unsetf(ios::floatfield);
+            if (threads >= maxThreads) break;
+        }
+    }
+    if (maxThreads > cores)
+        cout << "* more threads than hardware threads: these rows measure lock overhead under preemption, not parallel speedup\n";
+    return 0;
+}
+
+// Plain breadth-first search from one end, the baseline for --bench-path;
+// returns the hop count or -1, and the number of users reached
+static int breadthFirstHops(const MutualFriendsEngine& graph, uint32_t from, uint32_t to, vector<uint32_t>& seen,
+                            uint32_t mark, vector<uint32_t>& queue, size_t& visited) {
+    queue.assign(1, from);
+    seen[from] = mark;
+    visited = 1;
+    for (size_t head = 0, levelEnd = 1, hops = 0; head < queue.size(); hops++, levelEnd = queue.size()) {
+        for (; head < levelEnd; head++) {
+            if (queue[head] == to) return (int)hops;
+            const vector<uint32_t>& row = graph.friendsOf(queue[head]);
+            for (size_t j = 0; j < row.size(); j++) {
+                if (seen[row[j]] == mark) continue;
+                seen[row[j]] = mark;
+                queue.push_back(row[j]);
+                visited++;
+            }
+        }
+    }
+    return -1;
+}
+
+static double percentile(vector<double>& sorted, double p) {
+    return sorted[min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+// Connection-path latency on a small-world network of a few million users:
+// ring lattice (two neighbours each side) plus five random friends each
+int runConnectionPathBenchmark() {
+    const uint32_t userCount = 2000000, queries = 2000, baselineQueries = 50;
+    mt19937 rng(20);
+    MutualFriendsEngine graph;
+    {
+        vector<vector<uint32_t> > rows(userCount);
+        for (uint32_t u = 0; u < userCount; u++) {
+            for (uint32_t d = 1; d <= 7; d++) {
+                uint32_t v = d <= 2 ? (u + d) % userCount : (uint32_t)(rng() % userCount);
+                if (v == u || find(rows[u].begin(), rows[u].end(), v) != rows[u].end()) continue;
+                rows[u].push_back(v);
+                rows[v].push_back(u);
+            }
+        }
+        for (uint32_t u = 0; u < userCount; u++) {
+            graph.addUser();
+            graph.setRow(u, rows[u].data(), rows[u].data() + rows[u].size());
+            vector<uint32_t>().swap(rows[u]);
+        }
+    }
+    cout << "Connection path benchmark: " << userCount << " users, " << queries << " random pairs, max 6 hops\n";
+
+    ConnectionSearch search;
+    vector<uint32_t> path;
+    vector<double> micros;
+    vector<uint32_t> hopCounts(8, 0);
+    uint64_t visited = 0;
+    for (uint32_t q = 0; q < queries; q++) {
+        uint32_t a = rng() % userCount, b = rng() % userCount;
+        uint64_t t0 = nowNanos();
+        bool found = search.find(graph, userCount, a, b, 6, path);
+        micros.push_back((nowNanos() - t0) / 1e3);
+        hopCounts[found ? path.size() - 1 : 7]++;
+        visited += search.visited();
+    }
+    sort(micros.begin(), micros.end());
+    cout << "Hops:";
+    for (size_t h = 0; h < 7; h++)
+        if (hopCounts[h]) cout << " " << h << ":" << hopCounts[h];
+    if (hopCounts[7]) cout << " over 6:" << hopCounts[7];
+    cout << "\n" << fixed << setprecision(1);
+    cout << "Bidirectional: p50 " << percentile(micros, 0.50) << " us, p99 " << percentile(micros, 0.99)
+         << " us, max " << micros.back() << " us, " << (double)visited / queries << " users reached per query\n";
+
+    vector<uint32_t> seen(userCount, 0), queue;
+    vector<double> baseline;
+    visited = 0;
+    for (uint32_t q = 0; q < baselineQueries; q++) {
+        uint32_t a = rng() % userCount, b = rng() % userCount;
+        size_t reached = 0;
+        uint64_t t0 = nowNanos();
+        breadthFirstHops(graph, a, b, seen, q + 1, queue, reached);
+        baseline.push_back((nowNanos() - t0) / 1e3);
+        visited += reached;
+    }
+    sort(baseline.begin(), baseline.end());
+    cout << "One-sided BFS (" << baselineQueries << " pairs): p50 " << percentile(baseline, 0.50) << " us, max "
+         << baseline.back() << " us, " << (double)visited / baselineQueries << " users reached per query\n";
+    cout.unsetf(ios::floatfield);
+    return 0;
+}
+
+// Ring lattice (three neighbours each side) plus three random friends per
+// user, one of them drawn towards low indices so a few hubs emerge
+static void buildAnalyticsNetwork(Profile& profile, uint32_t n) {
+    const string values[ATTR_COUNT] = { "Lahore", "chess", "FAST" };
+    vector<string> ids(n);
+    for (uint32_t u = 0; u < n; u++) {
+        ids[u] = "u" + to_string(u);
+        profile.createProfile(ids[u], ids[u], values);
+    }
+    mt19937 rng(19);
+    for (uint32_t u = 0; u < n; u++) {
+        uint32_t x = rng() % n;
+        uint32_t targets[6] = { (u + 1) % n, (u + 2) % n, (u + 3) % n, (uint32_t)rng() % n, (uint32_t)rng() % n,
+                                (uint32_t)((uint64_t)x * x / n) };
+        for (int i = 0; i < 6; i++) {
+            if (profile.sendFriendRequest(ids[u], ids[targets[i]]) == STATUS_OK)
+                profile.acceptFriendRequest(ids[targets[i]], ids[u]);
+        }
+    }
+}
+
+// Time of each analytics phase from one thread up to one per core; every
+// thread count must reproduce the single-threaded results
+int runAnalyticsBenchmark() {
+    const uint32_t userCount = 200000;
+    unsigned cores = max(thread::hardware_concurrency(), 1u);
+    Profile profile(INDEX_HASH);
+    buildAnalyticsNetwork(profile, userCount);
+    const FriendGraphSnapshot& graph = profile.friendGraph();
+    cout << "Analytics benchmark: " << graph.userCount() << " users, " << graph.edgeCount() / 2 << " friendships, "
+         << cores << " hardware thread" << (cores == 1 ? "" : "s") << "\n";
+    cout << right << setw(8) << "threads" << setw(13) << "components" << setw(10) << "degrees" << setw(12) << "triangles"
+         << setw(10) << "k-core" << setw(10) << "total" << setw(10) << "speedup" << "\n";
+    GraphReport first;
+    vector<uint32_t> firstCore;
+    double single = 0;
+    int mismatches = 0;
+    for (unsigned threads = 1;; threads = min(threads * 2, cores)) {
+        WorkStealingPool pool(threads);
+        GraphAnalytics analytics(graph, pool);
+        GraphReport r;
+        analytics.run(r);
+        double total = r.seconds[0] + r.seconds[1] + r.seconds[2] + r.seconds[3];
+        if (threads == 1) {
+            first = r;
+            firstCore = analytics.core;
+            single = total;
+        } else if (r.components != first.components || r.triangles != first.triangles || r.maxCore != first.maxCore
+                   || analytics.core != firstCore) {
+            mismatches++;
+        }
+        cout << setw(8) << threads << fixed << setprecision(3) << setw(12) << r.seconds[0] << "s" << setw(9)
+             << r.seconds[1] << "s" << setw(11) << r.seconds[2] << "s" << setw(9) << r.seconds[3] << "s" << setw(9)
+             << total << "s" << setprecision(2) << setw(9) << single / total << "x\n";
+        cout.unsetf(ios::floatfield);
+        if (threads >= cores) break;
+    }
+    cout << "Components " << first.components << ", triangles " << first.triangles << ", innermost core k = "
+         << first.maxCore << " (" << first.maxCoreSize << " users)\n";
+    if (mismatches) cout << "Results differ between thread counts!\n";
+    return mismatches ? 1 : 0;
+}
+
+// Benchmark suite: a synthetic network loaded through Profile, then timed
+// runs of the everyday operations. Reports throughput, latency percentiles
+// and peak RSS as a table or, with --json, one JSON object for scripts.
+
+// Ranks 0 .. n-1 with probability proportional to 1 / (rank + 1)^s
+class ZipfSampler {
+    vector<double> cdf;
+
+public:
+    ZipfSampler(uint32_t n, double s) : cdf(n) {
+        double total = 0;
+        for (uint32_t r = 0; r < n; r++) cdf[r] = total += 1.0 / pow(r + 1.0, s);
+        for (uint32_t r = 0; r < n; r++) cdf[r] /= total;
+    }
+    uint32_t operator()(mt19937& rng) const {
+        double x = uniform_real_distribution<double>(0.0, 1.0)(rng);
+        return (uint32_t)min<size_t>(upper_bound(cdf.begin(), cdf.end(), x) - cdf.begin(), cdf.size() - 1);
+    }
+};
+
+enum GraphModel { MODEL_BARABASI_ALBERT, MODEL_RMAT };
+
+// Barabasi-Albert preferential attachment: each new user befriends
+// perUser earlier users picked in proportion to their friend count
+// (a uniform pick from the list of every friendship endpoint so far).
+static void barabasiAlbertEdges(uint32_t n, uint32_t perUser, mt19937& rng, vector<pair<uint32_t, uint32_t> >& edges) {
+    vector<uint32_t> endpoints;
+    uint32_t seed = min(n, perUser + 1);
+    for (uint32_t u = 0; u < seed; u++) // small clique to start from
+        for (uint32_t v = 0; v < u; v++) {
+            edges.push_back(make_pair(v, u));
+            endpoints.push_back(u);
+            endpoints.push_back(v);
+        }
+    vector<uint32_t> picked;
+    for (uint32_t u = seed; u < n; u++) {
+        picked.clear();
+        while (picked.size() < perUser) {
+            uint32_t v = endpoints[rng() % endpoints.size()];
+            if (find(picked.begin(), picked.end(), v) == picked.end()) picked.push_back(v);
+        }
+        for (size_t i = 0; i < picked.size(); i++) {
+            edges.push_back(make_pair(picked[i], u));
+            endpoints.push_back(u);
+            endpoints.push_back(picked[i]);
+        }
+    }
+}
+
+// R-MAT: each friendship drops into one quadrant of the adjacency matrix
+// per level with probabilities 0.57 / 0.19 / 0.19 / 0.05, which yields a
+// skewed degree distribution and community structure. Self-loops and
+// repeats are dropped.
+static void rmatEdges(uint32_t n, uint64_t count, mt19937& rng, vector<pair<uint32_t, uint32_t> >& edges) {
+    uint32_t levels = 0;
+    while ((1ull << levels) < n) levels++;
+    uniform_real_distribution<double> unit(0.0, 1.0);
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t u = 0, v = 0;
+        for (uint32_t l = 0; l < levels; l++) {
+            double x = unit(rng);
+            u = u * 2 + (x >= 0.76);                           // c or d
+            v = v * 2 + (x >= 0.57 && x < 0.76) + (x >= 0.95); // b or d
+        }
+        u %= n;
+        v %= n;
+        if (u != v) edges.push_back(make_pair((uint32_t)min(u, v), (uint32_t)max(u, v)));
+    }
+    sort(edges.begin(), edges.end());
+    edges.erase(unique(edges.begin(), edges.end()), edges.end());
+    // R-MAT favours low indices; shuffle labels so hubs are spread over the ID space
+    vector<uint32_t> label(n);
+    for (uint32_t u = 0; u < n; u++) label[u] = u;
+    shuffle(label.begin(), label.end(), rng);
+    for (size_t i = 0; i < edges.size(); i++) edges[i] = make_pair(label[edges[i].first], label[edges[i].second]);
+    shuffle(edges.begin(), edges.end(), rng);
+}
+
+// Users, friendships and group memberships to load into a Profile
+struct SyntheticNetwork {
+    vector<string> ids, names;
+    vector<uint32_t> attributeRanks[ATTR_COUNT];
+    vector<pair<uint32_t, uint32_t> > friendships;
+    vector<vector<uint32_t> > groupMembers;
+    vector<string> groupNames;
+};
+
+static string syntheticAttribute(UserAttribute attr, uint32_t rank) {
+    static const char* prefixes[ATTR_COUNT] = { "City", "Interest", "Institution" };
+    return prefixes[attr] + to_string(rank);
+}
+
+// Word of the given frequency rank in the synthetic vocabulary, spelled in
+// base 26 so common words are short
+static string syntheticWord(uint32_t rank) {
+    string word;
+    do {
+        word.push_back((char)('a' + rank % 26));
+        rank /= 26;
+    } while (rank);
+    return word;
+}
+
+// Message text of 4 to 12 words drawn from a Zipf vocabulary, as in prose
+static string syntheticMessage(const ZipfSampler& words, mt19937& rng) {
+    string text;
+    uint32_t n = 4 + rng() % 9;
+    for (uint32_t i = 0; i < n; i++) {
+        if (i) text += ' ';
+        text += syntheticWord(words(rng));
+    }
+    return text;
+}
+
+// Attributes follow Zipf laws (a few big cities, popular interests and
+// large institutions); group sizes too, from a few big groups down to pairs.
+static void generateNetwork(uint32_t userCount, GraphModel model, uint32_t seed, SyntheticNetwork& net) {
+    static const char* first[] = { "Ali", "Sara", "Omar", "Ayesha", "Bilal", "Fatima", "Hamza", "Zainab", "Usman", "Maryam" };
+    static const char* last[] = { "Khan", "Ahmed", "Malik", "Butt", "Sheikh", "Qureshi", "Raza", "Iqbal" };
+    const uint32_t distinct[ATTR_COUNT] = { 300, 60, 2000 };
+    mt19937 rng(seed);
+    net.ids.resize(userCount);
+    net.names.resize(userCount);
+    for (uint32_t u = 0; u < userCount; u++) {
+        net.ids[u] = "user" + to_string(u);
+        net.names[u] = string(first[rng() % 10]) + " " + last[rng() % 8];
+    }
+    for (int a = 0; a < ATTR_COUNT; a++) {
+        ZipfSampler zipf(distinct[a], 1.0);
+        net.attributeRanks[a].resize(userCount);
+        for (uint32_t u = 0; u < userCount; u++) net.attributeRanks[a][u] = zipf(rng);
+    }
+
+    if (model == MODEL_BARABASI_ALBERT) barabasiAlbertEdges(userCount, 5, rng, net.friendships);
+    else rmatEdges(userCount, (uint64_t)userCount * 6, rng, net.friendships);
+
+    uint32_t groupCount = max(userCount / 200, 1u);
+    uint32_t largest = max(userCount / 20, 2u);
+    net.groupMembers.assign(groupCount, vector<uint32_t>());
+    net.groupNames.resize(groupCount);
+    for (uint32_t g = 0; g < groupCount; g++) {
+        net.groupNames[g] = "group" + to_string(g);
+        uint32_t size = max(2u, (uint32_t)(largest / (g + 1.0)));
+        for (uint32_t i = 0; i < size; i++) net.groupMembers[g].push_back(rng() % userCount);
+    }
+}
+
+// Per-call latencies of one operation
+struct OperationTiming {
+    string name;
+    vector<double> micros;
+    uint64_t failed; // calls that did not return STATUS_OK
+
+    OperationTiming(const string& n) : name(n), failed(0) {}
+    void record(uint64_t startNanos, bool ok) {
+        micros.push_back((nowNanos() - startNanos) / 1e3);
+        if (!ok) failed++;
+    }
+};
+
+static long peakResidentKilobytes() {
+#ifdef HAVE_POSIX_IO
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; // bytes on macOS
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+// Unsigned decimal batch field or command-line value: digits only, no sign or spaces, no overflow
+static bool parseNumber(const string& field, uint64_t& value) {
+    if (field.empty() || field[0] < '0' || field[0] > '9') return false;
+    errno = 0;
+    char* end = NULL;
+    unsigned long long v = strtoull(field.c_str(), &end, 10);
+    if (errno == ERANGE || *end != '\0') return false;
+    value = v;
+    return true;
+}
+
+// --bench-suite [--users <n>] [--model ba|rmat] [--index avl|hash] [--seed <n>] [--incremental] [--json]
+int runBenchmarkSuite(int argc, char* argv[]) {
+    uint32_t userCount = 100000, seed = 1;
+    GraphModel model = MODEL_RMAT;
+    UserIndexKind index = INDEX_AVL;
+    bool json = false, incremental = false;
+    uint64_t value;
+    for (int i = 0; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--json") json = true;
+        else if (arg == "--incremental") incremental = true;
+        else if ((arg == "--users" || arg == "--seed") && hasValue && parseNumber(argv[i + 1], value) && value <= UINT32_MAX) {
+            if (arg == "--users") userCount = (uint32_t)max<uint64_t>(value, 100);
+            else seed = (uint32_t)value;
+            i++;
+        } else if (arg == "--model" && hasValue && (string(argv[i + 1]) == "ba" || string(argv[i + 1]) == "rmat"))
+            model = string(argv[++i]) == "ba" ? MODEL_BARABASI_ALBERT : MODEL_RMAT;
+        else if (arg == "--index" && hasValue && (string(argv[i + 1]) == "avl" || string(argv[i + 1]) == "hash"))
+            index = string(argv[++i]) == "hash" ? INDEX_HASH : INDEX_AVL;
+        else {
+            cerr << "Usage: --bench-suite [--users <n>] [--model ba|rmat] [--index avl|hash] [--seed <n>] [--incremental] [--json]\n";
+            return 1;
+        }
+    }
+
+    uint64_t t0 = nowNanos();
+    SyntheticNetwork net;
+    generateNetwork(userCount, model, seed, net);
+    double generateSeconds = (nowNanos() - t0) / 1e9;
+
+    vector<OperationTiming> ops;
+    ops.push_back(OperationTiming("createProfile"));
+    ops.push_back(OperationTiming("sendFriendRequest"));
+    ops.push_back(OperationTiming("acceptFriendRequest"));
+    ops.push_back(OperationTiming("joinGroup"));
+    ops.push_back(OperationTiming("findUser"));
+    ops.push_back(OperationTiming("mutualFriends"));
+    ops.push_back(OperationTiming("countMutualFriends"));
+    ops.push_back(OperationTiming("suggestFriends"));
+    ops.push_back(OperationTiming("sendMessage"));
+    ops.push_back(OperationTiming("sendGroupMessage"));
+    ops.push_back(OperationTiming("readMessages"));
+    ops.push_back(OperationTiming("searchMessages"));
+
+    Profile profile(index);
+    profile.setIncrementalSuggestions(incremental);
+    mt19937 rng(seed + 1);
+    string values[ATTR_COUNT];
+    for (uint32_t u = 0; u < userCount; u++) {
+        for (int a = 0; a < ATTR_COUNT; a++) values[a] = syntheticAttribute((UserAttribute)a, net.attributeRanks[a][u]);
+        uint64_t start = nowNanos();
+        ops[0].record(start, profile.createProfile(net.names[u], net.ids[u], values) == STATUS_OK);
+    }
+    for (size_t i = 0; i < net.friendships.size(); i++) {
+        const string& a = net.ids[net.friendships[i].first];
+        const string& b = net.ids[net.friendships[i].second];
+        uint64_t start = nowNanos();
+        ops[1].record(start, profile.sendFriendRequest(a, b) == STATUS_OK);
+        start = nowNanos();
+        ops[2].record(start, profile.acceptFriendRequest(b, a) == STATUS_OK);
+    }
+    for (size_t g = 0; g < net.groupNames.size(); g++) {
+        profile.createGroup(net.groupNames[g]);
+        for (size_t i = 0; i < net.groupMembers[g].size(); i++) {
+            uint64_t start = nowNanos();
+            Status status = profile.joinGroup(net.ids[net.groupMembers[g][i]], net.groupNames[g]);
+            ops[3].record(start, status == STATUS_OK || status == STATUS_ALREADY_MEMBER); // random picks repeat
+        }
+    }
+
+    // The materialized counts are built on the first read; time that apart
+    double materializeSeconds = 0;
+    if (incremental) {
+        uint64_t start = nowNanos();
+        profile.countMutualFriends(net.ids[0], net.ids[userCount > 1 ? 1 : 0]);
+        materializeSeconds = (nowNanos() - start) / 1e9;
+    }
+
+    // Active users are drawn as friendship endpoints, so hubs act more often
+    const uint32_t lookups = 200000, pairQueries = 50000, suggestions = 2000, messages = 200000, reads = 50000;
+    ZipfSampler words(20000, 1.0);
+    vector<string> texts(4096);
+    for (size_t i = 0; i < texts.size(); i++) texts[i] = syntheticMessage(words, rng);
+    vector<UserNode*> users;
+    vector<Suggestion> suggested;
+    MessagePage page;
+    for (uint32_t i = 0; i < lookups; i++) {
+        const string& id = net.ids[rng() % userCount];
+        uint64_t start = nowNanos();
+        ops[4].record(start, profile.findUser(id) != NULL);
+    }
+    for (uint32_t i = 0; i < pairQueries; i++) {
+        const pair<uint32_t, uint32_t>& e = net.friendships[rng() % net.friendships.size()];
+        uint64_t start = nowNanos();
+        ops[5].record(start, profile.mutualFriends(net.ids[e.first], net.ids[e.second], users) == STATUS_OK);
+    }
+    for (uint32_t i = 0; i < pairQueries; i++) { // friends of friends as well as friends
+        const pair<uint32_t, uint32_t>& e = net.friendships[rng() % net.friendships.size()];
+        const pair<uint32_t, uint32_t>& f = net.friendships[rng() % net.friendships.size()];
+        uint64_t start = nowNanos();
+        ops[6].record(start, profile.countMutualFriends(net.ids[e.first], net.ids[i & 1 ? e.second : f.first]) >= 0);
+    }
+    for (uint32_t i = 0; i < suggestions; i++) {
+        const pair<uint32_t, uint32_t>& e = net.friendships[rng() % net.friendships.size()];
+        uint64_t start = nowNanos();
+        ops[7].record(start, profile.suggestFriends(net.ids[e.first], 10, suggested) == STATUS_OK);
+    }
+    for (uint32_t i = 0; i < messages; i++) {
+        const pair<uint32_t, uint32_t>& e = net.friendships[rng() % net.friendships.size()];
+        bool forward = rng() & 1;
+        const string& from = net.ids[forward ? e.first : e.second];
+        const string& to = net.ids[forward ? e.second : e.first];
+        uint64_t start = nowNanos();
+        ops[8].record(start, profile.sendMessage(from, to, texts[i % texts.size()]) == STATUS_OK);
+    }
+    for (uint32_t i = 0; i < messages / 10; i++) {
+        uint32_t g = rng() % net.groupNames.size();
+        const string& from = net.ids[net.groupMembers[g][rng() % net.groupMembers[g].size()]];
+        uint64_t start = nowNanos();
+        ops[9].record(start, profile.sendGroupMessage(from, net.groupNames[g], texts[(i * 7) % texts.size()]) == STATUS_OK);
+    }
+    for (uint32_t i = 0; i < reads; i++) {
+        const pair<uint32_t, uint32_t>& e = net.friendships[rng() % net.friendships.size()];
+        uint64_t start = nowNanos();
+        ops[10].record(start, profile.readMessages(net.ids[e.second], 20, page) == STATUS_OK);
+    }
+    for (uint32_t i = 0; i < reads; i++) { // one or two words, every fourth query a prefix
+        const pair<uint32_t, uint32_t>& e = net.friendships[rng() % net.friendships.size()];
+        string query = syntheticWord(words(rng));
+        if (i & 1) query += " " + syntheticWord(words(rng));
+        if (i % 4 == 0) query += "*";
+        uint64_t start = nowNanos();
+        ops[11].record(start, profile.searchMessages(net.ids[e.second], query, 20, page) == STATUS_OK);
+    }
+    double totalSeconds = (nowNanos() - t0) / 1e9;
+    long peakKb = peakResidentKilobytes();
+    const char* modelName = model == MODEL_BARABASI_ALBERT ? "ba" : "rmat";
+
+    if (json) {
+        cout << "{\"benchmark\":\"suite\",\"users\":" << userCount << ",\"model\":\"" << modelName << "\",\"index\":\""
+             << (index == INDEX_HASH ? "hash" : "avl") << "\",\"incremental\":" << (incremental ? "true" : "false")
+             << ",\"seed\":" << seed << ",\"friendships\":"
+             << net.friendships.size() << ",\"groups\":" << net.groupNames.size() << fixed << setprecision(3)
+             << ",\"generate_seconds\":" << generateSeconds << ",\"materialize_seconds\":" << materializeSeconds
+             << ",\"common_friend_pairs\":" << profile.commonFriendPairs() << ",\"total_seconds\":" << totalSeconds
+             << ",\"peak_rss_kb\":" << peakKb << ",\"operations\":[";
+    } else {
+        cout << "Benchmark suite: " << userCount << " users, " << net.friendships.size() << " friendships ("
+             << modelName << "), " << net.groupNames.size() << " groups, " << (index == INDEX_HASH ? "hash" : "AVL")
+             << " index, " << (incremental ? "incremental" : "recomputed") << " suggestions, seed " << seed << "\n";
+        cout << left << setw(22) << "operation" << right << setw(10) << "calls" << setw(9) << "failed" << setw(14)
+             << "ops/s" << setw(11) << "p50 us" << setw(11) << "p99 us" << setw(12) << "max us" << "\n";
+    }
+    for (size_t i = 0; i < ops.size(); i++) {
+        vector<double>& micros = ops[i].micros;
+        double sum = 0;
+        for (size_t k = 0; k < micros.size(); k++) sum += micros[k];
+        sort(micros.begin(), micros.end());
+        double rate = micros.size() * 1e6 / max(sum, 1e-3);
+        double p50 = micros.empty() ? 0 : percentile(micros, 0.50);
+        double p99 = micros.empty() ? 0 : percentile(micros, 0.99);
+        double worst = micros.empty() ? 0 : micros.back();
+        if (json) {
+            cout << (i ? "," : "") << "{\"name\":\"" << ops[i].name << "\",\"calls\":" << micros.size()
+                 << ",\"failed\":" << ops[i].failed << setprecision(0) << ",\"ops_per_sec\":" << rate
+                 << setprecision(3) << ",\"p50_us\":" << p50 << ",\"p99_us\":" << p99 << ",\"max_us\":" << worst << "}";
+        } else {
+            cout << left << setw(22) << ops[i].name << right << setw(10) << micros.size() << setw(9) << ops[i].failed
+                 << fixed << setprecision(0) << setw(14) << rate << setprecision(2) << setw(11) << p50 << setw(11)
+                 << p99 << setw(12) << worst << "\n";
+        }
+    }
+    if (json) cout << "]}\n";
+    else {
+        if (incremental)
+            cout << fixed << setprecision(2) << "Materialized " << profile.commonFriendPairs() << " common-friend pairs ("
+                 << profile.commonFriendBytes() / 1048576.0 << " MiB) in " << materializeSeconds << " s\n";
+        cout << setprecision(2) << "Generated in " << generateSeconds << " s, total " << totalSeconds
+             << " s, peak RSS " << peakKb / 1024.0 << " MiB\n";
+    }
+    cout.unsetf(ios::floatfield);
+    return 0;
+}
+
+// Capitalized name of two to four syllables, distinct per rank
+static string syntheticName(uint32_t rank) {
+    static const char* syllables[] = { "ka", "ri", "mo", "sa", "le", "na", "to", "vi", "da", "ru",
+                                       "mi", "ho", "ze", "la", "fa", "ne", "po", "shi", "ya", "bu" };
+    string name;
+    uint32_t r = rank;
+    do {
+        name += syllables[r % 20];
+        r /= 20;
+    } while (r);
+    if (name.size() < 4) name += syllables[(rank * 7 + 3) % 20]; // rank 0..19 would be one syllable
+    name[0] = (char)(name[0] - ('a' - 'A'));
+    return name;
+}
+
+// Name search benchmark: a million users with Zipf-distributed first and
+// last names and a few friends each; autocomplete prefixes and one-typo
+// queries ranked for a friend of the user looked for, against a scan of
+// every name.
+int runNameSearchBenchmark() {
+    const uint32_t userCount = 1000000, queries = 2000, scanQueries = 20;
+    mt19937 rng(25);
+    ZipfSampler firstNames(5000, 1.0), lastNames(50000, 0.8);
+    Profile profile(INDEX_HASH);
+    const string values[ATTR_COUNT] = { "Lahore", "chess", "FAST" };
+    vector<string> ids(userCount);
+    uint64_t t0 = nowNanos();
+    for (uint32_t u = 0; u < userCount; u++) {
+        ids[u] = "u" + to_string(u);
+        profile.createProfile(syntheticName(firstNames(rng)) + " " + syntheticName(lastNames(rng)), ids[u], values);
+    }
+    double createSeconds = (nowNanos() - t0) / 1e9;
+    for (uint32_t u = 0; u < userCount; u++) {
+        uint32_t targets[4] = { (u + 1) % userCount, (u + 2) % userCount, (uint32_t)rng() % userCount, (uint32_t)rng() % userCount };
+        for (int t = 0; t < 4; t++)
+            if (profile.sendFriendRequest(ids[u], ids[targets[t]]) == STATUS_OK) profile.acceptFriendRequest(ids[targets[t]], ids[u]);
+    }
+    cout << "Name search benchmark: " << userCount << " users, created (with name index) in " << fixed << setprecision(2)
+         << createSeconds << " s\n";
+
+    vector<NameMatch> found;
+    vector<double> micros[2];
+    uint64_t results[2] = { 0, 0 };
+    for (uint32_t q = 0; q < 2 * queries; q++) {
+        uint32_t target = 2 + rng() % (userCount - 2);
+        const string& name = profile.findUser(ids[target])->name;
+        string query;
+        int kind = q & 1;
+        if (kind == 0) { // what has been typed so far, up to a few letters into the last name
+            query = name.substr(0, 1 + rng() % min<size_t>(name.size(), name.find(' ') + 4));
+        } else { // last name with one letter wrong
+            query = name.substr(name.find(' ') + 1);
+            query[1 + rng() % (query.size() - 1)] = 'x';
+        }
+        uint64_t start = nowNanos();
+        profile.searchUsersByName(ids[target - 1], query, 10, found);
+        micros[kind].push_back((nowNanos() - start) / 1e3);
+        results[kind] += found.size();
+    }
+    const char* labels[2] = { "Autocomplete", "One typo" };
+    for (int kind = 0; kind < 2; kind++) {
+        sort(micros[kind].begin(), micros[kind].end());
+        cout << setprecision(1) << labels[kind] << ": p50 " << percentile(micros[kind], 0.50) << " us, p99 "
+             << percentile(micros[kind], 0.99) << " us, max " << micros[kind].back() << " us, "
+             << (double)results[kind] / queries << " results per query\n";
+    }
+
+    // What finding a name took before: every user's name, compared word by word
+    vector<double> scans;
+    vector<string> words;
+    vector<UserNode*> everyone;
+    profile.allUsers(everyone);
+    uint64_t matches = 0;
+    for (uint32_t q = 0; q < scanQueries; q++) {
+        const string& name = everyone[rng() % userCount]->name;
+        NameIndex::tokenize(name.substr(0, name.find(' ') + 3), words);
+        uint64_t start = nowNanos();
+        for (uint32_t u = 0; u < userCount; u++) {
+            const string& other = everyone[u]->name;
+            bool all = true;
+            for (size_t w = 0; w < words.size() && all; w++) {
+                bool any = false;
+                TermScanner scan(other);
+                string word;
+                while (!any && scan.next(word)) any = word.compare(0, words[w].size(), words[w]) == 0;
+                all = any;
+            }
+            matches += all;
+        }
+        scans.push_back((nowNanos() - start) / 1e3);
+    }
+    sort(scans.begin(), scans.end());
+    cout << "Scanning every name (" << scanQueries << " prefixes): p50 " << percentile(scans, 0.50) / 1e3 << " ms, "
+         << (double)matches / scanQueries << " matches per query\n";
+    cout.unsetf(ios::floatfield);
+    return 0;
+}
+
+// Batch mode: one command per line, fields separated by tabs, so names and
+// message text may contain spaces. Blank lines and lines starting with '#'
+// are skipped.
+//   user <id> <name> <city> <interests> <institution>
+//   edit <id> name|city|interests|institution <value>
+//   request <sender> <receiver>        requests <sender> <id>,<id>,...
+//   accept <user> <sender>             reject <user> <sender>
+//   unfriend <user> <friend>
+//   group <name>    join <id> <group>    leave <id> <group>
+//   group-requests <id> <group>
+//   message <sender> <receiver> <text>  post <sender> <group> <text>
+//   read <id> [limit]    page <id> <after> <limit>    search <id> <words> [limit]
+//   friends <id>   pending <id>   profile <id>   groups <id>   members <group>
+//   mutual <id> <id>   path <id> <id> [max hops]   suggest <id> [limit]   find <city> <interests> <institution> [any]
+//   names <searcher id, may be empty> <name or beginning> [limit]
+//   users   memory   stats   metrics [json]   save <file>   load <file>   compact   commit
+static void splitFields(const string& line, vector<string>& fields) {
+    size_t n = 0, start = 0;
+    while (true) {
+        size_t tab = line.find('\t', start);
+        size_t end = tab == string::npos ? line.size() : tab;
+        if (n == fields.size()) fields.push_back(string());
+        fields[n++].assign(line, start, end - start); // reuses the field's buffer
+        if (tab == string::npos) break;
+        start = tab + 1;
+    }
+    fields.resize(n);
+}
+
+// A limit or hop count: a number of at least one; an absent field keeps the default
+static bool parseCount(const vector<string>& f, size_t i, size_t& count) {
+    if (i >= f.size()) return true;
+    uint64_t v;
+    if (!parseNumber(f[i], v) || v == 0 || v > (uint64_t)SIZE_MAX) return false;
+    count = (size_t)v;
+    return true;
+}
+
+static int editFieldNumber(const string& name) {
+    const char* names[] = { "name", "city", "interests", "institution" };
+    for (int i = 0; i < 4; i++)
+        if (name == names[i]) return i + 1;
+    return 0;
+}
+
+// The bulk-import commands, sent straight to the engine when output is
+// suppressed: the console would only look the users up again to word
+// messages nobody sees. False if the line is not one of them.
+static bool runEngineCommand(Profile& profile, const vector<string>& f) {
+    const string& op = f[0];
+    size_t n = f.size();
+    if (op == "user" && n == 6) profile.createProfile(f[2], f[1], &f[3]);
+    else if (op == "request" && n == 3) profile.sendFriendRequest(f[1], f[2]);
+    else if (op == "accept" && n == 3) profile.acceptFriendRequest(f[1], f[2]);
+    else if (op == "join" && n == 3) profile.joinGroup(f[1], f[2]);
+    else if (op == "message" && n == 4) profile.sendMessage(f[1], f[2], f[3]);
+    else if (op == "post" && n == 4) profile.sendGroupMessage(f[1], f[2], f[3]);
+    else return false;
+    return true;
+}
+
+// Dispatches one parsed command line; false if it is not understood,
+// including a numeric field that is not a plain number in range
+static bool runBatchCommand(ProfileConsole& console, const vector<string>& f) {
+    const string& op = f[0];
+    size_t n = f.size();
+    if (op == "user" && n == 6) console.createProfile(f[2], f[1], &f[3]);
+    else if (op == "edit" && n == 4 && editFieldNumber(f[2])) console.editProfileField(f[1], editFieldNumber(f[2]), f[3]);
+    else if (op == "request" && n == 3) console.sendFriendRequest(f[1], f[2]);
+    else if (op == "requests" && n == 3) {
+        vector<string> receiverIds;
+        stringstream ids(f[2]);
+        string id;
+        while (getline(ids, id, ',')) if (!id.empty()) receiverIds.push_back(id);
+        console.sendFriendRequestsToUsers(f[1], receiverIds);
+    }
+    else if (op == "accept" && n == 3) console.acceptFriendRequest(f[1], f[2]);
+    else if (op == "reject" && n == 3) console.rejectFriendRequest(f[1], f[2]);
+    else if (op == "unfriend" && n == 3) console.deleteFriend(f[1], f[2]);
+    else if (op == "group" && n == 2) console.createGroup(f[1]);
+    else if (op == "join" && n == 3) console.joinGroup(f[1], f[2]);
+    else if (op == "leave" && n == 3) console.leaveGroup(f[1], f[2]);
+    else if (op == "group-requests" && n == 3) console.sendFriendRequestToGroup(f[1], f[2]);
+    else if (op == "message" && n == 4) console.sendMessage(f[1], f[2], f[3]);
+    else if (op == "post" && n == 4) console.sendGroupMessage(f[1], f[2], f[3]);
+    else if (op == "read" && (n == 2 || n == 3)) {
+        size_t limit = 20;
+        if (!parseCount(f, 2, limit)) return false;
+        console.readMessages(f[1], limit);
+    }
+    else if (op == "page" && n == 4) {
+        uint64_t afterSeq;
+        size_t limit;
+        if (!parseNumber(f[2], afterSeq) || !parseCount(f, 3, limit)) return false;
+        console.readMessages(f[1], afterSeq, limit);
+    }
+    else if (op == "search" && (n == 3 || n == 4)) {
+        size_t limit = 20;
+        if (!parseCount(f, 3, limit)) return false;
+        console.searchMessages(f[1], f[2], limit);
+    }
+    else if (op == "friends" && n == 2) console.listFriends(f[1]);
+    else if (op == "pending" && n == 2) console.listPendingRequests(f[1]);
+    else if (op == "profile" && n == 2) console.viewUserProfile(f[1]);
+    else if (op == "groups" && n == 2) console.listUserGroups(f[1]);
+    else if (op == "members" && n == 2) console.listGroupMembers(f[1]);
+    else if (op == "mutual" && n == 3) console.showMutualFriends(f[1], f[2]);
+    else if (op == "path" && (n == 3 || n == 4)) {
+        size_t maxHops = 6;
+        if (!parseCount(f, 3, maxHops)) return false;
+        console.showConnection(f[1], f[2], maxHops);
+    }
+    else if (op == "suggest" && (n == 2 || n == 3)) {
+        size_t limit = 10;
+        if (!parseCount(f, 2, limit)) return false;
+        console.suggestFriends(f[1], limit);
+    }
+    else if (op == "find" && (n == 4 || (n == 5 && f[4] == "any"))) {
+        vector<AttributeTerm> terms;
+        for (int a = 0; a < ATTR_COUNT; a++) {
+            AttributeTerm term = { (UserAttribute)a, f[1 + a] };
+            if (!term.value.empty()) terms.push_back(term);
+        }
+        console.findUsersByAttribute(terms, n == 4);
+    }
+    else if (op == "names" && (n == 3 || n == 4)) {
+        size_t limit = 10;
+        if (!parseCount(f, 3, limit)) return false;
+        console.searchUsersByName(f[1], f[2], limit);
+    }
+    else if (op == "users" && n == 1) console.listAllUsers();
+    else if (op == "memory" && n == 1) console.memoryReport();
+    else if (op == "stats" && n == 1) console.networkStats();
+    else if (op == "metrics" && (n == 1 || (n == 2 && f[1] == "json"))) console.showMetrics(n == 2);
+    else if (op == "save" && n == 2) console.saveSnapshot(f[1]);
+    else if (op == "load" && n == 2) console.loadSnapshot(f[1]);
+    else if (op == "compact" && n == 1) console.compactStore();
+    else if (op == "commit" && n == 1) console.commitLog();
+    else return false;
+    return true;
+}
+
+// Rewrites a metrics file (JSON if the name ends in .json, text otherwise)
+// once the interval has passed, checked between commands so the engine is
+// never read mid-operation. The file is replaced by rename, so readers see
+// either the old export or the new one.
+class MetricsExporter {
+    Profile& profile;
+    string path;
+    uint64_t intervalNanos, lastNanos;
+
+public:
+    MetricsExporter(Profile& p, const string& file, double seconds)
+        : profile(p), path(file), intervalNanos((uint64_t)(seconds * 1e9)), lastNanos(nowNanos()) {}
+
+    void poll() {
+        if (!path.empty() && nowNanos() - lastNanos >= intervalNanos) write();
+    }
+    bool write() {
+        if (path.empty()) return true;
+        lastNanos = nowNanos();
+        MetricGauges gauges;
+        profile.metricGauges(gauges);
+        string temp = path + ".tmp";
+        {
+            ofstream out(temp.c_str());
+            if (!out) return false;
+            bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+            if (json) writeMetricsJson(out, profile.operationMetrics(), gauges);
+            else writeMetricsText(out, profile.operationMetrics(), gauges);
+            if (!out) return false;
+        }
+        return rename(temp.c_str(), path.c_str()) == 0;
+    }
+};
+
+// Runs every command in the stream; returns the number of lines that were
+// not understood. Output goes through cout's buffer unless quiet is set.
+static size_t runBatch(Profile& profile, ProfileConsole& console, istream& in, bool quiet, MetricsExporter& exporter) {
+    QuietOutput silence(quiet);
+    string line;
+    vector<string> f;
+    size_t lineNo = 0, commands = 0, rejected = 0;
+    uint64_t t0 = nowNanos();
+    while (getline(in, line)) {
+        lineNo++;
+        if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+        if (line.empty() || line[0] == '#') continue;
+        splitFields(line, f);
+        if ((quiet && runEngineCommand(profile, f)) || runBatchCommand(console, f)) {
+            commands++;
+        } else {
+            rejected++;
+            cerr << "line " << lineNo << ": cannot parse '" << f[0] << "' with " << f.size() - 1 << " fields\n";
+        }
+        exporter.poll();
+    }
+    console.commitLog();
+    exporter.write();
+    double seconds = (nowNanos() - t0) / 1e9;
+    cerr << "Batch: " << commands << " commands in " << fixed << setprecision(3) << seconds << " s ("
+         << setprecision(0) << commands / max(seconds, 1e-9) << " commands/s)";
+    if (rejected) cerr << ", " << rejected << " lines rejected";
+    cerr << "\n";
+    cerr.unsetf(ios::floatfield);
+    return rejected;
+}
+
+static int printUsage(const char* program) {
+    cerr << "Usage: " << program << " [--load <file> | --data <prefix>] [--batch <file>|- [--quiet]]"
+         << " [--metrics-out <file> [--metrics-every <seconds>]]\n"
+         << "       " << program << " --bench-mutual | --bench-wal | --bench-concurrent [--threads <n>] | --bench-analytics | --bench-path | --bench-names\n"
+         << "       " << program << " --bench-suite [--users <n>] [--model ba|rmat] [--index avl|hash] [--seed <n>] [--incremental] [--json]\n";
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && string(argv[1]) == "--bench-mutual") return runMutualFriendsBenchmark();
+    if (argc > 1 && string(argv[1]) == "--bench-wal") return runWalBenchmark();
+    if (argc > 1 && string(argv[1]) == "--bench-concurrent") {
+        uint64_t maxThreads = 0;
+        if (argc != 2 && (argc != 4 || string(argv[2]) != "--threads" || !parseNumber(argv[3], maxThreads)
+                          || maxThreads == 0 || maxThreads > 1024))
+            return printUsage(argv[0]);
+        return runConcurrentBenchmark((unsigned)maxThreads);
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-analytics") return runAnalyticsBenchmark();
+    if (argc > 1 && string(argv[1]) == "--bench-path") return runConnectionPathBenchmark();
+    if (argc > 1 && string(argv[1]) == "--bench-names") return runNameSearchBenchmark();
+    if (argc > 1 && string(argv[1]) == "--bench-suite") return runBenchmarkSuite(argc - 2, argv + 2);
+
+    // [--load <file> | --data <prefix>] [--batch <file>|- [--quiet]] [--metrics-out <file> [--metrics-every <s>]]
+    string loadPath, dataPrefix, batchPath, metricsPath;
+    bool quiet = false;
+    double metricsEvery = 10;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--quiet") quiet = true;
+        else if (arg == "--metrics-every" && i + 1 < argc && atof(argv[i + 1]) > 0) metricsEvery = atof(argv[++i]);
+        else if ((arg == "--load" || arg == "--data" || arg == "--batch" || arg == "--metrics-out") && i + 1 < argc) {
+            string& target = arg == "--load" ? loadPath : arg == "--data" ? dataPrefix : arg == "--batch" ? batchPath : metricsPath;
+            target = argv[++i];
+        } else {
+            return printUsage(argv[0]);
+        }
+    }
+
+    if (!batchPath.empty()) ios::sync_with_stdio(false); // cout buffers on its own, flushed when full
+
+    Profile profile;
+    ProfileConsole console(profile);
+    MetricsExporter exporter(profile, metricsPath, metricsEvery);
+    if (!loadPath.empty() && !console.loadSnapshot(loadPath)) return 1;
+    if (!dataPrefix.empty() && !console.openStore(dataPrefix)) return 1;
+    if (!batchPath.empty()) {
+        if (batchPath == "-") return runBatch(profile, console, cin, quiet, exporter) ? 2 : 0;
+        ifstream script(batchPath.c_str());
+        if (!script) {
+            cerr << "Cannot open " << batchPath << "\n";
+            return 1;
+        }
+        return runBatch(profile, console, script, quiet, exporter) ? 2 : 0;
+    }
+    int choice;
+    while (1) {
+        console.commitLog(); // everything done so far is durable before we wait for input
+        exporter.poll();
+        cout << "\nMenu:\n";
+        cout << "1. Create Profile\n";
+        cout << "2. Create Group\n";
+        cout << "3. Send Friend Request\n";
+        cout << "4. Accept Friend Request\n";
+        cout << "5. Send Message\n";
+        cout << "6. Read Messages\n";
+        cout << "7. List Group Members\n";
+        cout << "8. Show Mutual Friends\n";
+        cout << "9. Send Friend Request to Group Members\n";
+        cout << "10. Suggest Friends\n";
+        cout << "11. List All Users\n";
+        cout << "12. List Friends\n";
+        cout << "13. List Pending Friend Requests\n";
+        cout << "14. Edit Profile\n";
+        cout << "15. Delete Friend\n";
+        cout << "16. Reject Friend Request\n";
+        cout << "17. Send Group Message\n";
+        cout << "18. View User Profile\n";
+        cout << "19. Find Users by Attribute\n";
+        cout << "20. Memory Usage Report\n";
+        cout << "21. Read Messages Page\n";
+        cout << "22. Join Group\n";
+        cout << "23. Leave Group\n";
+        cout << "24. List My Groups\n";
+        cout << "25. Send Friend Requests to Several Users\n";
+        cout << "26. Save Snapshot\n";
+        cout << "27. Load Snapshot\n";
+        cout << "28. Compact Data Log\n";
+        cout << "29. Network Statistics\n";
+        cout << "30. Find Connection Path\n";
+        cout << "31. Show Metrics\n";
+        cout << "32. Search Messages\n";
+        cout << "33. Search Users by Name\n";
+        cout << "0. Exit\n";
+        cout << "Enter your choice: ";
+        cin >> choice;
+        if (!(cin)) {
+            cout << "Invalid input. Please enter a number.\n";
+            cin.clear();
+            cin.ignore(10000, '\n');
+            continue;
+        }
+        cin.ignore();
+        if (choice == 1) {
+            console.makeProfile();
+        } else if (choice == 2) {
+            string groupName;
+            cout << "Enter group name: ";
+            getline(cin, groupName);
+            console.createGroup(groupName);
+        } else if (choice == 3) {
+            string senderId, receiverId;
+            cout << "Enter sender ID: "; getline(cin, senderId);
+            cout << "Enter receiver ID: "; getline(cin, receiverId);
+            console.sendFriendRequest(senderId, receiverId);
+        } else if (choice == 4) {
+            string userId, senderId;
+            cout << "Enter your user ID: "; getline(cin, userId);
+            cout << "Enter sender ID: "; getline(cin, senderId);
+            console.acceptFriendRequest(userId, senderId);
+        } else if (choice == 5) {
+            string senderId, receiverId, message;
+            cout << "Enter sender ID: "; getline(cin, senderId);
+            cout << "Enter receiver ID: "; getline(cin, receiverId);
+            cout << "Enter message: "; getline(cin, message);
+            console.sendMessage(senderId, receiverId, message);
+        } else if (choice == 6) {
+            string userId;
+            cout << "Enter user ID: "; getline(cin, userId);
+            console.readMessages(userId);
+        } else if (choice == 7) {
+            string groupName;
+            cout << "Enter group name: "; getline(cin, groupName);
+            console.listGroupMembers(groupName);
+        } else if (choice == 8) {
+            string user1Id, user2Id;
+            cout << "Enter first user ID: "; getline(cin, user1Id);
+            cout << "Enter second user ID: "; getline(cin, user2Id);
+            console.showMutualFriends(user1Id, user2Id);
+        } else if (choice == 9) {
+            string userId, groupName;
+            cout << "Enter your user ID: "; getline(cin, userId);
+            cout << "Enter group name: "; getline(cin, groupName);
+            console.sendFriendRequestToGroup(userId, groupName);
+        } else if (choice == 10) {
+            string userId;
+            cout << "Enter user ID: "; getline(cin, userId);
+            console.suggestFriends(userId);
+        } else if (choice == 11) {
+            console.listAllUsers();
+        } else if (choice == 12) {
+            string userId;
+            cout << "Enter user ID: "; getline(cin, userId);
+            console.listFriends(userId);
+        } else if (choice == 13) {
+            string userId;
+            cout << "Enter user ID: "; getline(cin, userId);
+            console.listPendingRequests(userId);
+        } else if (choice == 14) {
+            string userId;
+            cout << "Enter your user ID: "; getline(cin, userId);
+            console.editProfile(userId);
+        } else if (choice == 15) {
+            string userId, friendId;
+            cout << "Enter your user ID: "; getline(cin, userId);
+            cout << "Enter friend's ID to remove: "; getline(cin, friendId);
+            console.deleteFriend(userId, friendId);
+        } else if (choice == 16) {
+            string userId, senderId;
+            cout << "Enter your user ID: "; getline(cin, userId);
+            cout << "Enter ID of request to reject: "; getline(cin, senderId);
+            console.rejectFriendRequest(userId, senderId);
+        } else if (choice == 17) {
+            string senderId, groupName, message;
+            cout << "Enter your user ID: "; getline(cin, senderId);
+            cout << "Enter group name: "; getline(cin, groupName);
+            cout << "Enter message: "; getline(cin, message);
+            console.sendGroupMessage(senderId, groupName, message);
+        } else if (choice == 18) {
+            string userId;
+            cout << "Enter user ID to view: "; getline(cin, userId);
+            console.viewUserProfile(userId);
+        } else if (choice == 19) {
+            const char* prompts[ATTR_COUNT] = { "City", "Interests", "Institution" };
+            vector<AttributeTerm> terms;
+            for (int a = 0; a < ATTR_COUNT; a++) {
+                AttributeTerm term;
+                term.attr = (UserAttribute)a;
+                cout << prompts[a] << " (leave empty to skip): "; getline(cin, term.value);
+                if (!term.value.empty()) terms.push_back(term);
+            }
+            string mode;
+            cout << "Match all or any? (all/any): "; getline(cin, mode);
+            console.findUsersByAttribute(terms, mode != "any");
+        } else if (choice == 20) {
+            console.memoryReport();
+        } else if (choice == 21) {
+            string userId, afterSeq, limit;
+            cout << "Enter user ID: "; getline(cin, userId);
+            cout << "Show messages after # (0 for the first page): "; getline(cin, afterSeq);
+            cout << "Page size: "; getline(cin, limit);
+            uint64_t after, pageSize;
+            if (parseNumber(afterSeq, after) && parseNumber(limit, pageSize) && pageSize > 0)
+                console.readMessages(userId, after, (size_t)pageSize);
+            else
+                cout << "Invalid number.\n";
+        } else if (choice == 22) {
+            string userId, groupName;
+            cout << "Enter your user ID: "; getline(cin, userId);
+            cout << "Enter group name: "; getline(cin, groupName);
+            console.joinGroup(userId, groupName);
+        } else if (choice == 23) {
+            string userId, groupName;
+            cout << "Enter your user ID: "; getline(cin, userId);
+            cout << "Enter group name: "; getline(cin, groupName);
+            console.leaveGroup(userId, groupName);
+        } else if (choice == 24) {
+            string userId;
+            cout << "Enter your user ID: "; getline(cin, userId);
+            console.listUserGroups(userId);
+        } else if (choice == 25) {
+            string senderId, line, id;
+            cout << "Enter sender ID: "; getline(cin, senderId);
+            cout << "Enter receiver IDs (comma separated): "; getline(cin, line);
+            vector<string> receiverIds;
+            stringstream ids(line);
+            while (getline(ids, id, ',')) {
+                size_t b = id.find_first_not_of(' '), e = id.find_last_not_of(' ');
+                if (b != string::npos) receiverIds.push_back(id.substr(b, e - b + 1));
+            }
+            console.sendFriendRequestsToUsers(senderId, receiverIds);
+        } else if (choice == 26) {
+            string path;
+            cout << "Enter snapshot file path: "; getline(cin, path);
+            console.saveSnapshot(path);
+        } else if (choice == 27) {
+            string path;
+            cout << "Enter snapshot file path: "; getline(cin, path);
+            console.loadSnapshot(path);
+        } else if (choice == 28) {
+            console.compactStore();
+        } else if (choice == 29) {
+            console.networkStats();
+        } else if (choice == 30) {
+            string user1Id, user2Id;
+            cout << "Enter first user ID: "; getline(cin, user1Id);
+            cout << "Enter second user ID: "; getline(cin, user2Id);
+            console.showConnection(user1Id, user2Id);
+        } else if (choice == 31) {
+            console.showMetrics(false);
+        } else if (choice == 32) {
+            string userId, query;
+            cout << "Enter user ID: "; getline(cin, userId);
+            cout << "Words to search for (end a word with * to match its beginning): "; getline(cin, query);
+            console.searchMessages(userId, query);
+        } else if (choice == 33) {
+            string userId, query;
+            cout << "Your user ID, to rank friends first (leave empty to skip): "; getline(cin, userId);
+            cout << "Name or beginning of a name: "; getline(cin, query);
+            console.searchUsersByName(userId, query);
+        } else if (choice == 0) {
+            cout << "Exiting program.\n";
+            break;
+        } else {
+            cout << "Invalid choice. Please try again.\n";
+        }
+    }
+    exporter.write();
+    return 0;
+}
+
+
+
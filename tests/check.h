@@ -0,0 +1,45 @@
+// Shared by the checks in tests/: pulls in the whole program with its main
+// renamed, counts failed CHECKs and reads or writes whole files. Each test prints "<name>: ok" through
+// finish() and exits non-zero if anything failed.
+#ifndef TESTS_CHECK_H
+#define TESTS_CHECK_H
+
+#define main socialNetworkMain
+#include "../DSA_PROJECT.cpp"
+#undef main
+
+#include <atomic>
+#include <fstream>
+
+static atomic<int> failures(0);
+
+#define CHECK(cond)                                                              \
+    do {                                                                         \
+        if (!(cond)) {                                                           \
+            cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond "\n"; \
+            failures++;                                                          \
+        }                                                                        \
+    } while (0)
+
+inline string readFile(const string& path) {
+    ifstream in(path.c_str(), ios::binary);
+    stringstream bytes;
+    bytes << in.rdbuf();
+    return bytes.str();
+}
+
+inline void writeFile(const string& path, const string& bytes) {
+    ofstream out(path.c_str(), ios::binary | ios::trunc);
+    out.write(bytes.data(), bytes.size());
+}
+
+static int finish(const char* name) {
+    if (failures) {
+        cerr << failures.load() << " check(s) failed\n";
+        return 1;
+    }
+    cout << name << ": ok\n";
+    return 0;
+}
+
+#endif
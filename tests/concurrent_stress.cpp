@@ -0,0 +1,60 @@
+// The --bench-concurrent workloads on four threads through ConcurrentProfile,
+// then consistency checks on the result. Meant for -fsanitize=thread:
+//   g++ -std=c++17 -O1 -g -fsanitize=thread -pthread tests/concurrent_stress.cpp -o concurrent_stress && ./concurrent_stress
+#include "check.h"
+
+static const unsigned THREADS = 4;
+static const uint32_t USERS = 2000;
+static const uint32_t OPS = 20000; // per thread and workload
+
+static bool isFriendOf(Profile& profile, UserNode* user, UserNode* other) {
+    FriendRange range;
+    profile.friendsOf(user->id, range);
+    for (FriendRange::iterator it = range.begin(); it != range.end(); ++it)
+        if (*it == other) return true;
+    return false;
+}
+
+// Friend lists mirror each other; every user's messages, private and
+// group, have distinct seqs rising oldest first; no message is left queued
+static void checkConsistent(Profile& profile, const vector<string>& ids) {
+    size_t asymmetric = 0, unordered = 0;
+    for (size_t u = 0; u < ids.size(); u++) {
+        UserNode* user = profile.findUser(ids[u]);
+        FriendRange range;
+        profile.friendsOf(ids[u], range);
+        for (FriendRange::iterator it = range.begin(); it != range.end(); ++it)
+            if (!isFriendOf(profile, *it, user)) asymmetric++;
+        MessagePage page;
+        profile.readMessages(ids[u], 0, 1000000, page);
+        for (size_t i = 1; i < page.messages.size(); i++)
+            if (page.messages[i].msg->seq <= page.messages[i - 1].msg->seq) unordered++;
+    }
+    CHECK(asymmetric == 0);
+    CHECK(unordered == 0);
+    MetricGauges gauges;
+    profile.metricGauges(gauges);
+    CHECK(gauges.queuedMessages == 0);
+}
+
+static void stress(bool messaging) {
+    vector<string> ids(USERS), groups(CONCURRENT_GROUPS);
+    for (uint32_t u = 0; u < USERS; u++) ids[u] = "u" + to_string(u);
+    for (uint32_t g = 0; g < CONCURRENT_GROUPS; g++) groups[g] = "g" + to_string(g);
+    Profile profile(INDEX_HASH);
+    buildConcurrentNetwork(profile, ids, groups);
+    {
+        ConcurrentProfile api(profile);
+        vector<thread> pool;
+        for (unsigned t = 0; t < THREADS; t++)
+            pool.push_back(thread(concurrentWorker<ConcurrentProfile>, ref(api), cref(ids), cref(groups), 1000 + t, OPS, messaging));
+        for (size_t t = 0; t < pool.size(); t++) pool[t].join();
+    } // ends concurrent use, draining the inbox queues
+    checkConsistent(profile, ids);
+}
+
+int main() {
+    stress(false);
+    stress(true);
+    return finish("concurrent_stress");
+}
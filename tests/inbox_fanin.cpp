@@ -0,0 +1,134 @@
+// Fan-in through ConcurrentProfile: many senders to one receiver while it
+// reads. Every message arrives once, seqs rise along the inbox and each
+// sender's messages keep their send order. The data store log then replays
+// to the same inbox, also from a copy taken while messages were still queued.
+//   g++ -std=c++17 -O2 -pthread tests/inbox_fanin.cpp -o inbox_fanin && ./inbox_fanin
+//   g++ -std=c++17 -O1 -g -fsanitize=thread -pthread tests/inbox_fanin.cpp -o inbox_fanin_tsan && ./inbox_fanin_tsan
+#include "check.h"
+
+static const string PREFIX = "inbox-fanin-test";
+static const string CRASH_PREFIX = "inbox-fanin-test-crash";
+static const int SENDERS = 8;
+static const int MESSAGES = 2000; // per sender, while the receiver reads
+static const int QUEUED = 100;    // per sender, left unread
+
+struct Received {
+    vector<string> senders;
+    vector<int> numbers;
+    vector<uint64_t> seqs;
+};
+
+static string senderId(int s) { return "s" + to_string(s); }
+
+static void sendAll(ConcurrentProfile& api, int s, int from, int count) {
+    for (int i = from; i < from + count; i++)
+        if (api.sendMessage(senderId(s), "r", to_string(i)) != STATUS_OK) failures++;
+}
+
+template <typename Api>
+static void readAll(Api& api, Received& out) {
+    uint64_t after = out.seqs.empty() ? 0 : out.seqs.back();
+    for (;;) {
+        MessagePage page;
+        if (api.readMessages("r", after, 512, page) != STATUS_OK) {
+            failures++;
+            return;
+        }
+        if (page.messages.empty()) return;
+        for (size_t i = 0; i < page.messages.size(); i++) {
+            const MessageNode* m = page.messages[i].msg;
+            out.senders.push_back(m->sender->id);
+            out.numbers.push_back(atoi(m->text.c_str()));
+            out.seqs.push_back(m->seq);
+        }
+        after = out.seqs.back();
+    }
+}
+
+static void readWhileSending(ConcurrentProfile& api, atomic<bool>& done, Received& out) {
+    while (!done.load()) readAll(api, out);
+    readAll(api, out);
+}
+
+// Each message once, seqs strictly rising, per-sender order kept
+static void checkInbox(const Received& got, int perSender) {
+    CHECK(got.seqs.size() == (size_t)SENDERS * perSender);
+    vector<int> next(SENDERS, 0);
+    for (size_t i = 0; i < got.seqs.size(); i++) {
+        if (i > 0 && got.seqs[i] <= got.seqs[i - 1]) {
+            CHECK(got.seqs[i] > got.seqs[i - 1]);
+            return;
+        }
+        int s = atoi(got.senders[i].c_str() + 1);
+        if (s < 0 || s >= SENDERS || got.numbers[i] != next[s]) {
+            CHECK(got.numbers[i] == next[s]);
+            return;
+        }
+        next[s]++;
+    }
+}
+
+static void removeStore(const string& prefix) {
+    remove((prefix + ".snap").c_str());
+    remove((prefix + ".wal").c_str());
+}
+
+// The inbox after reopening a store
+static Received reopen(const string& prefix) {
+    Received got;
+    Profile profile;
+    StoreInfo info;
+    CHECK(profile.openStore(prefix, info) == STATUS_OK);
+    CHECK(info.discardedBytes == 0);
+    readAll(profile, got);
+    return got;
+}
+
+int main() {
+    removeStore(PREFIX);
+    removeStore(CRASH_PREFIX);
+    Received live;
+    {
+        Profile profile;
+        StoreInfo info;
+        CHECK(profile.openStore(PREFIX, info) == STATUS_OK);
+        string values[ATTR_COUNT] = { "Lahore", "chess", "FAST" };
+        profile.createProfile("Receiver", "r", values);
+        for (int s = 0; s < SENDERS; s++) {
+            profile.createProfile("Sender", senderId(s), values);
+            profile.sendFriendRequest(senderId(s), "r");
+            profile.acceptFriendRequest("r", senderId(s));
+        }
+        ConcurrentProfile api(profile);
+        atomic<bool> done(false);
+        thread reader(readWhileSending, ref(api), ref(done), ref(live));
+        vector<thread> senders;
+        for (int s = 0; s < SENDERS; s++) senders.push_back(thread(sendAll, ref(api), s, 0, MESSAGES));
+        for (int s = 0; s < SENDERS; s++) senders[s].join();
+        done.store(true);
+        reader.join();
+        checkInbox(live, MESSAGES);
+
+        // Queued but unread; the copy is what a crash at this point leaves
+        senders.clear();
+        for (int s = 0; s < SENDERS; s++) senders.push_back(thread(sendAll, ref(api), s, MESSAGES, QUEUED));
+        for (int s = 0; s < SENDERS; s++) senders[s].join();
+        CHECK(api.commitLog() == STATUS_OK);
+        writeFile(CRASH_PREFIX + ".wal", readFile(PREFIX + ".wal"));
+    }
+
+    Received clean = reopen(PREFIX);
+    Received crashed = reopen(CRASH_PREFIX);
+    checkInbox(clean, MESSAGES + QUEUED);
+    checkInbox(crashed, MESSAGES + QUEUED);
+    // What was read before keeps its seqs; the rest is new in both
+    for (size_t i = 0; i < live.seqs.size() && i < clean.seqs.size() && i < crashed.seqs.size(); i++) {
+        if (clean.seqs[i] != live.seqs[i] || crashed.seqs[i] != live.seqs[i] || clean.senders[i] != live.senders[i]) {
+            CHECK(clean.seqs[i] == live.seqs[i] && crashed.seqs[i] == live.seqs[i]);
+            break;
+        }
+    }
+    removeStore(PREFIX);
+    removeStore(CRASH_PREFIX);
+    return finish("inbox_fanin");
+}
@@ -0,0 +1,107 @@
+// Incremental mode under random requests, accepts, rejects, unfriends and
+// profile edits. After every step the maintained mutual-friend counts equal
+// a CommonFriendCounts built from scratch over the same friend lists, and
+// every user's cached suggestions equal those of a twin network whose
+// counts and cache were just dropped.
+//   g++ -std=c++17 -O2 -pthread tests/incremental_counts.cpp -o incremental_counts && ./incremental_counts
+#include "check.h"
+
+static const uint32_t USERS = 60;
+static const int STEPS = 3000;
+static const size_t LIMITS[] = { 3, 10, 25 };
+
+static string userId(uint32_t u) { return "u" + to_string(u); }
+
+static UserNode* pick(FriendRange range, mt19937& rng) {
+    vector<UserNode*> users;
+    for (FriendRange::iterator it = range.begin(); it != range.end(); ++it) users.push_back(*it);
+    return users.empty() ? NULL : users[rng() % users.size()];
+}
+
+// One random operation, applied to both networks; they must agree on it
+static void step(Profile& live, Profile& twin, mt19937& rng) {
+    static const char* const VALUES[] = { "Lahore", "Karachi", "chess", "cricket", "FAST", "LUMS" };
+    uint32_t a = rng() % USERS, b = rng() % USERS, roll = rng() % 100;
+    FriendRange range;
+    if (roll < 35) {
+        CHECK(live.sendFriendRequest(userId(a), userId(b)) == twin.sendFriendRequest(userId(a), userId(b)));
+    } else if (roll < 70) {
+        live.pendingRequestsOf(userId(a), range);
+        UserNode* sender = pick(range, rng);
+        if (!sender) return;
+        if (roll < 62) CHECK(live.acceptFriendRequest(userId(a), sender->id) == twin.acceptFriendRequest(userId(a), sender->id));
+        else CHECK(live.rejectFriendRequest(userId(a), sender->id) == twin.rejectFriendRequest(userId(a), sender->id));
+    } else if (roll < 85) {
+        live.friendsOf(userId(a), range);
+        UserNode* other = pick(range, rng);
+        if (!other) return;
+        CHECK(live.deleteFriend(userId(a), other->id) == twin.deleteFriend(userId(a), other->id));
+    } else {
+        ProfileField field = (ProfileField)(FIELD_CITY + rng() % 3);
+        string value = VALUES[(field - FIELD_CITY) * 2 + rng() % 2];
+        CHECK(live.editProfileField(userId(a), field, value) == twin.editProfileField(userId(a), field, value));
+    }
+}
+
+// The live counts against CommonFriendCounts::build over its friend lists
+static bool countsMatch(Profile& profile) {
+    MutualFriendsEngine graph;
+    for (uint32_t u = 0; u < USERS; u++) graph.addUser();
+    for (uint32_t u = 0; u < USERS; u++) {
+        FriendRange range;
+        profile.friendsOf(userId(u), range);
+        for (FriendRange::iterator it = range.begin(); it != range.end(); ++it) graph.addEdge(u, (*it)->index);
+    }
+    CommonFriendCounts expected;
+    expected.build(graph, USERS);
+    if (profile.commonFriendPairs() != expected.pairs()) return false;
+    for (uint32_t u = 0; u < USERS; u++)
+        for (uint32_t w = 0; w < USERS; w++)
+            if (u != w && (uint32_t)profile.countMutualFriends(userId(u), userId(w)) != expected.get(u, w)) return false;
+    return true;
+}
+
+static bool sameSuggestions(const vector<Suggestion>& a, const vector<Suggestion>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++)
+        if (a[i].user->id != b[i].user->id || a[i].mutualFriends != b[i].mutualFriends
+            || a[i].attributeMask != b[i].attributeMask || a[i].score != b[i].score)
+            return false;
+    return true;
+}
+
+int main() {
+    Profile live, twin;
+    for (uint32_t u = 0; u < USERS; u++) {
+        string values[ATTR_COUNT] = { u % 2 ? "Lahore" : "Karachi", u % 3 ? "chess" : "cricket", u % 5 ? "FAST" : "LUMS" };
+        live.createProfile("User", userId(u), values);
+        twin.createProfile("User", userId(u), values);
+    }
+    live.setIncrementalSuggestions(true);
+    mt19937 rng(23);
+    int countFailures = 0, suggestionFailures = 0;
+    for (int s = 0; s < STEPS && countFailures + suggestionFailures < 5; s++) {
+        step(live, twin, rng);
+        if (!countsMatch(live)) {
+            cerr << "step " << s << ": counts differ from a rebuild\n";
+            countFailures++;
+        }
+        twin.setIncrementalSuggestions(false); // drops its counts and cached lists
+        twin.setIncrementalSuggestions(true);
+        for (uint32_t u = 0; u < USERS; u++) {
+            size_t limit = LIMITS[(s + u) % 3];
+            vector<Suggestion> cached, fresh;
+            live.suggestFriends(userId(u), limit, cached);
+            twin.suggestFriends(userId(u), limit, fresh);
+            if (!sameSuggestions(cached, fresh)) {
+                cerr << "step " << s << ": cached suggestions for " << userId(u) << " differ from a fresh cache\n";
+                suggestionFailures++;
+                break;
+            }
+        }
+    }
+    CHECK(countFailures == 0);
+    CHECK(suggestionFailures == 0);
+    CHECK(live.commonFriendPairs() > 0);
+    return finish("incremental_counts");
+}
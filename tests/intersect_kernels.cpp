@@ -0,0 +1,103 @@
+// Every sorted-set intersection kernel against std::set_intersection, both
+// listing and count-only: empty and one-element rows, equal lengths, tails
+// shorter than a vector block, disjoint and identical rows, random rows.
+//   g++ -std=c++17 -O2 -pthread tests/intersect_kernels.cpp -o intersect_kernels && ./intersect_kernels
+#include "check.h"
+
+struct Kernel {
+    const char* name;
+    IntersectFn fn;
+    bool smallFirst; // needs na <= nb
+};
+
+static vector<Kernel> kernels() {
+    vector<Kernel> out;
+    Kernel merge = { "merge", intersectMerge, false };
+    Kernel galloping = { "galloping", intersectGalloping, true };
+    Kernel sorted = { "intersectSorted", intersectSorted, false };
+    out.push_back(merge);
+    out.push_back(galloping);
+    out.push_back(sorted);
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    Kernel sse = { "sse4.2", intersectSSE, false };
+    Kernel avx2 = { "avx2", intersectAVX2, false };
+    if (__builtin_cpu_supports("sse4.2")) out.push_back(sse);
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("sse4.2")) out.push_back(avx2);
+#endif
+    return out;
+}
+
+static size_t checked = 0;
+
+static void compare(const vector<uint32_t>& a, const vector<uint32_t>& b) {
+    vector<uint32_t> want;
+    set_intersection(a.begin(), a.end(), b.begin(), b.end(), back_inserter(want));
+    vector<Kernel> all = kernels();
+    for (size_t k = 0; k < all.size(); k++) {
+        const vector<uint32_t>& x = all[k].smallFirst && a.size() > b.size() ? b : a;
+        const vector<uint32_t>& y = &x == &a ? b : a;
+        vector<uint32_t> got(min(a.size(), b.size()) + 1, 0xFFFFFFFFu);
+        size_t n = all[k].fn(x.data(), x.size(), y.data(), y.size(), got.data());
+        size_t counted = all[k].fn(x.data(), x.size(), y.data(), y.size(), NULL);
+        got.resize(min(n, got.size()));
+        if (got != want || counted != want.size()) {
+            cerr << all[k].name << ": " << a.size() << " x " << b.size() << " ids, expected " << want.size()
+                 << " common, listed " << n << ", counted " << counted << "\n";
+            CHECK(got == want && counted == want.size());
+        }
+        checked++;
+    }
+}
+
+// count distinct ids from [0, universe), ascending
+static vector<uint32_t> randomRow(mt19937& rng, size_t count, uint32_t universe) {
+    vector<uint32_t> row;
+    for (uint32_t id = 0; id < universe && row.size() < count; id++)
+        if (rng() % (universe - id) < count - row.size()) row.push_back(id);
+    return row;
+}
+
+static vector<uint32_t> range(uint32_t first, size_t count, uint32_t step) {
+    vector<uint32_t> row;
+    for (size_t i = 0; i < count; i++) row.push_back(first + (uint32_t)i * step);
+    return row;
+}
+
+int main() {
+    mt19937 rng(11);
+    vector<uint32_t> none;
+    // Empty and one-element rows
+    compare(none, none);
+    compare(none, range(0, 20, 1));
+    compare(range(5, 1, 1), none);
+    compare(range(5, 1, 1), range(5, 1, 1));
+    compare(range(5, 1, 1), range(6, 1, 1));
+    compare(range(7, 1, 1), range(0, 40, 1));
+    compare(range(0, 40, 1), range(39, 1, 1));
+    // Every pair of short lengths, so each kernel ends on a partial block
+    for (size_t na = 0; na <= 20; na++)
+        for (size_t nb = 0; nb <= 20; nb++) {
+            compare(randomRow(rng, na, 32), randomRow(rng, nb, 32));
+            compare(range(0, na, 2), range(0, nb, 3)); // every sixth id shared
+        }
+    // Equal lengths, including whole blocks only
+    for (size_t n = 4; n <= 64; n += 4) {
+        compare(randomRow(rng, n, (uint32_t)n * 2), randomRow(rng, n, (uint32_t)n * 2));
+        compare(range(0, n, 1), range(0, n, 1));     // identical
+        compare(range(0, n, 2), range(1, n, 2));     // interleaved, disjoint
+        compare(range(0, n, 1), range((uint32_t)n, n, 1)); // disjoint, one after the other
+    }
+    // Long rows, identical and disjoint, and skewed sizes that gallop
+    compare(range(0, 1000, 3), range(0, 1000, 3));
+    compare(range(0, 1000, 2), range(1, 1000, 2));
+    compare(range(100000, 1000, 1), range(0, 1000, 1));
+    for (int t = 0; t < 200; t++) {
+        size_t na = rng() % 300, nb = rng() % 300;
+        if (t % 4 == 0) nb = na * 40 + rng() % 100;
+        uint32_t universe = (uint32_t)(max(na, nb) + 1) * (1 + rng() % 4);
+        compare(randomRow(rng, na, universe), randomRow(rng, nb, universe));
+    }
+    CHECK(checked > 0);
+    return finish("intersect_kernels");
+}
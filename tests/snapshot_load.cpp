@@ -0,0 +1,100 @@
+// Snapshot loading: the bulk-built name and attribute indexes answer like
+// the ones built user by user, and files whose message seqs run backwards
+// or past the stored clock are rejected as corrupt.
+//   g++ -std=c++17 -O2 -pthread tests/snapshot_load.cpp -o snapshot_load && ./snapshot_load
+#include "check.h"
+
+static const string PATH = "snapshot-load-test.snap";
+static const uint32_t USERS = 3000;
+static const char* WORDS[] = { "ali", "alina", "kari", "morasa", "moreno", "sara", "saad", "zoya", "\xc3\xa9lise", "an" };
+static const char* CITIES[] = { "Lahore", "Karachi", "Multan" };
+
+// Names of one to three words, often shared, so the trie branches and
+// many users end at the same keys; only u1 receives messages
+static void buildNetwork(Profile& profile) {
+    mt19937 rng(7);
+    for (uint32_t u = 0; u < USERS; u++) {
+        string name;
+        for (uint32_t w = 0, words = 1 + rng() % 3; w < words; w++) name += (w ? " " : "") + string(WORDS[rng() % 10]);
+        string values[ATTR_COUNT] = { CITIES[rng() % 3], "chess", u % 2 ? "FAST" : "" };
+        CHECK(profile.createProfile(name, "u" + to_string(u), values) == STATUS_OK);
+    }
+    for (uint32_t u = 2; u < USERS; u += 3) {
+        CHECK(profile.sendFriendRequest("u" + to_string(u), "u1") == STATUS_OK);
+        CHECK(profile.acceptFriendRequest("u1", "u" + to_string(u)) == STATUS_OK);
+        CHECK(profile.sendMessage("u" + to_string(u), "u1", "hello") == STATUS_OK);
+    }
+}
+
+static string describe(const vector<NameMatch>& matches) {
+    string s;
+    for (size_t i = 0; i < matches.size(); i++) s += matches[i].user->id + "/" + to_string(matches[i].edits) + " ";
+    return s;
+}
+
+static void sameAnswers(Profile& built, Profile& loaded) {
+    const char* queries[] = { "ali", "kari mor", "morasa", "sara zo", "alnia", "morena", "\xc3\xa9l", "an", "saad kari moreno" };
+    for (size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); q++) {
+        const char* searchers[] = { "", "u1" };
+        for (int s = 0; s < 2; s++) {
+            vector<NameMatch> a, b;
+            CHECK(built.searchUsersByName(searchers[s], queries[q], 50, a) == STATUS_OK);
+            CHECK(loaded.searchUsersByName(searchers[s], queries[q], 50, b) == STATUS_OK);
+            CHECK(describe(a) == describe(b));
+        }
+    }
+    vector<AttributeTerm> terms(2);
+    terms[0].attr = ATTR_CITY;
+    terms[0].value = "Multan";
+    terms[1].attr = ATTR_INSTITUTION;
+    terms[1].value = "FAST";
+    for (int all = 0; all < 2; all++) {
+        vector<UserNode*> a, b;
+        CHECK(built.findUsersByAttribute(terms, all == 1, a) == STATUS_OK);
+        CHECK(loaded.findUsersByAttribute(terms, all == 1, b) == STATUS_OK);
+        CHECK(a.size() == b.size());
+        for (size_t i = 0; i < a.size() && i < b.size(); i++) CHECK(a[i]->id == b[i]->id);
+    }
+    for (uint32_t u = 0; u < USERS; u += 97) {
+        UserNode* a = built.userAt(u);
+        UserNode* b = loaded.findUser("u" + to_string(u));
+        CHECK(b != NULL && b->name == a->name && b->index == a->index && b->readSeq == a->readSeq);
+    }
+}
+
+// The snapshot with one 64-bit field overwritten is refused and leaves the
+// network empty
+static void rejected(const string& image, size_t offset, uint64_t value) {
+    string damaged = image;
+    memcpy(&damaged[offset], &value, sizeof(value));
+    writeFile(PATH, damaged);
+    Profile profile;
+    CHECK(profile.loadSnapshot(PATH) == STATUS_CORRUPT);
+    CHECK(profile.userCount() == 0);
+}
+
+int main() {
+    Profile built;
+    buildNetwork(built);
+    CHECK(built.saveSnapshot(PATH) == STATUS_OK);
+    {
+        Profile loaded;
+        CHECK(loaded.loadSnapshot(PATH) == STATUS_OK);
+        CHECK(loaded.userCount() == USERS);
+        sameAnswers(built, loaded);
+    }
+
+    string image = readFile(PATH);
+    SnapshotHeader h;
+    memcpy(&h, image.data(), sizeof(h));
+    size_t messages = h.inboxOffset + (h.userCount + 1) * sizeof(uint64_t); // all in u1's inbox
+    size_t seqAt = offsetof(SnapshotMessage, seq);
+    uint64_t firstSeq;
+    memcpy(&firstSeq, image.data() + messages + seqAt, sizeof(firstSeq));
+    rejected(image, messages + sizeof(SnapshotMessage) + seqAt, firstSeq); // repeats the one before
+    rejected(image, messages + seqAt, 0);
+    rejected(image, messages + 2 * sizeof(SnapshotMessage) + seqAt, h.messageClock + 1);
+    rejected(image, h.usersOffset + offsetof(SnapshotUser, readSeq), h.messageClock + 1);
+    remove(PATH.c_str());
+    return finish("snapshot_load");
+}
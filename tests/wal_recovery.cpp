@@ -0,0 +1,111 @@
+// Group commit deadline, and recovery of a data store whose log was damaged
+// by a crash: a torn last record and a record that fails its CRC.
+//   g++ -std=c++17 -O2 -pthread tests/wal_recovery.cpp -o wal_recovery && ./wal_recovery
+#include "check.h"
+
+static const string PREFIX = "wal-recovery-test";
+
+// Byte offset of every record in a log image
+static vector<size_t> recordOffsets(const string& log) {
+    vector<size_t> offsets;
+    size_t pos = WAL_HEADER_BYTES;
+    while (pos + WAL_RECORD_HEADER <= log.size()) {
+        uint32_t length;
+        memcpy(&length, log.data() + pos, 4);
+        offsets.push_back(pos);
+        pos += WAL_RECORD_HEADER + length;
+    }
+    return offsets;
+}
+
+static size_t inboxSize(Profile& profile, const string& userId) {
+    MessagePage page;
+    if (profile.readMessages(userId, 0, 100, page) != STATUS_OK) return 0;
+    return page.total;
+}
+
+// Three users, one friendship and three messages to b: 8 log records
+static string buildLog() {
+    remove((PREFIX + ".snap").c_str());
+    remove((PREFIX + ".wal").c_str());
+    {
+        Profile profile;
+        StoreInfo info;
+        CHECK(profile.openStore(PREFIX, info) == STATUS_OK);
+        string values[ATTR_COUNT] = { "Lahore", "chess", "FAST" };
+        CHECK(profile.createProfile("Ann", "a", values) == STATUS_OK);
+        CHECK(profile.createProfile("Bob", "b", values) == STATUS_OK);
+        CHECK(profile.createProfile("Cat", "c", values) == STATUS_OK);
+        CHECK(profile.sendFriendRequest("a", "b") == STATUS_OK);
+        CHECK(profile.acceptFriendRequest("b", "a") == STATUS_OK);
+        CHECK(profile.sendMessage("a", "b", "one") == STATUS_OK);
+        CHECK(profile.sendMessage("a", "b", "two") == STATUS_OK);
+        CHECK(profile.sendMessage("a", "b", "three") == STATUS_OK);
+    } // closing the store commits the log
+    return readFile(PREFIX + ".wal");
+}
+
+static void tornTail(const string& log) {
+    vector<size_t> offsets = recordOffsets(log);
+    CHECK(offsets.size() == 8);
+    // The crash hit halfway through writing the last message
+    writeFile(PREFIX + ".wal", log.substr(0, log.size() - 5));
+    {
+        Profile profile;
+        StoreInfo info;
+        CHECK(profile.openStore(PREFIX, info) == STATUS_OK);
+        CHECK(info.replayed == 7);
+        CHECK(info.discardedBytes == log.size() - 5 - offsets.back());
+        CHECK(profile.areFriends(profile.findUser("a"), profile.findUser("b")));
+        CHECK(inboxSize(profile, "b") == 2);
+        CHECK(profile.sendMessage("a", "b", "three again") == STATUS_OK);
+    }
+    // Appending resumed where the torn record began
+    Profile profile;
+    StoreInfo info;
+    CHECK(profile.openStore(PREFIX, info) == STATUS_OK);
+    CHECK(info.discardedBytes == 0);
+    CHECK(inboxSize(profile, "b") == 3);
+}
+
+static void crcMismatch(const string& log) {
+    vector<size_t> offsets = recordOffsets(log);
+    // One flipped bit in the text of the first message; it and everything
+    // after it are cut off, everything before it replays
+    string damaged = log;
+    damaged[offsets[5] + WAL_RECORD_HEADER + 20] ^= 0x10;
+    writeFile(PREFIX + ".wal", damaged);
+    Profile profile;
+    StoreInfo info;
+    CHECK(profile.openStore(PREFIX, info) == STATUS_OK);
+    CHECK(info.replayed == 5);
+    CHECK(info.discardedBytes == log.size() - offsets[5]);
+    CHECK(profile.findUser("c") != NULL);
+    CHECK(profile.areFriends(profile.findUser("a"), profile.findUser("b")));
+    CHECK(inboxSize(profile, "b") == 0);
+}
+
+// A record left alone is written out by the flusher once GROUP_NANOS pass,
+// without another append or a commit
+static void deadlineFlush() {
+    remove((PREFIX + ".snap").c_str());
+    remove((PREFIX + ".wal").c_str());
+    Profile profile;
+    StoreInfo info;
+    CHECK(profile.openStore(PREFIX, info) == STATUS_OK);
+    string values[ATTR_COUNT] = { "Lahore", "chess", "FAST" };
+    CHECK(profile.createProfile("Ann", "a", values) == STATUS_OK);
+    this_thread::sleep_for(chrono::milliseconds(200));
+    CHECK(profile.logSyncs() == 1);
+    CHECK(readFile(PREFIX + ".wal").size() > WAL_HEADER_BYTES);
+}
+
+int main() {
+    deadlineFlush();
+    string log = buildLog();
+    tornTail(log);
+    crcMismatch(log);
+    remove((PREFIX + ".snap").c_str());
+    remove((PREFIX + ".wal").c_str());
+    return finish("wal_recovery");
+}